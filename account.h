@@ -1,12 +1,19 @@
 #ifndef ACCOUNT_H
 #define ACCOUNT_H
 
+#ifndef MICROSIM_HEADLESS
 #include "QtCharts/qchartview.h"
+#endif
 #include <QObject>
+#include <atomic>
 #include <iostream>
 #include <list>
+#include <mutex>
+#include <vector>
 #include <QList>
+#ifndef MICROSIM_HEADLESS
 #include <QListWidgetItem>
+#endif
 #include <QDebug>
 
 class Statistics;
@@ -15,12 +22,27 @@ class Government;
 
 #include <map>
 #include <QVector>
+#ifndef MICROSIM_HEADLESS
 #include <QtCharts/QLineSeries>
+#include <QtCharts/QAreaSeries>
 #include <QLineSeries>
+#include <QPointF>
+#endif
 #include <QSettings>
 #include <QMap>
 
+#include "inequality.h"
+#include "profiler.h"
+#include "randomstream.h"
+
+/*
+ * MICROSIM_HEADLESS is defined by the batch target (microsim-batch.pro), which
+ * links only the engine against QtCore. Anything to do with charts or widgets
+ * must be excluded from that build.
+ */
+#ifndef MICROSIM_HEADLESS
 QT_CHARTS_USE_NAMESPACE
+#endif
 
 
 /*
@@ -45,7 +67,9 @@ enum class ParamType {
     bus_int,
     loan_prob,
     std_wage,
-    gov_size
+    gov_size,
+
+    num_params      // must be last
 };
 
 enum class Reason {
@@ -109,6 +133,230 @@ class Bank;
 class Worker;
 class Firm;
 class Government;
+class Domain;
+class DerivedProperties;
+
+/******************************************************************************
+ * WorkerStore holds the frequently used ('hot') fields of all the workers in a
+ * domain as a set of parallel arrays, one per field, indexed by worker. Each
+ * Worker object is just a view onto its own slot. This means that the loops
+ * that aggregate over the whole population (e.g. for statistics) run over
+ * contiguous memory rather than chasing a pointer to every worker.
+ ******************************************************************************/
+
+struct WorkerStore
+{
+    QVector<double> balance;
+    QVector<double> wages;
+    QVector<double> purchases;
+    QVector<double> inc_tax;
+    QVector<double> benefits;
+    QVector<double> average_wages;
+    QVector<double> agreed_wage;
+
+    /*
+     * Index of the worker's employer in Domain::employers, or -1 if the
+     * worker is unemployed
+     */
+    QVector<int> employer;
+
+    /*
+     * Position of the worker in Domain::unemployed, or -1 if the worker is
+     * employed
+     */
+    QVector<int> pool_pos;
+
+    /*
+     * Set the number of slots and clear all of them
+     */
+    void reset(int n)
+    {
+        balance.fill(0.0, n);
+        wages.fill(0.0, n);
+        purchases.fill(0.0, n);
+        inc_tax.fill(0.0, n);
+        benefits.fill(0.0, n);
+        average_wages.fill(0.0, n);
+        agreed_wage.fill(0.0, n);
+        employer.fill(-1, n);
+        pool_pos.fill(-1, n);
+    }
+
+    int count() const
+    {
+        return employer.count();
+    }
+
+    /*
+     * Memory used per worker (one element of each column), for reporting
+     */
+    static size_t bytesPerWorker()
+    {
+        return sizeof(decltype(balance)::value_type)
+                + sizeof(decltype(wages)::value_type)
+                + sizeof(decltype(purchases)::value_type)
+                + sizeof(decltype(inc_tax)::value_type)
+                + sizeof(decltype(benefits)::value_type)
+                + sizeof(decltype(average_wages)::value_type)
+                + sizeof(decltype(agreed_wage)::value_type)
+                + sizeof(decltype(employer)::value_type)
+                + sizeof(decltype(pool_pos)::value_type);
+    }
+};
+
+/*
+ * Running totals for a group of accounts. These are kept up to date by the
+ * operations that change them (credit, transferSafely, loan, hire and fire)
+ * so that properties can be evaluated without visiting every account. The
+ * domain keeps one for the business sector (the firms in Domain::firms, but
+ * not the government or the banks) and one for households (the workers).
+ */
+struct SectorTotals
+{
+    int employees = 0;
+    double balance = 0;
+    double owed = 0;
+    double wages = 0;
+    double purchases = 0;
+    double sales_receipts = 0;
+    double sales_tax = 0;
+    double inc_tax = 0;
+    double investment = 0;
+
+    void clear()
+    {
+        *this = SectorTotals();
+    }
+};
+
+/*
+ * The value of every property in every recorded (non-silent) period of a run,
+ * held as one column per property. Row r of each column is the value for
+ * period first_period + r. Because every property is recorded (unless the
+ * domain was told otherwise -- see Domain::setRecordedProperties), any of
+ * them can be charted (or written out) after the run without running it
+ * again.
+ */
+struct PropertyRecord
+{
+    int first_period = 0;
+    QVector<double> columns[static_cast<int>(Property::num_properties)];
+
+    /*
+     * Empty every column, leaving room for the given number of periods
+     */
+    void clear(int periods = 0)
+    {
+        for (QVector<double> &column : columns)
+        {
+            column.clear();
+            column.reserve(periods);
+        }
+    }
+
+    int count() const
+    {
+        return columns[0].count();
+    }
+
+    bool isEmpty() const
+    {
+        return columns[0].isEmpty();
+    }
+
+    const QVector<double> &column(Property p) const
+    {
+        return columns[static_cast<int>(p)];
+    }
+
+    /*
+     * The value in the most recently recorded period
+     */
+    double last(Property p) const
+    {
+        return column(p).last();
+    }
+};
+
+/*
+ * A flat copy of a domain's parameters (see Domain::params), indexed by
+ * ParamType and already converted to double, so that reading one is a single
+ * array access rather than a QMap lookup. Parameters that aren't set are
+ * zero. It is only read, so any number of threads can read it at once.
+ */
+struct ParameterBlock
+{
+    double values[static_cast<int>(ParamType::num_params)] = {};
+
+    double operator[](ParamType type) const
+    {
+        return values[static_cast<int>(type)];
+    }
+
+    void load(const QMap<ParamType,int> &params);
+};
+
+/*
+ * How to evaluate a property: the properties it is calculated from, and a
+ * function that calculates it given the domain and the values already
+ * calculated for the period (which include all of those properties). See
+ * Domain::propertyRules.
+ */
+struct PropertyRule
+{
+    typedef double (*Evaluator)(Domain *dom, const double *values);
+
+    QVector<Property> depends;
+    Evaluator evaluate = nullptr;
+};
+
+/*
+ * An evaluation plan, compiled from the rules for a given set of properties.
+ * It holds the steps needed to evaluate those properties and everything they
+ * depend on (and nothing else), ordered so that every property comes after
+ * the properties it depends on. Evaluating it is then a single pass over the
+ * steps, with no lookups or branches on the property.
+ */
+class PropertyPlan
+{
+public:
+
+    /*
+     * Compile a plan for the given properties, or for all of them if the
+     * list is empty. The rules are indexed by Property and must not depend
+     * on each other in a cycle.
+     */
+    void compile(const QVector<PropertyRule> &rules, const QList<Property> &wanted);
+
+    /*
+     * Set the value of each property in the plan, indexed by Property.
+     * Other values are left as they are.
+     */
+    void evaluate(Domain *dom, double *values) const
+    {
+        for (const Step &step : steps)
+        {
+            values[step.index] = step.evaluate(dom, values);
+        }
+    }
+
+    bool includes(Property p) const;
+
+    int count() const
+    {
+        return steps.count();
+    }
+
+private:
+
+    struct Step
+    {
+        int index;
+        PropertyRule::Evaluator evaluate;
+    };
+
+    QVector<Step> steps;
+};
 
 /******************************************************************************
  *
@@ -123,6 +371,7 @@ class Domain : public QObject
 
     friend class Firm;
     friend class Government;
+    friend class Worker;
 
 public:
 
@@ -141,6 +390,13 @@ public:
      */
     static void initialisePropertyMap();
 
+    /*
+     * The user-defined properties, which appear in the property list after
+     * the built-in ones. They are read from settings explicitly (see
+     * DerivedProperties::read), after initialisePropertyMap.
+     */
+    static DerivedProperties derivedProperties;
+
     /*
      * Restore all listed domains from Settings, storing their pointers in
      * domains amd returning the number of domains restored. Must be public so
@@ -156,16 +412,62 @@ public:
      */
     static Domain *createDomain(const QString &name);
 
+    /*
+     * Create a copy of the configuration of an existing domain (its name,
+     * currency, parameters, random seed and inequality mode) with the given
+     * parameters overridden, and reset it ready to run. The copy is NOT added
+     * to domains and must be deleted by the caller. Used for parameter sweeps
+     * (see Sweep), where many copies are run at once on different threads.
+     */
+    static Domain *cloneDomain(const Domain *base,
+                               const QMap<ParamType,int> &overrides);
+
+    ~Domain();
+
     /*
      * List of all domains. When a new domain is created or restored it is
-     * automatically added to this list.
+     * automatically added to this list. Clones (see cloneDomain) are not, as
+     * they are made and deleted on other threads and the list is only used
+     * on the main thread.
      */
     static QList<Domain*> domains;
 
+#ifndef MICROSIM_HEADLESS
+    /*
+     * Set up all charts for the checked properties and fill them with the
+     * values recorded so far. This doesn't run the model (see
+     * SimulationRunner), so it is used when a property is checked or
+     * unchecked, and at the start and end of each run.
+     */
+    static void redrawCharts(QListWidget *propertyList);
+
+    /*
+     * Refill the existing series of all charts with the values recorded so
+     * far. Called periodically while a run is in progress.
+     */
+    static void updateCharts();
+
+    /*
+     * True if every domain has recorded at least one period
+     */
+    static bool recordsAvailable();
+
+    /*
+     * As redrawCharts and updateCharts, but for this domain's chart alone.
+     * They do nothing if the domain doesn't have a chart yet.
+     */
+    void redrawChart(QListWidget *propertyList);
+    void updateChart();
+
     /*
-     * Draw all charts
+     * Run this domain many times with different seeds (see Ensemble) and
+     * record the results. Stops early if *cancel becomes true, and adds one
+     * to *progress for each period run.
      */
-    static void drawCharts(QListWidget *propertyList);
+    void runEnsemble(int max_runs, double tolerance, int iterations,
+                     int start_period, const std::atomic<bool> *cancel,
+                     std::atomic<int> *progress);
+#endif
 
 
     /*********************************************************
@@ -183,8 +485,43 @@ public:
 
     void reset();
 
+    /*
+     * Read the general settings that affect a run (the inequality mode,
+     * random seed and number of start-ups). This is done by reset(), but can
+     * also be done on its own, followed by runHash(0, start_period), to see
+     * whether a domain that has been run can be continued (because nothing
+     * but the run length has changed) rather than run again.
+     */
+    void readSettings();
+
+    /*
+     * Save the complete state of the domain at the end of the last period
+     * run (its workers, firms, banks and government, with their balances,
+     * loans and employment links, the running totals, the record and the
+     * random seed) to a file, or restore it from one, in place of reset().
+     * A state can only be restored into a domain of the same name, as the
+     * name keys its random streams. Running the restored domain from
+     * lastPeriod() + 1 gives the same results as continuing the original.
+     * See checkpoint.cpp for the format. On failure these return false and
+     * set error. The whole file is checked before the domain is changed, so
+     * a domain that fails to restore is left as it was.
+     */
+    bool saveState(const QString &fileName, QString &error) const;
+    bool restoreState(const QString &fileName, QString &error);
+
+    /*
+     * The last period run, or -1 if none has been run since reset()
+     */
+    int lastPeriod() const;
+
     Firm *createFirm(bool state_supported = false);
-    Firm *selectRandomFirm(Firm *exclude = nullptr);
+
+    /*
+     * Return a firm chosen uniformly from the firms list (which doesn't
+     * include the government or the banks), excluding the firm indicated by
+     * exclude. If there are none nullptr is returned.
+     */
+    Firm *selectRandomFirm(RandomStream &rs, Firm *exclude = nullptr);
 
     Government *government();
 
@@ -275,9 +612,27 @@ public:
      * ParameterSets. This has been temporarily suspended so now we just have
      * a single set of parameters, which will have to be defined as a QMap
      * with the ParamType as key. The value is always (I think) an integer.
+     *
+     * The engine doesn't read params directly but a flat copy of it (see
+     * parameter()), so changes take effect from the next period (or reset).
      */
     QMap<ParamType,int> params;
 
+    /*
+     * Copy params into the block read by parameter() and the get...()
+     * functions below. Done by reset() and at the start of every period.
+     */
+    void loadParameters();
+
+    /*
+     * The value of a parameter as of the start of the current period. This
+     * is cheap enough to use in the per-transaction paths.
+     */
+    double parameter(ParamType type) const
+    {
+        return param_block[type];
+    }
+
     enum class Reason {
         for_benefits,
         for_bonus
@@ -292,10 +647,12 @@ public:
      */
     void readParameters();
 
+#ifndef MICROSIM_HEADLESS
     /*
      * Set the chartview
      */
     void setChartView(QChartView *chartView);
+#endif
 
     /*
      * Return the gini coefficient based on the wages of all the workers.
@@ -321,17 +678,87 @@ public:
     double sum[static_cast<int>(Property::num_properties)];
 
     /*
-     * Retrieve the current (periodic) value associated with a given Property
+     * Retrieve the current (periodic) value associated with a given Property.
+     * This evaluates the property and everything it depends on, so to get
+     * the values of many properties use the record.
      */
     double getPropertyVal(Property p);
 
+    /*
+     * Only evaluate and record the given properties (and any properties they
+     * depend on) in each period, or all of them if the list is empty, which
+     * is the default. Properties that aren't evaluated are recorded as zero.
+     * This takes effect from the next period.
+     */
+    void setRecordedProperties(const QList<Property> &properties);
+
+    /*
+     * The values of all the properties in each recorded period of the last
+     * run. Leave room for the given number of periods before the run (this
+     * is optional). recorded() may only be used on the thread running the
+     * domain, or when it isn't running; snapshot() returns a copy that can
+     * be taken on any thread while the domain is running.
+     */
+    const PropertyRecord &recorded() const;
+    PropertyRecord snapshot() const;
+    void reserveRecord(int periods);
+
+    /*
+     * Timings and counts for each phase of each period since the last reset
+     * (recorded only while profiling is enabled -- see Profiler)
+     */
+    Profiler &profiler();
+
+    /*
+     * Replace the record with one made earlier by an identical run (e.g. read
+     * from a ResultCache), after reset() and instead of running the domain
+     */
+    void restoreRecord(const PropertyRecord &values);
+
+    /*
+     * A hash of everything that determines the results of a run of the given
+     * length: the domain's name (which keys its random streams), currency,
+     * parameters and random seed, the number of start-ups, the inequality
+     * mode and ENGINE_VERSION. Must be called after reset() or
+     * readSettings(). Runs with the same hash record the same values, and
+     * runHash(0, start_period) identifies the configuration apart from the
+     * run length.
+     */
+    QByteArray runHash(int iterations, int start_period) const;
+
+    /*
+     * Return a random stream (see RandomStream) for the current period, for
+     * the given purpose and agent. Workers are identified by their index in
+     * workers and firms (including banks and the government) by their index
+     * in employers; draws made by the domain itself use DOMAIN_AGENT.
+     * Streams are independent of each other, so agents can draw on any
+     * thread and in any order and the results depend only on the seed.
+     */
+    RandomStream randomStream(RandomStream::Purpose purpose, quint64 agent);
+
+    static const quint64 DOMAIN_AGENT = ~Q_UINT64_C(0);
+
+    /*
+     * The seed is read from settings ("random-seed") on reset, so this must
+     * be called after reset() to override it.
+     */
+    void setRandomSeed(quint64 seed);
+    quint64 randomSeed() const;
+
+    /*
+     * Select exact or approximate calculation of the Gini coefficient (see
+     * Inequality). The mode is read from settings ("inequality-mode") on
+     * reset, so this must be called after reset() to override it.
+     */
+    void setInequalityMode(Inequality::Mode mode);
+
     /*
      * Choose a bank. Every worker and every firm will have a bank that will
      * be chosen at random, with the exception of clearing banks -- which must
      * choose the government as their bank, and the government itself -- which
      * is its own bank.
      */
-    Bank *selectRandomBank();
+    Bank *selectRandomBank(RandomStream &rs);
 
     // These are the functions that actually interrogate the components of the
     // model to evaluate its properties
@@ -356,6 +783,10 @@ private:
 
     int last_period = -1;
 
+    int start_ups = 10;     // read from settings on reset
+
+    ParameterBlock param_block;     // see parameter()
+
     QString _name;
     QString _currency;
     QString _abbrev;
@@ -395,22 +826,29 @@ private:
      */
     Domain(const QString &name);
 
-    QChartView *_chartView;
-    QChart *chart;
-
     /*
-     * This gives us a set of pointers to line series, ordered by the Properties
-     * they are associated with. E.g., when iterating, the series for bens_paid
-     * will be encountered before the series for gov_recpts. Order is
-     * significant as it allows us to store values and use them in later
-     * composite properties (e,g, deficit).
+     * See cloneDomain
      */
+    Domain(const Domain *base, const QMap<ParamType,int> &overrides);
 
-    // NOTE: I have changed the order of the properties to alphabetical by
-    // plain-text name -- possibly not a good idea. The order in which the
-    // properties are calculated will need to be reviewed to make sure it still
-    // works.
+#ifndef MICROSIM_HEADLESS
+    QChartView *_chartView = nullptr;
+    QChart *chart = nullptr;
+
+    /*
+     * The line series for each checked property, and for each checked
+     * derived property (by index in derivedProperties)
+     */
     QMap<Property, QLineSeries*> series;
+    QMap<int, QLineSeries*> derived_series;
+
+    /*
+     * In ensemble mode (see runEnsemble) record holds the mean of each
+     * property over all the runs, and these hold the bounds of the band
+     * around it. Otherwise they are empty.
+     */
+    PropertyRecord band_lower;
+    PropertyRecord band_upper;
 
     /*
      * drawChart just sets up the chart with a title and a set of empty series.
@@ -418,8 +856,23 @@ private:
      */
     void drawChart(QListWidget *propertyList);
 
+    /*
+     * Fill the series from the record and add them to the chart
+     */
     void addSeriesToChart();
 
+    /*
+     * Refill the series (already on the chart) from the record
+     */
+    void updateSeries();
+
+    /*
+     * Calculate the derived properties from the given record and refill
+     * their series
+     */
+    void updateDerivedSeries(const PropertyRecord &values);
+#endif
+
     //static void run();
 
     /*
@@ -444,22 +897,151 @@ private:
 
     /*
      * List of all workers, whether employed or not. For now we will assume the
-     * number of workers, unlike firms, will remain unchanged for the duration
+     * number of workers, unlike firms, will remain unchanged for the duration.
+     * Workers are held by value (in a single allocation) rather than being
+     * created individually.
+     */
+    std::vector<Worker> workers;
+
+    /*
+     * The data for each worker. The worker at workers[i] uses slot i.
+     */
+    WorkerStore wstore;
+
+    /*
+     * Identify the random streams for this run of this domain (see
+     * randomStream). domain_key is derived from the name, so it doesn't
+     * depend on the order in which domains are created.
+     */
+    quint64 seed = 1;
+    quint64 domain_key = 0;
+
+    /*
+     * Calculates the Gini coefficient, mean and spread of wages each period.
+     * Holds its own buffer, which is reused.
+     */
+    Inequality inequality;
+
+    /*
+     * Every Firm (including banks and the government) is listed here when it
+     * is created, so that a worker's employer can be held in the WorkerStore
+     * as an index rather than a pointer. Cleared on reset.
+     */
+    QVector<Firm*> employers;
+
+    int registerEmployer(Firm *firm);
+
+    /*
+     * Indices (into workers) of all the workers who are currently unemployed,
+     * kept as a binary min-heap so that the unemployed worker with the lowest
+     * index is always at the front and is the next to be hired, as when the
+     * whole population was scanned for one. WorkerStore::pool_pos gives each
+     * worker's position, so hiring and firing are both O(log n) in the number
+     * unemployed.
+     */
+    QVector<int> unemployed;
+
+    /*
+     * Restore the heap order of the pool after the entry at pos has become
+     * smaller or larger respectively than it was
+     */
+    void poolSiftUp(int pos);
+    void poolSiftDown(int pos);
+
+    /*
+     * Make every worker unemployed and put them all in the pool. This must be
+     * called whenever the workers are reset.
      */
-    QVector<Worker*> workers;
+    void resetUnemployed();
 
     /*
-     * Update the worker to show the new employer and add the worker to the
-     * employer's list of employees.
+     * Return the next unemployed worker to be hired (without hiring them), or
+     * nullptr if there are none.
+     */
+    Worker *nextUnemployed();
+
+    /*
+     * Update the worker to show the new employer, add the worker to the
+     * employer's list of employees and remove the worker from the unemployed
+     * pool.
      */
     void hire(Worker *w, Firm *f);
 
     /*
-     * When a worker is fired s/he is added to the unemployedWorkers list and
-     * employer is set to nullptr.
+     * When a worker is fired s/he is added to the unemployed pool and
+     * employer is set to nullptr. The firm is responsible for removing the
+     * worker from its list of employees.
      */
     void fire(Worker *w);
 
+    /*
+     * See recorded(). The record (and in the GUI the ensemble band) is only
+     * changed, or copied on another thread, with record_mutex locked. QVector
+     * is implicitly shared, so a copy is cheap to take.
+     */
+    PropertyRecord record;
+    mutable std::mutex record_mutex;
+
+    Profiler _profiler;
+
+    /*
+     * Whether this domain is in domains, i.e. isn't a clone
+     */
+    bool _listed = false;
+
+    /*
+     * The rules for evaluating each property, indexed by Property, and the
+     * plan compiled from them for the recorded properties (see
+     * setRecordedProperties)
+     */
+    static const QVector<PropertyRule> &propertyRules();
+    PropertyPlan record_plan;
+
+    /*
+     * Evaluate the recorded properties using record_plan and append the
+     * values of all the properties to the record
+     */
+    void recordProperties(int period);
+
+    /*
+     * Running totals (see SectorTotals). Every firm in the firms list points
+     * to business; all workers contribute to households.
+     */
+    SectorTotals business;
+    SectorTotals households;
+
+    /*
+     * Recalculate the running totals from scratch. This must be called after
+     * any operation that changes accounts without going through the usual
+     * functions, i.e. after resetting or re-initialising firms or workers.
+     */
+    void recountTotals();
+
+    /*
+     * Workers make their purchases in parallel (see purchasePhase). The
+     * workers are divided into shards of a fixed size, and each shard totals
+     * the purchases its workers make from each firm. The shards are then
+     * added up in order and each firm is credited once, so the results don't
+     * depend on the number of threads. The shards are kept between periods to
+     * avoid reallocating them.
+     */
+    struct PurchaseShard
+    {
+        QVector<double> receipts;   // indexed as firms
+        double purchases = 0;
+        int count = 0;              // number of purchases
+    };
+
+    QVector<PurchaseShard> purchase_shards;
+
+    /*
+     * Trigger all the workers to make their purchases. This is equivalent to
+     * calling Worker::trigger for each worker except that each firm is
+     * credited with (and pays sales tax on) its total sales rather than each
+     * sale separately.
+     */
+    void purchasePhase(int period);
+
      /*
      * The government associated with this domain. It might have been possible
      * to conflate the two classes (Government and Domain) but it seems clearer
@@ -471,6 +1053,16 @@ signals:
 
     void domainsRestored();
 
+    /*
+     * Emitted at the end of the stats phase of each non-silent iteration,
+     * before any exogenous changes are made. The values of all the
+     * properties for the period have just been recorded, so a receiver can
+     * read them using recorded().last().
+     * Note that this is emitted on whichever thread is running the domain,
+     * which may not be the GUI thread (see SimulationRunner).
+     */
+    void iterated(int period);
+
 };
 
 
@@ -479,22 +1071,21 @@ signals:
  * the basic overrideable functionality.
  ******************************************************************************/
 
-class Account : public QObject
+class Account
 {
     /*
-     * For the avoidance of doubt: according to Qt docs and several entries on
-     * StackOverflow, the Q_OBJECT macro should be used in every class that
-     * derives *directly or indirectly* from QObject. This means that not only
-     * Account but also all its subclasses must include Q_OBJECT.
+     * Accounts are deliberately not QObjects. They have no signals or slots,
+     * and there can be millions of them, so the extra memory (and time spent
+     * in construction) needed for a QObject would be wasted. Domain, which
+     * does need to be a QObject, is responsible for them.
      */
 
-    Q_OBJECT
-
     friend class Domain;
 
 public:
 
     Account(Domain *domain);
+    virtual ~Account() {}
 
     /*
      * init() may be called at the start of each period
@@ -506,15 +1097,16 @@ public:
     virtual bool isBank() { return _isBank; }
     virtual bool isGovernment() { return _isGovernment; }
 
-    virtual double getBalance();
-    virtual double getAmountOwed();
-
     /*
-     * This function is declared as virtual to allow derived classes to add
-     * functionality, e.g. diagnostics
+     * Workers keep their balances in the domain's WorkerStore and firms
+     * (including banks and the government) in the Firm object, so each
+     * provides its own versions of these
      */
+    virtual double getBalance() = 0;
+    virtual double getAmountOwed();
+
     virtual void credit(double amount, Account *creditor = nullptr,
-                        bool force = false);
+                        bool force = false) = 0;
 
     virtual void loan(double amount, double rate, Account *creditor);
 
@@ -562,29 +1154,20 @@ protected:
      * the central bank, and does not have (or need) an account at a clearing
      * bank. This is rather confusing but is also Quite Neat.
      */
-    Bank *_bank;
+    Bank *_bank = nullptr;
 
     bool _isBank = false;
     bool _isGovernment = false;
 
-    double balance = 0;
-    double owed_to_bank = 0;
-    double interest_rate = 0;
-
     int last_triggered = -1;
 
     virtual bool transferSafely(Account *recipient, double amount,
-                                Account *creditor);
+                                Account *creditor) = 0;
 
 private:
 
     int id;
-    static int _id;
-
-signals:
-
-public slots:
-
+    static std::atomic<int> _id;   // accounts may be created on any thread
 };
 
 
@@ -595,44 +1178,40 @@ public slots:
 
 class Worker: public Account
 {
-    Q_OBJECT
-
     friend class Domain;
     friend class Government;
     friend class Firm;
 
 private:
 
-    int wage;
-    Firm *employer;
-
-    // Receipts and payments for current period only. Must be set to zero on
-    // each trigger (unless re-triggered in same period) and accumulated
-    // throughout period. 'Get' methods must be used to retrieve these values
-    // at the end of each period, for statistics.
-    double purchases;
-    double benefits;
-    double wages;
-    double inc_tax;
+    /*
+     * Index of this worker's slot in the domain's WorkerStore, which holds
+     * the balance, the employer, and the receipts and payments for the
+     * current period (purchases, benefits, wages and income tax). These must
+     * be set to zero on each trigger (unless re-triggered in same period) and
+     * accumulated throughout period. 'Get' methods must be used to retrieve
+     * these values at the end of each period, for statistics.
+     */
+    int ix;
 
     int period_hired;
     int period_fired;
 
-    double agreed_wage;
-    double average_wages = 0;
-
 protected:
 
-    Government *gov;
-
     void init() override;
 
     void setEmployer(Firm*);
     void setPeriodHired(int period);
 
+    bool transferSafely(Account *recipient, double amount,
+                        Account *creditor) override;
+
 public:
 
-    Worker(Domain *domain);
+    Worker(Domain *domain, int ix);
+
+    double getBalance() override;
 
     Firm *getEmployer();
 
@@ -666,10 +1245,9 @@ public:
 
 class Firm: public Account
 {
-    Q_OBJECT
-
     friend class Domain;
     friend class Government;
+    friend class Worker;
 
 private:
 
@@ -688,12 +1266,43 @@ private:
     double productivity = 1;
     double _dedns = 0;
 
+    /*
+     * Record a sale (already credited) and pay sales tax on it
+     */
+    void recordSale(double amount);
+
+    /*
+     * Index of this firm in Domain::employers (see WorkerStore::employer)
+     */
+    int _employer_ix;
+
 protected:
 
+    double balance = 0;
+    double owed_to_bank = 0;
+    double interest_rate = 0;
+
+    /*
+     * The running totals this firm contributes to, or nullptr if it doesn't
+     * contribute to any. Set by the domain.
+     */
+    SectorTotals *_sector = nullptr;
+
+    /*
+     * Change the balance or the amount owed to the bank, keeping the sector
+     * totals up to date. Use these rather than changing balance or
+     * owed_to_bank directly.
+     */
+    void adjustBalance(double amount);
+    void adjustOwed(double amount);
+
     QList<Worker*> employees;
 
     void init() override;
 
+    bool transferSafely(Account *recipient, double amount,
+                        Account *creditor) override;
+
 public:
 
     /*
@@ -726,7 +1335,11 @@ public:
 
     bool isGovernmentSupported() override;
     void trigger(int period) override;
+    double getBalance() override;
+    double getAmountOwed() override;
     void credit(double amount, Account *creditor = nullptr, bool force = false) override;
+    void loan(double amount, double rate, Account *creditor) override;
+    void creditSales(double amount);
 
     Worker *hire(double wage);
     double hireSome(double wage, int number_to_hire);
@@ -770,15 +1383,13 @@ public:
 
 class Bank: public Firm
 {
-    Q_OBJECT
-
     friend class Domain;
 
 public:
     Bank(Domain *domain);
 
     /*
-     * This method overrides the method in the base (Account) class, which
+     * This method overrides the method in the base (Firm) class, which
      * prohibits transfers that would leave a negative balance. This
      * restriction doesn't apply to the government, which creates money
      * precisely by creating transfers that leave a negative balance.
@@ -797,7 +1408,7 @@ private:
      */
     QList<Account*> accounts;
 
-    double reserves;    // HPM, only used for cleaing
+    double reserves = 0;    // HPM, only used for cleaing
 
 };
 
@@ -810,8 +1421,6 @@ private:
 
 class Government: public Bank
 {
-    Q_OBJECT
-
     friend class Domain;
     friend class Firm;
 
@@ -1,4 +1,5 @@
 #include "account.h"
+#include "log.h"
 
 Bank::Bank(Domain *domain) : Firm(domain) //Account(domain)
 {
@@ -8,7 +9,8 @@ Bank::Bank(Domain *domain) : Firm(domain) //Account(domain)
 void Bank::lend(double amount, double rate, Account *recipient)
 {
     recipient->loan(amount, rate, this);
-    balance -= amount;
+    adjustBalance(-amount);
+    _domain->profiler().count(ProfileCounter::loans);
 }
 
 /*
@@ -28,15 +30,15 @@ bool Bank::transferSafely(Account *recipient, double amount, Account *creditor)
     if (amount > balance || recipient == nullptr)
     {
         // TODO: This needs to go into a log somewhere
-        qDebug() << "Account::transferSafely(): done (insufficient funds or no recipient)";
+        LOG_DEBUG(LogCategory::transactions) << "Account::transferSafely(): done (insufficient funds or no recipient)";
         Q_ASSERT(false);
         return false;
     }
     else
     {
-        qDebug() << "crediting" << amount;
+        LOG_DEBUG(LogCategory::transactions) << "crediting" << amount;
         recipient->credit(amount, creditor);
-        balance -= amount;
+        adjustBalance(-amount);
         return true;
     }
 
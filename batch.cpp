@@ -0,0 +1,731 @@
+/*
+ * batch.cpp
+ *
+ * Headless batch runner. This runs a single domain for a given number of
+ * periods without any GUI and writes the value of each selected property for
+ * each (non-silent) period to a file. It uses the same settings file as the
+ * GUI, so the domain and chart profile names are those that appear there.
+ *
+ * Usage:
+ *
+ *     obson-batch [options] <domain>
+ *
+ *     -p, --profile <name>       write the properties checked in this chart
+ *                                profile (default: all properties). This
+ *                                includes derived properties (see
+ *                                derived.h), except in sweeps and ensembles.
+ *     -n, --iterations <n>       number of periods to record (default: the
+ *                                'iterations' setting)
+ *     -s, --start-period <n>     number of silent periods to run first
+ *                                (default: the 'start-period' setting)
+ *     -o, --output <file>        output file (default: stdout)
+ *     -c, --csv                  comma-separated rather than tab-separated
+ *     -b, --binary               write a binary results file (see
+ *                                resultfile.h) rather than text. Needs -o.
+ *     -f, --float                with -b, store the values as floats rather
+ *                                than doubles
+ *     -m, --memory-report        report the memory used by the domain's
+ *                                agents on stderr before running
+ *     -g, --inequality <mode>    'exact' or 'approximate' calculation of the
+ *                                Gini coefficient (default: the
+ *                                'inequality-mode' setting)
+ *     -r, --seed <n>             random seed (default: the 'random-seed'
+ *                                setting, or 1)
+ *     -T, --trace <file>         time each phase of each period (see
+ *                                profiler.h), write the timings to <file>
+ *                                as a Chrome/Perfetto trace, and report the
+ *                                totals on stderr. Not for sweeps or
+ *                                ensembles.
+ *
+ * Checkpoints:
+ *
+ *     -w, --save-state <file>    save the state of the domain to <file> at
+ *                                the end of the run
+ *     -i, --load-state <file>    start from the state saved in <file> (by
+ *                                -w) instead of from the beginning. The
+ *                                periods up to the one at which it was saved
+ *                                are not run again, so e.g. a state saved
+ *                                after the silent periods skips them.
+ *
+ * Parameter sweeps:
+ *
+ *     -x, --vary <key=values>    vary the parameter with settings key <key>
+ *                                over the given values, either a list
+ *                                (10,20,50) or a range (first:last:step).
+ *                                May be repeated to sweep over a grid.
+ *     -l, --points <file>        run the points listed in <file>, which has
+ *                                a header line of parameter keys and a line
+ *                                of values for each point
+ *     -j, --jobs <n>             run at most <n> points at once (default: one
+ *                                per core)
+ *
+ * Ensembles:
+ *
+ *     -e, --ensemble <n>         run the domain <n> times with different
+ *                                random seeds and write the mean and the 5th
+ *                                and 95th percentiles of each property for
+ *                                each period (see ensemble.h)
+ *     -t, --tolerance <pct>      stop the ensemble early once a batch of runs
+ *                                changes no mean or percentile by more than
+ *                                <pct> percent
+ *
+ * If -x or -l is given, the domain is run once for each point (every
+ * combination of the values given) and one row is written per point, giving
+ * the final, mean, minimum and maximum value of each property (see sweep.h).
+ */
+
+#include "account.h"
+#include "derived.h"
+#include "ensemble.h"
+#include "exporter.h"
+#include "log.h"
+#include "profiler.h"
+#include "resultfile.h"
+#include "sweep.h"
+#include "version.h"
+
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QFile>
+#include <QTextStream>
+#include <QSettings>
+#include <QDebug>
+
+#include <stdio.h>
+
+/*
+ * Estimates used by the memory report: the private data that Qt 5 allocates
+ * for each QObject (on x86-64), and the heap's bookkeeping for one allocation
+ */
+#define QOBJECT_PRIVATE_SIZE    112
+#define MALLOC_OVERHEAD         (2 * sizeof(size_t))
+
+/*
+ * Report the time spent in each phase, and the counts, over a whole run
+ */
+static void printProfile(const ProfileSummary &summary)
+{
+    const double total = double(summary.duration());
+
+    fprintf(stderr, "%-18s %12s %12s %7s\n", "Phase", "Total (ms)",
+            "Mean (us)", "%");
+    for (int i = 0; i < int(ProfilePhase::num_phases); i++)
+    {
+        double t = double(summary.phases[i]);
+        fprintf(stderr, "%-18s %12.3f %12.3f %7.2f\n",
+                Profiler::phaseName(ProfilePhase(i)).toLocal8Bit().constData(),
+                t / 1e6, summary.periods > 0 ? t / 1e3 / summary.periods : 0.0,
+                total > 0 ? 100 * t / total : 0.0);
+    }
+    fprintf(stderr, "%-18s %12.3f %12.3f\n", "All", total / 1e6,
+            summary.periods > 0 ? total / 1e3 / summary.periods : 0.0);
+
+    for (int i = 0; i < int(ProfileCounter::num_counters); i++)
+    {
+        fprintf(stderr, "%-18s %12lld\n",
+                Profiler::counterName(ProfileCounter(i)).toLocal8Bit().constData(),
+                static_cast<long long>(summary.counts[i]));
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+
+    /*
+     * These must match the settings in main.cpp so that we read the same
+     * settings file as the GUI
+     */
+    QCoreApplication::setOrganizationName("Obson.net");
+    QCoreApplication::setOrganizationDomain("Obson.net");
+    QCoreApplication::setApplicationName("MicroSim");
+    QCoreApplication::setApplicationVersion(VERSION);
+
+    QSettings::setDefaultFormat(QSettings::IniFormat);
+
+    Log::readSettings();
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Run a MicroSim domain without the GUI");
+    parser.addHelpOption();
+    parser.addVersionOption();
+    parser.addPositionalArgument("domain", "Name of the domain to run");
+
+    QCommandLineOption profileOption(
+                QStringList() << "p" << "profile",
+                "Record the properties checked in chart profile <name>.",
+                "name");
+    QCommandLineOption itersOption(
+                QStringList() << "n" << "iterations",
+                "Number of periods to record.",
+                "n");
+    QCommandLineOption startOption(
+                QStringList() << "s" << "start-period",
+                "Number of silent periods to run before recording.",
+                "n");
+    QCommandLineOption outputOption(
+                QStringList() << "o" << "output",
+                "Write results to <file> instead of stdout.",
+                "file");
+    QCommandLineOption csvOption(
+                QStringList() << "c" << "csv",
+                "Separate values with commas rather than tabs.");
+    QCommandLineOption binaryOption(
+                QStringList() << "b" << "binary",
+                "Write a binary results file rather than text (needs -o).");
+    QCommandLineOption floatOption(
+                QStringList() << "f" << "float",
+                "Store the values in a binary results file as floats.");
+    QCommandLineOption memOption(
+                QStringList() << "m" << "memory-report",
+                "Report the memory used per agent before running.");
+    QCommandLineOption inequalityOption(
+                QStringList() << "g" << "inequality",
+                "Calculate the Gini coefficient <mode> 'exact' or 'approximate'.",
+                "mode");
+
+    QCommandLineOption seedOption(
+                QStringList() << "r" << "seed",
+                "Use random seed <n>.",
+                "n");
+    QCommandLineOption traceOption(
+                QStringList() << "T" << "trace",
+                "Time each phase of each period and write a trace to <file>.",
+                "file");
+
+    QCommandLineOption saveStateOption(
+                QStringList() << "w" << "save-state",
+                "Save the state of the domain to <file> at the end of the run.",
+                "file");
+    QCommandLineOption loadStateOption(
+                QStringList() << "i" << "load-state",
+                "Start from the domain state saved in <file>.",
+                "file");
+
+    QCommandLineOption varyOption(
+                QStringList() << "x" << "vary",
+                "Sweep the parameter <key> over the given values (list or first:last:step).",
+                "key=values");
+    QCommandLineOption pointsOption(
+                QStringList() << "l" << "points",
+                "Sweep over the parameter values listed in <file>.",
+                "file");
+    QCommandLineOption jobsOption(
+                QStringList() << "j" << "jobs",
+                "Run at most <n> sweep points at once.",
+                "n");
+
+    QCommandLineOption ensembleOption(
+                QStringList() << "e" << "ensemble",
+                "Run an ensemble of <n> runs with different seeds.",
+                "n");
+    QCommandLineOption toleranceOption(
+                QStringList() << "t" << "tolerance",
+                "Stop the ensemble once the results change by less than <pct> percent.",
+                "pct");
+
+    parser.addOption(profileOption);
+    parser.addOption(itersOption);
+    parser.addOption(startOption);
+    parser.addOption(outputOption);
+    parser.addOption(csvOption);
+    parser.addOption(binaryOption);
+    parser.addOption(floatOption);
+    parser.addOption(memOption);
+    parser.addOption(inequalityOption);
+    parser.addOption(seedOption);
+    parser.addOption(traceOption);
+    parser.addOption(saveStateOption);
+    parser.addOption(loadStateOption);
+    parser.addOption(varyOption);
+    parser.addOption(pointsOption);
+    parser.addOption(jobsOption);
+    parser.addOption(ensembleOption);
+    parser.addOption(toleranceOption);
+
+    parser.process(app);
+
+    const QStringList args = parser.positionalArguments();
+    if (args.count() != 1)
+    {
+        parser.showHelp(1);
+    }
+
+    QString domainName = args.at(0);
+
+    QSettings settings;
+
+    int iterations = settings.value("iterations", 100).toInt();
+    int start_period = settings.value("start-period", 0).toInt();
+
+    if (parser.isSet(itersOption))
+    {
+        iterations = parser.value(itersOption).toInt();
+    }
+
+    if (parser.isSet(startOption))
+    {
+        start_period = parser.value(startOption).toInt();
+    }
+
+    /*
+     * Work out which properties to record. A QMap keeps them in Property
+     * order, which is the order of the columns.
+     */
+    Domain::initialisePropertyMap();
+    Domain::derivedProperties.read();
+
+    const DerivedProperties &derived = Domain::derivedProperties;
+
+    QMap<Property,QString> columns;
+    QList<int> derived_columns;     // written after the built-in ones
+
+    if (parser.isSet(profileOption))
+    {
+        QString profile = parser.value(profileOption);
+
+        settings.beginGroup("Profiles");
+        if (!settings.childGroups().contains(profile))
+        {
+            fprintf(stderr, "Chart profile \"%s\" not found\n",
+                    profile.toLocal8Bit().constData());
+            return 1;
+        }
+
+        settings.beginGroup(profile);
+        foreach (QString name, Domain::propertyMap.keys())
+        {
+            if (settings.value(name, false).toBool())
+            {
+                columns[Domain::propertyMap[name]] = name;
+            }
+        }
+        for (int k = 0; k < derived.count(); k++)
+        {
+            if (settings.value(derived.definition(k).name, false).toBool())
+            {
+                derived_columns.append(k);
+            }
+        }
+        settings.endGroup();
+        settings.endGroup();
+    }
+    else
+    {
+        foreach (QString name, Domain::propertyMap.keys())
+        {
+            columns[Domain::propertyMap[name]] = name;
+        }
+        for (int k = 0; k < derived.count(); k++)
+        {
+            derived_columns.append(k);
+        }
+    }
+
+    settings.beginGroup("Domains");
+    if (!settings.childGroups().contains(domainName))
+    {
+        qWarning().noquote() << "Domain" << domainName
+                             << "not found in settings -- using defaults";
+    }
+    settings.endGroup();
+
+    Domain *dom = Domain::createDomain(domainName);
+    if (dom == nullptr)
+    {
+        fprintf(stderr, "Cannot create domain \"%s\"\n",
+                domainName.toLocal8Bit().constData());
+        return 1;
+    }
+
+    if (parser.isSet(memOption))
+    {
+        /*
+         * Workers are held by value in a single vector, with their hot fields
+         * in the domain's WorkerStore. Firms, banks and the government are
+         * allocated individually but there are relatively few of them.
+         */
+        size_t pop = size_t(dom->getParameterVal(ParamType::pop)) * 100;
+        size_t per_worker = sizeof(Worker) + WorkerStore::bytesPerWorker();
+
+        /*
+         * Before that, each worker was a QObject, allocated individually and
+         * held by pointer, and carried the balance, debt, interest rate and
+         * sector totals that only firms use. The QObjectPrivate that every
+         * QObject allocates isn't in the public headers, so its size is an
+         * estimate.
+         */
+        size_t old_object = sizeof(Worker) + sizeof(QObject)
+                + 3 * sizeof(double) + sizeof(SectorTotals *);
+        size_t old_per_worker = old_object + QOBJECT_PRIVATE_SIZE
+                + 2 * MALLOC_OVERHEAD + sizeof(Worker *)
+                + WorkerStore::bytesPerWorker();
+
+        fprintf(stderr, "                   before      after\n");
+        fprintf(stderr, "Worker object:     %6zu %10zu bytes\n", old_object, sizeof(Worker));
+        fprintf(stderr, "QObjectPrivate:   ~%6d %10d bytes\n", QOBJECT_PRIVATE_SIZE, 0);
+        fprintf(stderr, "Heap overhead:    ~%6zu %10d bytes\n", 2 * MALLOC_OVERHEAD, 0);
+        fprintf(stderr, "Pointer to it:     %6zu %10d bytes\n", sizeof(Worker *), 0);
+        fprintf(stderr, "WorkerStore slot:  %6zu %10zu bytes\n",
+                WorkerStore::bytesPerWorker(), WorkerStore::bytesPerWorker());
+        fprintf(stderr, "Total per worker: ~%6zu %10zu bytes\n", old_per_worker, per_worker);
+        fprintf(stderr, "Workers (%zu):     ~%.1f MB before, %.1f MB after\n", pop,
+                double(pop * old_per_worker) / (1024 * 1024),
+                double(pop * per_worker) / (1024 * 1024));
+        fprintf(stderr, "Firm object:       %zu bytes (+ employee list)\n", sizeof(Firm));
+    }
+
+    if (parser.isSet(traceOption)
+            && (parser.isSet(varyOption) || parser.isSet(pointsOption)
+                || parser.isSet(ensembleOption)))
+    {
+        fprintf(stderr, "Only a single run can be traced\n");
+        return 1;
+    }
+
+    /*
+     * Open the output file. A binary results file is written under a
+     * temporary name and only replaces the output file when it is complete.
+     */
+    const bool binary = parser.isSet(binaryOption);
+    ResultFileWriter results(parser.isSet(floatOption) ? ResultValueType::f32
+                                                       : ResultValueType::f64);
+    QFile file;
+    if (binary)
+    {
+        if (!parser.isSet(outputOption))
+        {
+            fprintf(stderr, "A binary results file needs an output file (-o)\n");
+            return 1;
+        }
+        if (parser.isSet(ensembleOption))
+        {
+            fprintf(stderr, "Ensembles can't be written as binary results files\n");
+            return 1;
+        }
+
+        QString error;
+        if (!results.open(parser.value(outputOption), error))
+        {
+            fprintf(stderr, "%s\n", error.toLocal8Bit().constData());
+            return 1;
+        }
+    }
+    else if (parser.isSet(outputOption))
+    {
+        file.setFileName(parser.value(outputOption));
+        if (!file.open(QIODevice::WriteOnly | QIODevice::Text))
+        {
+            fprintf(stderr, "Cannot open %s for writing\n",
+                    file.fileName().toLocal8Bit().constData());
+            return 1;
+        }
+    }
+    else
+    {
+        file.open(stdout, QIODevice::WriteOnly | QIODevice::Text);
+    }
+
+    char sep = parser.isSet(csvOption) ? ',' : '\t';
+
+    dom->reset();
+
+    /*
+     * reset() reads the inequality mode and random seed from settings, so any
+     * override must come after it
+     */
+    if (parser.isSet(inequalityOption))
+    {
+        QString mode = parser.value(inequalityOption);
+        if (mode != "exact" && mode != "approximate")
+        {
+            fprintf(stderr, "Unknown inequality mode \"%s\"\n",
+                    mode.toLocal8Bit().constData());
+            return 1;
+        }
+        dom->setInequalityMode(Inequality::modeFromName(mode));
+    }
+
+    if (parser.isSet(seedOption))
+    {
+        dom->setRandomSeed(parser.value(seedOption).toULongLong());
+    }
+
+    /*
+     * A sweep runs clones of the domain (with the overrides above) and writes
+     * a summary row for each point rather than a row for each period
+     */
+    if (parser.isSet(varyOption) || parser.isSet(pointsOption))
+    {
+        Sweep sweep(dom);
+
+        foreach (QString spec, parser.values(varyOption))
+        {
+            QString error;
+            if (!sweep.addAxis(spec, error))
+            {
+                fprintf(stderr, "%s\n", error.toLocal8Bit().constData());
+                return 1;
+            }
+        }
+
+        if (parser.isSet(pointsOption))
+        {
+            QString error;
+            if (!sweep.readPoints(parser.value(pointsOption), error))
+            {
+                fprintf(stderr, "%s\n", error.toLocal8Bit().constData());
+                return 1;
+            }
+        }
+
+        if (parser.isSet(jobsOption))
+        {
+            sweep.setMaxThreads(parser.value(jobsOption).toInt());
+        }
+
+        sweep.setProperties(columns);
+        sweep.setPeriods(iterations, start_period);
+
+        fprintf(stderr, "Running %d points\n", sweep.count());
+
+        /*
+         * In a binary results file, each point is written in full rather than
+         * summarised
+         */
+        if (binary)
+        {
+            QString error;
+            sweep.run(results);
+            if (!results.close(error))
+            {
+                fprintf(stderr, "%s\n", error.toLocal8Bit().constData());
+                return 1;
+            }
+            return 0;
+        }
+
+        QTextStream out(&file);
+        sweep.run(out, QChar(sep));
+
+        out.flush();
+        file.close();
+
+        return 0;
+    }
+
+    /*
+     * An ensemble writes the mean and band of each property for each period
+     * rather than the values from a single run
+     */
+    if (parser.isSet(ensembleOption))
+    {
+        Ensemble ensemble(dom);
+        ensemble.setProperties(columns.keys());
+        ensemble.setPeriods(iterations, start_period);
+        ensemble.setRuns(parser.value(ensembleOption).toInt());
+
+        if (parser.isSet(toleranceOption))
+        {
+            ensemble.setTolerance(parser.value(toleranceOption).toDouble() / 100);
+        }
+
+        int runs = ensemble.run();
+        fprintf(stderr, "Ensemble of %d runs\n", runs);
+
+        DelimitedWriter out(&file, sep);
+
+        out.field(QString("Period"));
+        foreach (QString name, columns.values())
+        {
+            out.field(name + " (mean)");
+            out.field(name + " (5%)");
+            out.field(name + " (95%)");
+        }
+        out.endRow();
+
+        for (int t = 0; t < ensemble.periods(); t++)
+        {
+            out.field(ensemble.firstPeriod() + t);
+            for (int k = 0; k < columns.count(); k++)
+            {
+                out.field(ensemble.mean(k, t));
+                out.field(ensemble.lower(k, t));
+                out.field(ensemble.upper(k, t));
+            }
+            out.endRow();
+        }
+
+        bool ok = out.flush();
+        file.close();
+
+        return ok ? 0 : 1;
+    }
+
+    /*
+     * The rows are buffered (see DelimitedWriter), so the memory used doesn't
+     * depend on the number of periods
+     */
+    DelimitedWriter out(&file, sep);
+
+    if (!binary)
+    {
+        out.field(QString("Period"));
+        foreach (QString name, columns.values())
+        {
+            out.field(name);
+        }
+        foreach (int k, derived_columns)
+        {
+            out.field(derived.definition(k).name);
+        }
+        out.endRow();
+    }
+
+    const QList<Property> keys = columns.keys();
+    QVector<double> values(keys.count() + derived_columns.count());
+    bool run_started = false;
+
+    /*
+     * The derived properties are brought up to date with the record each
+     * period, which only evaluates the new row (or the whole record the first
+     * time, which may have been restored from a saved state)
+     */
+    ParameterBlock params;
+    QVector<QVector<double>> derived_values;
+
+    /*
+     * Write the values for each period as soon as the domain has recorded
+     * them (see Domain::recorded)
+     */
+    QObject::connect(dom, &Domain::iterated, [&](int period) {
+        const PropertyRecord &record = dom->recorded();
+
+        if (!derived_columns.isEmpty())
+        {
+            derived.evaluate(record, params, derived_values,
+                             derived_values.isEmpty() ? 0 : record.count() - 1);
+        }
+
+        if (binary)
+        {
+            if (!run_started)
+            {
+                ResultRunInfo info = ResultRunInfo::fromDomain(dom);
+                info.first_period = period;
+                info.properties = columns.values();
+                foreach (int k, derived_columns)
+                {
+                    info.properties.append(derived.definition(k).name);
+                }
+                results.beginRun(info);
+                run_started = true;
+            }
+
+            for (int k = 0; k < keys.count(); k++)
+            {
+                values[k] = record.last(keys[k]);
+            }
+            for (int k = 0; k < derived_columns.count(); k++)
+            {
+                values[keys.count() + k] = derived_values[derived_columns[k]].last();
+            }
+            results.addPeriod(values.constData());
+            return;
+        }
+
+        out.field(period);
+        for (auto it = columns.constBegin(); it != columns.constEnd(); ++it)
+        {
+            out.field(record.last(it.key()));
+        }
+        foreach (int k, derived_columns)
+        {
+            out.field(derived_values[k].last());
+        }
+        out.endRow();
+    });
+
+    /*
+     * A saved state replaces reset() and the periods already run, and holds
+     * its own seed and inequality mode
+     */
+    if (parser.isSet(loadStateOption))
+    {
+        QString error;
+        if (!dom->restoreState(parser.value(loadStateOption), error))
+        {
+            fprintf(stderr, "%s\n", error.toLocal8Bit().constData());
+            return 1;
+        }
+        fprintf(stderr, "Restored state at period %d\n", dom->lastPeriod());
+    }
+
+    /*
+     * Only the properties written need evaluating, unless the state is to be
+     * saved, when the record it holds should be complete
+     */
+    if (!parser.isSet(saveStateOption))
+    {
+        dom->setRecordedProperties(columns.keys() + derived.uses(derived_columns));
+    }
+
+    params.load(dom->params);
+
+    Profiler::setEnabled(parser.isSet(traceOption));
+
+    for (int period = dom->lastPeriod() + 1; period <= iterations + start_period; period++)
+    {
+        dom->iterate(period, period < start_period);
+    }
+
+    if (parser.isSet(traceOption))
+    {
+        QVector<PeriodProfile> profiles = dom->profiler().snapshot();
+        printProfile(ProfileSummary(profiles));
+
+        TraceWriter trace;
+        trace.addDomain(domainName, profiles);
+
+        QString error;
+        if (!trace.write(parser.value(traceOption), error))
+        {
+            fprintf(stderr, "%s\n", error.toLocal8Bit().constData());
+            return 1;
+        }
+    }
+
+    if (parser.isSet(saveStateOption))
+    {
+        QString error;
+        if (!dom->saveState(parser.value(saveStateOption), error))
+        {
+            fprintf(stderr, "%s\n", error.toLocal8Bit().constData());
+            return 1;
+        }
+    }
+
+    if (binary)
+    {
+        QString error;
+        if (run_started)
+        {
+            results.endRun();
+        }
+        if (!results.close(error))
+        {
+            fprintf(stderr, "%s\n", error.toLocal8Bit().constData());
+            return 1;
+        }
+        return 0;
+    }
+
+    if (!out.flush())
+    {
+        fprintf(stderr, "Error writing output\n");
+        return 1;
+    }
+    file.close();
+
+    return 0;
+}
@@ -0,0 +1,632 @@
+/*
+ * bench.cpp
+ *
+ * Benchmarks for the simulation engine. Each benchmark is run on synthetic
+ * domains of increasing size, and the results are written as JSON so that
+ * they can be compared across versions. The user's settings are not read or
+ * changed: the domains are configured in a temporary settings file.
+ *
+ * Usage:
+ *
+ *     obson-bench [options]
+ *
+ *     -o, --output <file>        write the results to <file> (default: stdout)
+ *     -a, --max-agents <n>       largest population to run, as a number of
+ *                                agents (default 1000000). Populations go
+ *                                up by powers of ten from 1000.
+ *     -F, --firms <list>         numbers of firms to run each population
+ *                                with, e.g. 10,100 (default: 10, and one per
+ *                                thousand agents)
+ *     -t, --min-time <ms>        minimum time for each sample (default 200)
+ *     -r, --repeat <n>           number of samples of each micro-benchmark
+ *                                (default 5)
+ *     -f, --filter <text>        only run benchmarks whose names contain
+ *                                <text>
+ *
+ * Micro-benchmarks time a single engine operation many times over, and report
+ * the median and fastest time per operation (ns_per_op, ns_per_op_min):
+ *
+ *     Firm::transferSafely       a payment from one firm to another
+ *                                (including the recipient's sales tax)
+ *     Firm::credit               a sale credited to a firm
+ *     Firm::hireSome             hiring from the unemployed pool, per worker
+ *     Firm::payWages             paying a firm's employees, per employee
+ *     Government::payBenefits    paying benefits, per unemployed worker
+ *     Inequality (exact)         the Gini calculation, per worker
+ *     Inequality (approximate)
+ *
+ * The macro-benchmark, Domain::iterate, times whole periods after a few
+ * periods of warm-up, and reports periods per second, nanoseconds per agent
+ * per period and the time per period spent in each phase (see profiler.h).
+ * Running 10^7 agents needs several gigabytes of memory.
+ */
+
+#include "account.h"
+#include "inequality.h"
+#include "parallel.h"
+#include "profiler.h"
+#include "version.h"
+
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QDateTime>
+#include <QFile>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QSettings>
+#include <QTemporaryDir>
+
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <string.h>
+#include <stdio.h>
+
+/*
+ * Periods run before a domain is timed, so that firms have hired and the
+ * first period's special cases are out of the way
+ */
+#define BENCH_WARMUP_PERIODS 3
+
+/*
+ * Limits on the number of periods timed in a macro-benchmark
+ */
+#define BENCH_MIN_PERIODS 3
+#define BENCH_MAX_PERIODS 1000
+
+/*
+ * Number of operations in each timed batch of a constant-time
+ * micro-benchmark
+ */
+#define BENCH_BATCH_OPS 100000
+
+static qint64 clockNs()
+{
+    using namespace std::chrono;
+    return duration_cast<nanoseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+/*
+ * The time taken by some number of operations
+ */
+struct Timing
+{
+    qint64 ns;
+    qint64 ops;
+};
+
+struct Options
+{
+    qint64 min_ns = 200000000;
+    int repeat = 5;
+    QString filter;
+};
+
+/*
+ * Take opts.repeat samples of body, which does some operations and returns
+ * how long they took. Each sample calls body until at least opts.min_ns has
+ * been timed. Returns the result with the median and fastest times per
+ * operation.
+ */
+template <typename F>
+static QJsonObject sample(const Options &opts, F body)
+{
+    QVector<double> per_op;
+    qint64 total_ops = 0;
+
+    for (int r = 0; r < opts.repeat; r++)
+    {
+        Timing t = {0, 0};
+        while (t.ns < opts.min_ns)
+        {
+            Timing b = body();
+            if (b.ops == 0)
+            {
+                break;      // nothing to time (e.g. no one unemployed)
+            }
+            t.ns += b.ns;
+            t.ops += b.ops;
+        }
+        if (t.ops == 0)
+        {
+            break;
+        }
+        per_op.append(double(t.ns) / t.ops);
+        total_ops += t.ops;
+    }
+
+    QJsonObject result;
+    result["ops"] = double(total_ops);
+    if (per_op.isEmpty())
+    {
+        return result;
+    }
+
+    std::sort(per_op.begin(), per_op.end());
+    result["ns_per_op"] = per_op[per_op.count() / 2];
+    result["ns_per_op_min"] = per_op.first();
+    return result;
+}
+
+/*
+ * Set the parameters of the domains created from now on (the [Default]
+ * group, as for a domain that isn't listed in settings). The values are
+ * typical ones; only the population and number of firms vary.
+ */
+static void configure(int agents, int firms)
+{
+    QSettings settings;
+
+    settings.setValue("random-seed", 1);
+    settings.setValue("inequality-mode", "exact");
+    settings.setValue("start-ups", firms);
+
+    settings.beginGroup("Default");
+    settings.setValue("Currency", "Units");
+    settings.setValue("Abbrev", "CU");
+    settings.setValue("govt-procurement", 0);
+    settings.setValue("propensity-to-consume", 80);
+    settings.setValue("income-tax-rate", 10);
+    settings.setValue("income-threshold", 50);
+    settings.setValue("sales-tax-rate", 10);
+    settings.setValue("firm-creation-prob", 0);
+    settings.setValue("pre-tax-dedns-rate", 0);
+    settings.setValue("unempl-benefit-rate", 60);
+    settings.setValue("population", agents / 100);
+    settings.setValue("reserve-rate", 50);
+    settings.setValue("prop-invest", 2);
+    settings.setValue("boe-interest", 1);
+    settings.setValue("bus-interest", 3);
+    settings.setValue("loan-prob", 80);
+    settings.setValue("capex-recoup-periods", 10);
+    settings.setValue("standard-wage", 500);
+    settings.setValue("government-size", 20);
+    settings.endGroup();
+}
+
+static QJsonObject header(const QString &name, const QString &kind, int agents,
+                          int firms)
+{
+    QJsonObject result;
+    result["name"] = name;
+    result["kind"] = kind;
+    result["agents"] = agents;
+    result["firms"] = firms;
+    return result;
+}
+
+static void report(QJsonArray &results, QJsonObject result)
+{
+    fprintf(stderr, "  %-28s %9d agents %6d firms",
+            result["name"].toString().toLocal8Bit().constData(),
+            result["agents"].toInt(), result["firms"].toInt());
+    if (result.contains("ns_per_op"))
+    {
+        fprintf(stderr, "  %10.1f ns/op\n", result["ns_per_op"].toDouble());
+    }
+    else if (result.contains("periods_per_second"))
+    {
+        fprintf(stderr, "  %10.2f periods/s  %8.2f ns/agent\n",
+                result["periods_per_second"].toDouble(),
+                result["ns_per_agent"].toDouble());
+    }
+    else
+    {
+        fprintf(stderr, "  (nothing to time)\n");
+    }
+    results.append(result);
+}
+
+/*
+ * A firm whose transferSafely (which is protected) can be called directly
+ */
+class BenchFirm : public Firm
+{
+public:
+    BenchFirm(Domain *domain) : Firm(domain) {}
+    using Firm::transferSafely;
+};
+
+static bool selected(const Options &opts, const QString &name)
+{
+    return opts.filter.isEmpty() || name.contains(opts.filter, Qt::CaseInsensitive);
+}
+
+/*
+ * The micro-benchmarks, on a domain with the given population. The firms they
+ * use are created for the purpose, so the domain isn't run.
+ */
+static void runMicro(QJsonArray &results, const Options &opts, int agents,
+                     int firms)
+{
+    configure(agents, firms);
+
+    Domain *dom = Domain::createDomain("bench-micro");
+    Government *gov = dom->government();
+
+    BenchFirm *payer = new BenchFirm(dom);
+    Firm *payee = dom->createFirm();
+    Firm *employer = dom->createFirm();
+
+    /*
+     * Enough money that no payment fails
+     */
+    payer->credit(1e15, gov);
+    employer->credit(1e15, gov);
+
+    const double wage = dom->getStdWage();
+
+    auto fireAll = [employer]() {
+        while (employer->getNumEmployees() > 0)
+        {
+            employer->fire(int(employer->getNumEmployees()) - 1);
+        }
+    };
+
+    QString name = "Firm::transferSafely";
+    if (selected(opts, name))
+    {
+        QJsonObject result = header(name, "micro", agents, firms);
+        const QJsonObject timing = sample(opts, [&]() {
+            qint64 start = clockNs();
+            for (int i = 0; i < BENCH_BATCH_OPS; i++)
+            {
+                payer->transferSafely(payee, 1.0, payer);
+            }
+            return Timing{clockNs() - start, BENCH_BATCH_OPS};
+        });
+        for (auto it = timing.begin(); it != timing.end(); ++it)
+        {
+            result[it.key()] = it.value();
+        }
+        report(results, result);
+    }
+
+    name = "Firm::credit";
+    if (selected(opts, name))
+    {
+        QJsonObject result = header(name, "micro", agents, firms);
+        const QJsonObject timing = sample(opts, [&]() {
+            qint64 start = clockNs();
+            for (int i = 0; i < BENCH_BATCH_OPS; i++)
+            {
+                payee->credit(1.0, payer);
+            }
+            return Timing{clockNs() - start, BENCH_BATCH_OPS};
+        });
+        for (auto it = timing.begin(); it != timing.end(); ++it)
+        {
+            result[it.key()] = it.value();
+        }
+        report(results, result);
+    }
+
+    /*
+     * Hire everyone who is unemployed, then (untimed) fire them again
+     */
+    name = "Firm::hireSome";
+    if (selected(opts, name))
+    {
+        QJsonObject result = header(name, "micro", agents, firms);
+        const QJsonObject timing = sample(opts, [&]() {
+            int available = dom->getNumUnemployed();
+            qint64 start = clockNs();
+            employer->hireSome(wage, available);
+            Timing t = {clockNs() - start, qint64(employer->getNumEmployees())};
+            fireAll();
+            return t;
+        });
+        for (auto it = timing.begin(); it != timing.end(); ++it)
+        {
+            result[it.key()] = it.value();
+        }
+        report(results, result);
+    }
+
+    name = "Firm::payWages";
+    if (selected(opts, name))
+    {
+        QJsonObject result = header(name, "micro", agents, firms);
+        employer->hireSome(wage, dom->getNumUnemployed());
+        const QJsonObject timing = sample(opts, [&]() {
+            qint64 start = clockNs();
+            employer->payWages();
+            return Timing{clockNs() - start, qint64(employer->getNumEmployees())};
+        });
+        fireAll();
+        for (auto it = timing.begin(); it != timing.end(); ++it)
+        {
+            result[it.key()] = it.value();
+        }
+        report(results, result);
+    }
+
+    name = "Government::payBenefits";
+    if (selected(opts, name))
+    {
+        QJsonObject result = header(name, "micro", agents, firms);
+        const QJsonObject timing = sample(opts, [&]() {
+            qint64 start = clockNs();
+            gov->payBenefits(1.0);
+            return Timing{clockNs() - start, qint64(dom->getNumUnemployed())};
+        });
+        for (auto it = timing.begin(); it != timing.end(); ++it)
+        {
+            result[it.key()] = it.value();
+        }
+        report(results, result);
+    }
+
+    delete payer;
+    delete dom;
+
+    /*
+     * Wages with a long tail, and some zeros for the unemployed. The values
+     * are sorted in place, so they are copied in (untimed) before each
+     * calculation.
+     */
+    QVector<double> wages(agents);
+    std::mt19937_64 gen(1);
+    std::lognormal_distribution<double> dist(6.0, 0.5);
+    for (int i = 0; i < agents; i++)
+    {
+        wages[i] = (i % 10 == 0) ? 0 : dist(gen);
+    }
+
+    for (Inequality::Mode mode : {Inequality::Mode::exact,
+                                  Inequality::Mode::approximate})
+    {
+        name = "Inequality (" + Inequality::modeName(mode) + ")";
+        if (!selected(opts, name))
+        {
+            continue;
+        }
+
+        QJsonObject result = header(name, "micro", agents, firms);
+        Inequality inequality;
+        inequality.setMode(mode);
+        const QJsonObject timing = sample(opts, [&]() {
+            memcpy(inequality.values(agents), wages.constData(),
+                   sizeof(double) * size_t(agents));
+            qint64 start = clockNs();
+            inequality.calculate(agents);
+            return Timing{clockNs() - start, qint64(agents)};
+        });
+        for (auto it = timing.begin(); it != timing.end(); ++it)
+        {
+            result[it.key()] = it.value();
+        }
+        report(results, result);
+    }
+}
+
+/*
+ * Time whole periods of a domain with the given population and number of
+ * firms
+ */
+static void runMacro(QJsonArray &results, const Options &opts, int agents,
+                     int firms)
+{
+    const QString name = "Domain::iterate";
+    if (!selected(opts, name))
+    {
+        return;
+    }
+
+    configure(agents, firms);
+    Domain *dom = Domain::createDomain("bench-macro");
+
+    int period = 0;
+    for (; period < BENCH_WARMUP_PERIODS; period++)
+    {
+        dom->iterate(period, true);
+    }
+
+    /*
+     * The phases are timed by the domain's profiler, which costs a couple of
+     * clock reads per phase
+     */
+    Profiler::setEnabled(true);
+
+    qint64 start = clockNs();
+    qint64 elapsed = 0;
+    int timed = 0;
+    while ((elapsed < opts.min_ns || timed < BENCH_MIN_PERIODS)
+           && timed < BENCH_MAX_PERIODS)
+    {
+        dom->iterate(period++);
+        timed++;
+        elapsed = clockNs() - start;
+    }
+
+    Profiler::setEnabled(false);
+
+    QJsonObject result = header(name, "macro", agents, firms);
+    result["periods"] = timed;
+    result["seconds"] = double(elapsed) / 1e9;
+    result["periods_per_second"] = timed / (double(elapsed) / 1e9);
+    result["ns_per_period"] = double(elapsed) / timed;
+    result["ns_per_agent"] = double(elapsed) / timed / agents;
+
+    ProfileSummary summary(dom->profiler().snapshot());
+    QJsonObject phases;
+    for (int i = 0; i < int(ProfilePhase::num_phases); i++)
+    {
+        phases[Profiler::phaseName(ProfilePhase(i))]
+                = summary.periods > 0 ? double(summary.phases[i]) / summary.periods : 0;
+    }
+    result["phase_ns_per_period"] = phases;
+
+    QJsonObject counts;
+    for (int i = 0; i < int(ProfileCounter::num_counters); i++)
+    {
+        counts[Profiler::counterName(ProfileCounter(i))]
+                = summary.periods > 0 ? double(summary.counts[i]) / summary.periods : 0;
+    }
+    result["counts_per_period"] = counts;
+
+    delete dom;
+    report(results, result);
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+
+    QCoreApplication::setOrganizationName("Obson.net");
+    QCoreApplication::setOrganizationDomain("Obson.net");
+    QCoreApplication::setApplicationName("MicroSim-bench");
+    QCoreApplication::setApplicationVersion(VERSION);
+
+    /*
+     * Keep the synthetic configurations out of the user's settings
+     */
+    QTemporaryDir settings_dir;
+    if (!settings_dir.isValid())
+    {
+        fprintf(stderr, "Cannot create a temporary directory for settings\n");
+        return 1;
+    }
+    QSettings::setDefaultFormat(QSettings::IniFormat);
+    QSettings::setPath(QSettings::IniFormat, QSettings::UserScope,
+                       settings_dir.path());
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Benchmark the MicroSim simulation engine");
+    parser.addHelpOption();
+    parser.addVersionOption();
+
+    QCommandLineOption outputOption(
+                QStringList() << "o" << "output",
+                "Write the results to <file> instead of stdout.",
+                "file");
+    QCommandLineOption agentsOption(
+                QStringList() << "a" << "max-agents",
+                "Largest population to run (default 1000000).",
+                "n");
+    QCommandLineOption firmsOption(
+                QStringList() << "F" << "firms",
+                "Numbers of firms to run each population with.",
+                "list");
+    QCommandLineOption timeOption(
+                QStringList() << "t" << "min-time",
+                "Minimum time for each sample (default 200).",
+                "ms");
+    QCommandLineOption repeatOption(
+                QStringList() << "r" << "repeat",
+                "Number of samples of each micro-benchmark (default 5).",
+                "n");
+    QCommandLineOption filterOption(
+                QStringList() << "f" << "filter",
+                "Only run benchmarks whose names contain <text>.",
+                "text");
+
+    parser.addOption(outputOption);
+    parser.addOption(agentsOption);
+    parser.addOption(firmsOption);
+    parser.addOption(timeOption);
+    parser.addOption(repeatOption);
+    parser.addOption(filterOption);
+
+    parser.process(app);
+
+    Options opts;
+    if (parser.isSet(timeOption))
+    {
+        opts.min_ns = parser.value(timeOption).toLongLong() * 1000000;
+    }
+    if (parser.isSet(repeatOption))
+    {
+        opts.repeat = std::max(1, parser.value(repeatOption).toInt());
+    }
+    opts.filter = parser.value(filterOption);
+
+    qint64 max_agents = 1000000;
+    if (parser.isSet(agentsOption))
+    {
+        max_agents = parser.value(agentsOption).toLongLong();
+    }
+    if (max_agents < 1000 || max_agents > 100000000)
+    {
+        fprintf(stderr, "The number of agents must be between 1000 and 100000000\n");
+        return 1;
+    }
+
+    QList<int> firm_counts;
+#if QT_VERSION >= QT_VERSION_CHECK(5, 14, 0)
+    foreach (QString item, parser.value(firmsOption).split(',', Qt::SkipEmptyParts))
+#else
+    foreach (QString item, parser.value(firmsOption).split(',', QString::SkipEmptyParts))
+#endif
+    {
+        int n = item.trimmed().toInt();
+        if (n <= 0)
+        {
+            fprintf(stderr, "Invalid number of firms \"%s\"\n",
+                    item.toLocal8Bit().constData());
+            return 1;
+        }
+        firm_counts.append(n);
+    }
+
+    QFile file;
+    if (parser.isSet(outputOption))
+    {
+        file.setFileName(parser.value(outputOption));
+        if (!file.open(QIODevice::WriteOnly))
+        {
+            fprintf(stderr, "Cannot open %s for writing\n",
+                    file.fileName().toLocal8Bit().constData());
+            return 1;
+        }
+    }
+    else
+    {
+        file.open(stdout, QIODevice::WriteOnly);
+    }
+
+    Domain::initialisePropertyMap();
+
+    QJsonArray results;
+
+    for (qint64 agents = 1000; agents <= max_agents; agents *= 10)
+    {
+        QList<int> firms = firm_counts;
+        if (firms.isEmpty())
+        {
+            firms << 10;
+            if (agents / 1000 > 10)
+            {
+                firms << int(agents / 1000);
+            }
+        }
+
+        fprintf(stderr, "%lld agents\n", static_cast<long long>(agents));
+
+        runMicro(results, opts, int(agents), firms.first());
+        foreach (int n, firms)
+        {
+            runMacro(results, opts, int(agents), n);
+        }
+    }
+
+    QJsonObject root;
+    root["version"] = VERSION;
+    root["engine_version"] = ENGINE_VERSION;
+    root["threads"] = Parallel::idealThreadCount();
+    root["date"] = QDateTime::currentDateTimeUtc().toString(Qt::ISODate);
+    root["min_time_ms"] = double(opts.min_ns) / 1e6;
+    root["repeat"] = opts.repeat;
+    root["results"] = results;
+
+    QByteArray json = QJsonDocument(root).toJson();
+    if (file.write(json) != json.size())
+    {
+        fprintf(stderr, "Error writing results\n");
+        return 1;
+    }
+    file.close();
+
+    return 0;
+}
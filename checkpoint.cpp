@@ -0,0 +1,966 @@
+/*
+ * checkpoint.cpp
+ *
+ * Saving and restoring the complete state of a domain (see Domain::saveState
+ * and Domain::restoreState), e.g. so that a long run of silent periods need
+ * only be made once.
+ *
+ * The file is a header followed by a series of sections, all in the machine's
+ * byte order (which is checked on reading). Strings are held as a length
+ * followed by UTF-8, and arrays as a count followed by the raw values.
+ *
+ *     header       "OBST", byte order mark, format version, ENGINE_VERSION
+ *     domain       name, currency, parameters, seed, inequality mode, last
+ *                  period, start-ups, cached property values, running totals
+ *     workers      count, then one array per field: the WorkerStore columns
+ *                  followed by the Account and Worker fields
+ *     unemployed   the pool of unemployed workers, in heap order
+ *     employers    count, then for each employer (in Domain::employers order,
+ *                  which is the order they were created in) its kind (firm,
+ *                  bank or government) and fields, and its employees
+ *     lists        the firms and banks lists and the government, as indices
+ *                  into employers
+ *     record       the values recorded so far (see PropertyRecord)
+ *
+ * Pointers between accounts are saved as references: -1 for nullptr, an index
+ * into Domain::employers for a firm, bank or government, or the number of
+ * employers plus the worker's index for a worker.
+ *
+ * Workers are held by value and their hot fields are held in columns in the
+ * WorkerStore, so they are saved and restored a column at a time with a single
+ * large write or copy each, rather than an object at a time. The file is read
+ * by mapping it into memory. Only firms, banks and the government (of which
+ * there are relatively few) are allocated individually.
+ *
+ * The random number generator has no state to save, since every stream is
+ * identified by the seed, the domain's name and the period (see RandomStream).
+ */
+
+#include "account.h"
+#include "version.h"
+
+#include <QFile>
+#include <QSaveFile>
+
+#include <climits>
+#include <string.h>
+
+#define STATE_FORMAT 1
+#define STATE_BYTE_ORDER 0x01020304
+
+enum class EmployerKind : quint8
+{
+    firm,
+    bank,
+    government
+};
+
+/*
+ * Writes values to a file, a whole array at a time where possible. The file is
+ * buffered, so small values don't each cost a system call.
+ */
+class StateWriter
+{
+public:
+
+    StateWriter(QIODevice *device)
+    {
+        this->device = device;
+    }
+
+    template <typename T>
+    void put(const T &value)
+    {
+        putRaw(&value, sizeof(T));
+    }
+
+    template <typename T>
+    void putArray(const T *values, int count)
+    {
+        put(qint32(count));
+        putRaw(values, qint64(count) * qint64(sizeof(T)));
+    }
+
+    template <typename T>
+    void putArray(const QVector<T> &values)
+    {
+        putArray(values.constData(), values.count());
+    }
+
+    void putString(const QString &s)
+    {
+        QByteArray utf8 = s.toUtf8();
+        putArray(utf8.constData(), utf8.count());
+    }
+
+    bool ok() const
+    {
+        return _ok;
+    }
+
+private:
+
+    QIODevice *device;
+    bool _ok = true;
+
+    void putRaw(const void *data, qint64 bytes)
+    {
+        if (_ok && bytes > 0)
+        {
+            _ok = device->write(static_cast<const char *>(data), bytes) == bytes;
+        }
+    }
+};
+
+/*
+ * Reads values from a file mapped into memory, checking that each one is
+ * within the file. After the first failure every read fails.
+ */
+class StateReader
+{
+public:
+
+    StateReader(const uchar *data, qint64 size)
+    {
+        this->data = data;
+        this->size = size;
+    }
+
+    template <typename T>
+    T get()
+    {
+        T value = T();
+        getRaw(&value, sizeof(T));
+        return value;
+    }
+
+    /*
+     * Read an array count, which must be no more than max
+     */
+    int getCount(qint64 max = INT_MAX)
+    {
+        qint32 count = get<qint32>();
+        if (count < 0 || count > max)
+        {
+            _ok = false;
+            return 0;
+        }
+        return count;
+    }
+
+    template <typename T>
+    void getArray(T *values, int count)
+    {
+        getRaw(values, qint64(count) * qint64(sizeof(T)));
+    }
+
+    /*
+     * Read an array into a vector, which is resized to hold it. If expected
+     * is not negative the array must have exactly that many values.
+     */
+    template <typename T>
+    void getArray(QVector<T> &values, int expected = -1)
+    {
+        int count = getCount(remaining() / qint64(sizeof(T)));
+        if (expected >= 0 && count != expected)
+        {
+            _ok = false;
+        }
+        values.resize(_ok ? count : 0);
+        getArray(values.data(), values.count());
+    }
+
+    QString getString()
+    {
+        QByteArray utf8(getCount(remaining()), 0);
+        getArray(utf8.data(), utf8.count());
+        return QString::fromUtf8(utf8);
+    }
+
+    /*
+     * Number of bytes left to read, e.g. as a limit on a count
+     */
+    qint64 remaining() const
+    {
+        return size - pos;
+    }
+
+    bool ok() const
+    {
+        return _ok;
+    }
+
+private:
+
+    const uchar *data;
+    qint64 size;
+    qint64 pos = 0;
+    bool _ok = true;
+
+    void getRaw(void *value, qint64 bytes)
+    {
+        if (_ok && bytes > size - pos)
+        {
+            _ok = false;
+        }
+
+        if (_ok && bytes > 0)
+        {
+            memcpy(value, data + pos, size_t(bytes));
+            pos += bytes;
+        }
+    }
+};
+
+/*
+ * Account fields common to workers and employers. The fields are ordered so
+ * that there is no padding, which would otherwise be written uninitialised.
+ * A worker's balance is kept in the WorkerStore, so balance, owed_to_bank and
+ * interest_rate are only used for employers and are zero for workers.
+ */
+struct AccountState
+{
+    double balance = 0;
+    double owed_to_bank = 0;
+    double interest_rate = 0;
+    qint32 id = 0;
+    qint32 bank = -1;
+    qint32 last_triggered = -1;
+    qint32 reserved = 0;
+};
+
+/*
+ * The fields of an employer, as read from a file before it is checked and the
+ * employer is created
+ */
+struct EmployerState
+{
+    EmployerKind kind = EmployerKind::firm;
+    AccountState account;
+    bool in_sector = false;
+
+    double wages_paid = 0;
+    double bonuses_paid = 0;
+    double sales_tax_paid = 0;
+    double sales_receipts = 0;
+    double investment = 0;
+    qint32 num_hired = 0;
+    qint32 num_fired = 0;
+    qint32 num_just_fired = 0;
+    bool state_supported = false;
+    double productivity = 1;
+    double dedns = 0;
+
+    QVector<qint32> employees;
+
+    double reserves = 0;                // banks and the government
+    QVector<qint32> bank_accounts;
+
+    double totals[5] = {};              // the government
+};
+
+static void putTotals(StateWriter &out, const SectorTotals &t)
+{
+    out.put(qint32(t.employees));
+    const double values[] = {
+        t.balance, t.owed, t.wages, t.purchases, t.sales_receipts,
+        t.sales_tax, t.inc_tax, t.investment
+    };
+    out.putArray(values, 8);
+}
+
+static SectorTotals getTotals(StateReader &in)
+{
+    SectorTotals t;
+    t.employees = in.get<qint32>();
+
+    double values[8];
+    if (in.getCount() == 8)
+    {
+        in.getArray(values, 8);
+        t.balance = values[0];
+        t.owed = values[1];
+        t.wages = values[2];
+        t.purchases = values[3];
+        t.sales_receipts = values[4];
+        t.sales_tax = values[5];
+        t.inc_tax = values[6];
+        t.investment = values[7];
+    }
+    return t;
+}
+
+bool Domain::saveState(const QString &fileName, QString &error) const
+{
+    QSaveFile file(fileName);
+    if (!file.open(QIODevice::WriteOnly))
+    {
+        error = "Cannot open " + fileName + " for writing";
+        return false;
+    }
+
+    const int num_employers = employers.count();
+    const int pop = static_cast<int>(workers.size());
+
+    auto ref = [num_employers](const Account *a) -> qint32 {
+        if (a == nullptr)
+        {
+            return -1;
+        }
+        const Firm *f = dynamic_cast<const Firm *>(a);
+        if (f != nullptr)
+        {
+            return f->_employer_ix;
+        }
+        return num_employers + static_cast<const Worker *>(a)->ix;
+    };
+
+    auto accountState = [&ref](const Account *a) -> AccountState {
+        AccountState s;
+        s.id = a->id;
+        s.bank = ref(a->_bank);
+        s.last_triggered = a->last_triggered;
+        return s;
+    };
+
+    auto employerState = [&accountState](const Firm *f) -> AccountState {
+        AccountState s = accountState(f);
+        s.balance = f->balance;
+        s.owed_to_bank = f->owed_to_bank;
+        s.interest_rate = f->interest_rate;
+        return s;
+    };
+
+    StateWriter out(&file);
+
+    /*
+     * Header
+     */
+    out.putArray("OBST", 4);
+    out.put(quint32(STATE_BYTE_ORDER));
+    out.put(quint32(STATE_FORMAT));
+    out.put(quint32(ENGINE_VERSION));
+
+    /*
+     * Domain
+     */
+    out.putString(_name);
+    out.putString(_currency);
+    out.putString(_abbrev);
+
+    out.put(qint32(params.count()));
+    for (auto it = params.constBegin(); it != params.constEnd(); ++it)
+    {
+        out.put(qint32(it.key()));
+        out.put(qint32(it.value()));
+    }
+
+    out.put(seed);
+    out.put(qint32(inequality.mode()));
+    out.put(qint32(last_period));
+    out.put(qint32(start_ups));
+    out.put(qint32(_population));
+    out.put(qint32(_startups));
+
+    const qint32 counts[] = {
+        _num_hired, _num_fired, _num_firms, _num_emps, _num_unemps,
+        _num_gov_emps, _pop_size
+    };
+    out.putArray(counts, int(sizeof(counts) / sizeof(counts[0])));
+
+    const double values[] = {
+        _exp, _bens, _rcpts, _gov_bal, _prod_bal, _wages, _consumption,
+        _bonuses, _dedns, _inc_tax, _sales_tax, _dom_bal, _loan_prob,
+        _amount_owed, _deficit, _pc_active, _bus_size, _proc_exp,
+        _productivity, _rel_productivity, _investment, _gdp, _profit, _gini,
+        _mean, _spread
+    };
+    out.putArray(values, int(sizeof(values) / sizeof(values[0])));
+
+    putTotals(out, business);
+    putTotals(out, households);
+
+    /*
+     * Workers
+     */
+    out.put(qint32(pop));
+
+    out.putArray(wstore.balance);
+    out.putArray(wstore.wages);
+    out.putArray(wstore.purchases);
+    out.putArray(wstore.inc_tax);
+    out.putArray(wstore.benefits);
+    out.putArray(wstore.average_wages);
+    out.putArray(wstore.agreed_wage);
+    out.putArray(wstore.employer);
+    out.putArray(wstore.pool_pos);
+
+    {
+        QVector<AccountState> accounts(pop);
+        QVector<qint32> period_hired(pop), period_fired(pop);
+        for (int i = 0; i < pop; i++)
+        {
+            const Worker &w = workers[size_t(i)];
+            accounts[i] = accountState(&w);
+            period_hired[i] = w.period_hired;
+            period_fired[i] = w.period_fired;
+        }
+        out.putArray(accounts);
+        out.putArray(period_hired);
+        out.putArray(period_fired);
+    }
+
+    out.putArray(unemployed);
+
+    /*
+     * Employers
+     */
+    out.put(qint32(num_employers));
+
+    foreach (const Firm *f, employers)
+    {
+        EmployerKind kind = dynamic_cast<const Government *>(f) != nullptr
+                ? EmployerKind::government
+                : dynamic_cast<const Bank *>(f) != nullptr
+                  ? EmployerKind::bank
+                  : EmployerKind::firm;
+        out.put(kind);
+        out.put(employerState(f));
+        out.put(f->_sector != nullptr);
+
+        out.put(f->wages_paid);
+        out.put(f->bonuses_paid);
+        out.put(f->sales_tax_paid);
+        out.put(f->sales_receipts);
+        out.put(f->investment);
+        out.put(qint32(f->num_hired));
+        out.put(qint32(f->num_fired));
+        out.put(qint32(f->num_just_fired));
+        out.put(f->_state_supported);
+        out.put(f->productivity);
+        out.put(f->_dedns);
+
+        QVector<qint32> employees;
+        employees.reserve(f->employees.count());
+        foreach (const Worker *w, f->employees)
+        {
+            employees.append(w->ix);
+        }
+        out.putArray(employees);
+
+        if (kind != EmployerKind::firm)
+        {
+            const Bank *b = static_cast<const Bank *>(f);
+            out.put(b->reserves);
+
+            QVector<qint32> accounts;
+            foreach (const Account *a, b->accounts)
+            {
+                accounts.append(ref(a));
+            }
+            out.putArray(accounts);
+        }
+
+        if (kind == EmployerKind::government)
+        {
+            const Government *g = static_cast<const Government *>(f);
+            const double totals[] = {g->exp, g->unbudgeted, g->rec, g->ben, g->proc};
+            out.putArray(totals, 5);
+        }
+    }
+
+    /*
+     * Lists
+     */
+    QVector<qint32> list;
+    foreach (const Firm *f, firms)
+    {
+        list.append(f->_employer_ix);
+    }
+    out.putArray(list);
+
+    list.clear();
+    foreach (const Bank *b, banks)
+    {
+        list.append(b->_employer_ix);
+    }
+    out.putArray(list);
+
+    out.put(qint32(ref(_gov)));
+
+    /*
+     * Record
+     */
+    {
+        std::lock_guard<std::mutex> lock(record_mutex);
+        out.put(qint32(record.first_period));
+        out.put(qint32(Property::num_properties));
+        for (const QVector<double> &column : record.columns)
+        {
+            out.putArray(column);
+        }
+    }
+
+    if (!out.ok() || !file.commit())
+    {
+        error = "Cannot write " + fileName;
+        return false;
+    }
+
+    return true;
+}
+
+bool Domain::restoreState(const QString &fileName, QString &error)
+{
+    QFile file(fileName);
+    if (!file.open(QIODevice::ReadOnly))
+    {
+        error = "Cannot open " + fileName;
+        return false;
+    }
+
+    const qint64 size = file.size();
+    const uchar *data = size > 0 ? file.map(0, size) : nullptr;
+    if (data == nullptr)
+    {
+        error = "Cannot read " + fileName;
+        return false;
+    }
+
+    StateReader in(data, size);
+
+    /*
+     * Header
+     */
+    char magic[4] = {};
+    if (in.getCount(4) == 4)
+    {
+        in.getArray(magic, 4);
+    }
+
+    if (memcmp(magic, "OBST", 4) != 0
+            || in.get<quint32>() != STATE_BYTE_ORDER
+            || in.get<quint32>() != STATE_FORMAT)
+    {
+        error = fileName + " is not a domain state file for this version";
+        return false;
+    }
+
+    if (in.get<quint32>() != ENGINE_VERSION)
+    {
+        error = fileName + " was saved by a different version of the engine";
+        return false;
+    }
+
+    /*
+     * The whole file is read and checked before anything in the domain is
+     * changed, so that a damaged file leaves the domain as it was
+     */
+
+    /*
+     * Domain
+     */
+    QString name = in.getString();
+    if (in.ok() && name != _name)
+    {
+        error = fileName + " holds the state of domain \"" + name + "\", not \""
+                + _name + "\"";
+        return false;
+    }
+
+    const QString currency = in.getString();
+    const QString abbrev = in.getString();
+
+    QMap<ParamType,int> restored_params;
+    for (int i = in.getCount(in.remaining() / qint64(2 * sizeof(qint32))); i > 0; i--)
+    {
+        ParamType p = ParamType(in.get<qint32>());
+        restored_params[p] = in.get<qint32>();
+    }
+
+    const quint64 restored_seed = in.get<quint64>();
+    const Inequality::Mode inequality_mode = Inequality::Mode(in.get<qint32>());
+    const qint32 restored_last_period = in.get<qint32>();
+    const qint32 restored_start_ups = in.get<qint32>();
+    const qint32 population = in.get<qint32>();
+    const qint32 startups = in.get<qint32>();
+
+    bool ok = true;
+
+    qint32 counts[7] = {};
+    ok = ok && in.getCount(7) == 7;
+    in.getArray(counts, 7);
+
+    double values[26] = {};
+    ok = ok && in.getCount(26) == 26;
+    in.getArray(values, 26);
+
+    const SectorTotals business_totals = getTotals(in);
+    const SectorTotals household_totals = getTotals(in);
+
+    /*
+     * Workers. Every count is limited by what is left of the file, so that a
+     * damaged count can't make us try to allocate more than that.
+     */
+    const int pop = in.getCount(in.remaining() / qint64(sizeof(double)));
+
+    WorkerStore ws;
+    in.getArray(ws.balance, pop);
+    in.getArray(ws.wages, pop);
+    in.getArray(ws.purchases, pop);
+    in.getArray(ws.inc_tax, pop);
+    in.getArray(ws.benefits, pop);
+    in.getArray(ws.average_wages, pop);
+    in.getArray(ws.agreed_wage, pop);
+    in.getArray(ws.employer, pop);
+    in.getArray(ws.pool_pos, pop);
+
+    QVector<AccountState> worker_accounts;
+    QVector<qint32> period_hired, period_fired;
+    in.getArray(worker_accounts, pop);
+    in.getArray(period_hired, pop);
+    in.getArray(period_fired, pop);
+
+    QVector<int> pool;
+    in.getArray(pool);
+
+    /*
+     * Employers
+     */
+    const int num_employers =
+            in.getCount(in.remaining() / qint64(sizeof(AccountState)));
+
+    QVector<EmployerState> employer_states(in.ok() ? num_employers : 0);
+
+    for (int e = 0; in.ok() && e < num_employers; e++)
+    {
+        EmployerState &f = employer_states[e];
+
+        f.kind = in.get<EmployerKind>();
+        ok = ok && (f.kind == EmployerKind::firm || f.kind == EmployerKind::bank
+                    || f.kind == EmployerKind::government);
+
+        f.account = in.get<AccountState>();
+        f.in_sector = in.get<bool>();
+
+        f.wages_paid = in.get<double>();
+        f.bonuses_paid = in.get<double>();
+        f.sales_tax_paid = in.get<double>();
+        f.sales_receipts = in.get<double>();
+        f.investment = in.get<double>();
+        f.num_hired = in.get<qint32>();
+        f.num_fired = in.get<qint32>();
+        f.num_just_fired = in.get<qint32>();
+        f.state_supported = in.get<bool>();
+        f.productivity = in.get<double>();
+        f.dedns = in.get<double>();
+
+        in.getArray(f.employees);
+
+        if (f.kind != EmployerKind::firm)
+        {
+            f.reserves = in.get<double>();
+            in.getArray(f.bank_accounts);
+        }
+
+        if (f.kind == EmployerKind::government)
+        {
+            ok = ok && in.getCount(5) == 5;
+            in.getArray(f.totals, 5);
+        }
+    }
+
+    /*
+     * Lists
+     */
+    QVector<qint32> firm_list, bank_list;
+    in.getArray(firm_list);
+    in.getArray(bank_list);
+    const qint32 gov = in.get<qint32>();
+
+    /*
+     * Record
+     */
+    PropertyRecord restored;
+    restored.first_period = in.get<qint32>();
+    ok = ok && in.get<qint32>() == qint32(Property::num_properties);
+    for (int i = 0; ok && i < int(Property::num_properties); i++)
+    {
+        in.getArray(restored.columns[i], i == 0 ? -1 : restored.count());
+    }
+
+    ok = ok && in.ok();
+
+    /*
+     * Check the references. The employment links are used as indices by
+     * hire, fire and nextUnemployed, so check that they are in range and that
+     * the pool and the workers' positions in it agree.
+     */
+    const int pool_size = pool.count();
+    for (int p = 0; ok && p < pool_size; p++)
+    {
+        int i = pool[p];
+        ok = i >= 0 && i < pop && ws.pool_pos[i] == p;
+    }
+    for (int i = 0; ok && i < pop; i++)
+    {
+        int e = ws.employer[i];
+        int p = ws.pool_pos[i];
+        ok = e >= -1 && e < num_employers
+                && (p == -1 || (p >= 0 && p < pool_size && pool[p] == i));
+    }
+
+    auto isAccount = [&](qint32 r) {
+        return r >= -1 && r < num_employers + pop;
+    };
+
+    auto isBank = [&](qint32 r) {   // banks and the government
+        return r == -1 || (r >= 0 && r < num_employers
+                           && employer_states[r].kind != EmployerKind::firm);
+    };
+
+    for (int i = 0; ok && i < pop; i++)
+    {
+        ok = isBank(worker_accounts[i].bank);
+    }
+
+    for (int e = 0; ok && e < num_employers; e++)
+    {
+        const EmployerState &f = employer_states[e];
+        ok = isBank(f.account.bank);
+        foreach (qint32 ix, f.employees)
+        {
+            ok = ok && ix >= 0 && ix < pop;
+        }
+        foreach (qint32 r, f.bank_accounts)
+        {
+            ok = ok && isAccount(r);
+        }
+    }
+
+    foreach (qint32 e, firm_list)
+    {
+        ok = ok && e >= 0 && e < num_employers;
+    }
+
+    foreach (qint32 e, bank_list)
+    {
+        ok = ok && isBank(e);
+    }
+
+    ok = ok && gov >= 0 && gov < num_employers
+            && employer_states[gov].kind == EmployerKind::government;
+
+    if (!ok)
+    {
+        error = fileName + " is damaged";
+        return false;
+    }
+
+    /*
+     * The file is good, so replace the domain's state with it
+     */
+    _currency = currency;
+    _abbrev = abbrev;
+    params = restored_params;
+    loadParameters();
+
+    seed = restored_seed;
+    inequality.setMode(inequality_mode);
+    last_period = restored_last_period;
+    start_ups = restored_start_ups;
+    _population = population;
+    _startups = startups;
+
+    _num_hired = counts[0];
+    _num_fired = counts[1];
+    _num_firms = counts[2];
+    _num_emps = counts[3];
+    _num_unemps = counts[4];
+    _num_gov_emps = counts[5];
+    _pop_size = counts[6];
+
+    const double *v = values;
+    _exp = *v++; _bens = *v++; _rcpts = *v++; _gov_bal = *v++;
+    _prod_bal = *v++; _wages = *v++; _consumption = *v++; _bonuses = *v++;
+    _dedns = *v++; _inc_tax = *v++; _sales_tax = *v++; _dom_bal = *v++;
+    _loan_prob = *v++; _amount_owed = *v++; _deficit = *v++;
+    _pc_active = *v++; _bus_size = *v++; _proc_exp = *v++;
+    _productivity = *v++; _rel_productivity = *v++; _investment = *v++;
+    _gdp = *v++; _profit = *v++; _gini = *v++; _mean = *v++; _spread = *v++;
+
+    business = business_totals;
+    households = household_totals;
+
+    /*
+     * Remove the existing agents
+     */
+    qDeleteAll(firms);
+    firms.clear();
+    qDeleteAll(banks);
+    banks.clear();
+    delete _gov;
+    _gov = nullptr;
+    employers.clear();
+    workers.clear();
+
+    /*
+     * Workers. Creating a worker initialises its slot, so the workers must be
+     * created before the slots are filled.
+     */
+    wstore.reset(pop);
+    workers.reserve(size_t(pop));
+    for (int i = 0; i < pop; i++)
+    {
+        workers.emplace_back(this, i);
+    }
+    wstore = ws;
+    unemployed = pool;
+
+    /*
+     * The pool is kept as a heap (see Domain::unemployed), which it may not be
+     * in a file saved before it was. This changes nothing if it already is.
+     */
+    for (int p = pool_size / 2 - 1; p >= 0; p--)
+    {
+        poolSiftDown(p);
+    }
+
+    /*
+     * Employers. Each one registers itself (see registerEmployer) when it is
+     * created, so creating them in order gives them their original indices.
+     * Bank references may be to employers that haven't been created yet, so
+     * they are resolved afterwards.
+     */
+    for (int e = 0; e < num_employers; e++)
+    {
+        const EmployerState &s = employer_states[e];
+
+        Firm *f;
+        switch (s.kind)
+        {
+        case EmployerKind::bank:
+            f = new Bank(this);
+            break;
+        case EmployerKind::government:
+            f = new Government(this, 0);    // with no employees
+            break;
+        default:
+            f = new Firm(this);
+            break;
+        }
+        Q_ASSERT(f->_employer_ix == e);
+
+        f->_sector = s.in_sector ? &business : nullptr;
+
+        f->wages_paid = s.wages_paid;
+        f->bonuses_paid = s.bonuses_paid;
+        f->sales_tax_paid = s.sales_tax_paid;
+        f->sales_receipts = s.sales_receipts;
+        f->investment = s.investment;
+        f->num_hired = s.num_hired;
+        f->num_fired = s.num_fired;
+        f->num_just_fired = s.num_just_fired;
+        f->_state_supported = s.state_supported;
+        f->productivity = s.productivity;
+        f->_dedns = s.dedns;
+
+        f->employees.clear();
+        f->employees.reserve(s.employees.count());
+        foreach (qint32 ix, s.employees)
+        {
+            f->employees.append(&workers[size_t(ix)]);
+        }
+
+        if (s.kind != EmployerKind::firm)
+        {
+            static_cast<Bank *>(f)->reserves = s.reserves;
+        }
+
+        if (s.kind == EmployerKind::government)
+        {
+            Government *g = static_cast<Government *>(f);
+            g->exp = s.totals[0];
+            g->unbudgeted = s.totals[1];
+            g->rec = s.totals[2];
+            g->ben = s.totals[3];
+            g->proc = s.totals[4];
+        }
+    }
+
+    /*
+     * Resolve references (all checked above)
+     */
+    auto account = [&](qint32 r) -> Account * {
+        if (r < 0)
+        {
+            return nullptr;
+        }
+        if (r < num_employers)
+        {
+            return employers[r];
+        }
+        return &workers[size_t(r - num_employers)];
+    };
+
+    auto bank = [&](qint32 r) -> Bank * {
+        return static_cast<Bank *>(r < 0 ? nullptr : employers[r]);
+    };
+
+    auto restoreAccount = [&](Account *a, const AccountState &s) {
+        a->id = s.id;
+        a->_bank = bank(s.bank);
+        a->last_triggered = s.last_triggered;
+    };
+
+    for (int i = 0; i < pop; i++)
+    {
+        Worker &w = workers[size_t(i)];
+        restoreAccount(&w, worker_accounts[i]);
+        w.period_hired = period_hired[i];
+        w.period_fired = period_fired[i];
+    }
+
+    for (int e = 0; e < num_employers; e++)
+    {
+        const EmployerState &s = employer_states[e];
+        Firm *f = employers[e];
+
+        restoreAccount(f, s.account);
+        f->balance = s.account.balance;
+        f->owed_to_bank = s.account.owed_to_bank;
+        f->interest_rate = s.account.interest_rate;
+
+        if (s.kind != EmployerKind::firm)
+        {
+            Bank *b = static_cast<Bank *>(f);
+            b->accounts.clear();
+            foreach (qint32 r, s.bank_accounts)
+            {
+                b->accounts.append(account(r));
+            }
+        }
+    }
+
+    foreach (qint32 e, firm_list)
+    {
+        firms.append(employers[e]);
+    }
+
+    foreach (qint32 e, bank_list)
+    {
+        if (e >= 0)
+        {
+            banks.append(bank(e));
+        }
+    }
+
+    _gov = static_cast<Government *>(employers[gov]);
+
+    {
+        std::lock_guard<std::mutex> lock(record_mutex);
+        record = restored;
+    }
+
+    return true;
+}
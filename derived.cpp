@@ -0,0 +1,768 @@
+#include "derived.h"
+#include "log.h"
+
+#include <QSettings>
+
+#include <cmath>
+#include <cstring>
+
+/******************************************************************************
+ * ExpressionParser
+ ******************************************************************************/
+
+/*
+ * A recursive descent parser that appends the program for an expression to
+ * a DerivedExpression as it goes. Each parse function returns the lag of the
+ * subexpression it parsed (see DerivedExpression::lag), or -1 on failure, in
+ * which case error has been set.
+ *
+ *     expression := term (('+' | '-') term)*
+ *     term       := unary (('*' | '/') unary)*
+ *     unary      := '-' unary | primary
+ *     primary    := number | '[' name ']' | '{' key '}'
+ *                 | function '(' expression (',' expression)* ')'
+ *                 | '(' expression ')'
+ */
+class ExpressionParser
+{
+public:
+
+    ExpressionParser(const QString &text, const QStringList &derived,
+                     DerivedExpression &expr, QString &error)
+        : text(text), derived(derived), expr(expr), error(error)
+    {
+    }
+
+    bool parse()
+    {
+        int lag = expression();
+        if (lag < 0)
+        {
+            return false;
+        }
+
+        skipSpace();
+        if (pos < text.length())
+        {
+            return fail(QString("Unexpected '%1'").arg(text[pos]));
+        }
+
+        expr.lag = lag;
+        return true;
+    }
+
+private:
+
+    const QString &text;
+    const QStringList &derived;
+    DerivedExpression &expr;
+    QString &error;
+
+    int pos = 0;
+    int depth = 0;
+
+    typedef DerivedExpression::Op Op;
+
+    bool fail(const QString &message)
+    {
+        error = message + QString(" at position %1").arg(pos + 1);
+        return false;
+    }
+
+    void skipSpace()
+    {
+        while (pos < text.length() && text[pos].isSpace())
+        {
+            pos++;
+        }
+    }
+
+    bool accept(QChar c)
+    {
+        skipSpace();
+        if (pos < text.length() && text[pos] == c)
+        {
+            pos++;
+            return true;
+        }
+        return false;
+    }
+
+    /*
+     * Append an instruction, keeping track of the depth of the stack
+     */
+    void put(Op op, int arg = 0, double value = 0)
+    {
+        switch (op)
+        {
+        case Op::number:
+        case Op::property:
+        case Op::derived:
+        case Op::parameter:
+            depth++;
+            expr.depth = qMax(expr.depth, depth);
+            break;
+
+        case Op::add:
+        case Op::subtract:
+        case Op::multiply:
+        case Op::divide:
+        case Op::min:
+        case Op::max:
+            depth--;
+            break;
+
+        default:
+            break;
+        }
+
+        expr.code.append({op, arg, value});
+    }
+
+    int expression()
+    {
+        int lag = term();
+        while (lag >= 0)
+        {
+            Op op;
+            if (accept('+'))
+            {
+                op = Op::add;
+            }
+            else if (accept('-'))
+            {
+                op = Op::subtract;
+            }
+            else
+            {
+                break;
+            }
+
+            int rhs = term();
+            if (rhs < 0)
+            {
+                return -1;
+            }
+            put(op);
+            lag = qMax(lag, rhs);
+        }
+        return lag;
+    }
+
+    int term()
+    {
+        int lag = unary();
+        while (lag >= 0)
+        {
+            Op op;
+            if (accept('*'))
+            {
+                op = Op::multiply;
+            }
+            else if (accept('/'))
+            {
+                op = Op::divide;
+            }
+            else
+            {
+                break;
+            }
+
+            int rhs = unary();
+            if (rhs < 0)
+            {
+                return -1;
+            }
+            put(op);
+            lag = qMax(lag, rhs);
+        }
+        return lag;
+    }
+
+    int unary()
+    {
+        if (accept('-'))
+        {
+            int lag = unary();
+            if (lag >= 0)
+            {
+                put(Op::negate);
+            }
+            return lag;
+        }
+        return primary();
+    }
+
+    /*
+     * The text up to (but not including) the given character, which is
+     * skipped
+     */
+    bool readUntil(QChar end, QString &s)
+    {
+        int close = text.indexOf(end, pos);
+        if (close < 0)
+        {
+            fail(QString("Missing '%1'").arg(end));
+            return false;
+        }
+        s = text.mid(pos, close - pos).trimmed();
+        pos = close + 1;
+        return true;
+    }
+
+    int primary()
+    {
+        skipSpace();
+        if (pos >= text.length())
+        {
+            fail("Unexpected end of expression");
+            return -1;
+        }
+
+        QChar c = text[pos];
+
+        if (c.isDigit() || c == '.')
+        {
+            return number();
+        }
+
+        if (c == '[')
+        {
+            pos++;
+            QString name;
+            if (!readUntil(']', name))
+            {
+                return -1;
+            }
+
+            int k = derived.indexOf(name);
+            if (k >= 0)
+            {
+                put(Op::derived, k);
+                if (!expr.used_derived.contains(k))
+                {
+                    expr.used_derived.append(k);
+                }
+                return 0;
+            }
+
+            auto it = Domain::propertyMap.constFind(name);
+            if (it == Domain::propertyMap.constEnd())
+            {
+                fail("Unknown property [" + name + "]");
+                return -1;
+            }
+            put(Op::property, static_cast<int>(it.value()));
+            if (!expr.used_properties.contains(it.value()))
+            {
+                expr.used_properties.append(it.value());
+            }
+            return 0;
+        }
+
+        if (c == '{')
+        {
+            pos++;
+            QString key;
+            if (!readUntil('}', key))
+            {
+                return -1;
+            }
+
+            ParamType p = Domain::parameterKeys.key(key, ParamType::num_params);
+            if (p == ParamType::num_params)
+            {
+                fail("Unknown parameter {" + key + "}");
+                return -1;
+            }
+            put(Op::parameter, static_cast<int>(p));
+            return 0;
+        }
+
+        if (c == '(')
+        {
+            pos++;
+            int lag = expression();
+            if (lag >= 0 && !accept(')'))
+            {
+                fail("Missing ')'");
+                return -1;
+            }
+            return lag;
+        }
+
+        if (c.isLetter())
+        {
+            return function();
+        }
+
+        fail(QString("Unexpected '%1'").arg(c));
+        return -1;
+    }
+
+    int number()
+    {
+        int start = pos;
+        while (pos < text.length() && (text[pos].isDigit() || text[pos] == '.'))
+        {
+            pos++;
+        }
+        if (pos < text.length() && (text[pos] == 'e' || text[pos] == 'E'))
+        {
+            int mark = pos++;
+            if (pos < text.length() && (text[pos] == '+' || text[pos] == '-'))
+            {
+                pos++;
+            }
+            if (pos < text.length() && text[pos].isDigit())
+            {
+                while (pos < text.length() && text[pos].isDigit())
+                {
+                    pos++;
+                }
+            }
+            else
+            {
+                pos = mark;     // not an exponent after all
+            }
+        }
+
+        bool ok;
+        double value = text.mid(start, pos - start).toDouble(&ok);
+        if (!ok)
+        {
+            pos = start;
+            fail("Bad number");
+            return -1;
+        }
+        put(Op::number, 0, value);
+        return 0;
+    }
+
+    int function()
+    {
+        int start = pos;
+        while (pos < text.length() && text[pos].isLetter())
+        {
+            pos++;
+        }
+        QString name = text.mid(start, pos - start);
+
+        int args;
+        Op op;
+        if (name == "abs")
+        {
+            op = Op::abs;
+            args = 1;
+        }
+        else if (name == "min")
+        {
+            op = Op::min;
+            args = 2;
+        }
+        else if (name == "max")
+        {
+            op = Op::max;
+            args = 2;
+        }
+        else if (name == "prev")
+        {
+            op = Op::prev;
+            args = 1;
+        }
+        else
+        {
+            pos = start;
+            fail("Unknown function " + name);
+            return -1;
+        }
+
+        if (!accept('('))
+        {
+            fail("Missing '(' after " + name);
+            return -1;
+        }
+
+        int lag = 0;
+        for (int i = 0; i < args; i++)
+        {
+            if (i > 0 && !accept(','))
+            {
+                fail(QString("%1 needs %2 arguments").arg(name).arg(args));
+                return -1;
+            }
+            int arg_lag = expression();
+            if (arg_lag < 0)
+            {
+                return -1;
+            }
+            lag = qMax(lag, arg_lag);
+        }
+
+        /*
+         * prev has an optional number of periods, which must be a whole
+         * number rather than an expression as it is needed when compiling
+         */
+        int periods = 1;
+        if (op == Op::prev && accept(','))
+        {
+            skipSpace();
+            int digits = pos;
+            while (pos < text.length() && text[pos].isDigit())
+            {
+                pos++;
+            }
+            bool ok;
+            periods = text.mid(digits, pos - digits).toInt(&ok);
+            if (!ok)
+            {
+                pos = digits;
+                fail("The number of periods for prev must be a whole number");
+                return -1;
+            }
+        }
+
+        if (!accept(')'))
+        {
+            fail("Missing ')' after the arguments of " + name);
+            return -1;
+        }
+
+        if (op == Op::prev)
+        {
+            put(op, periods);
+            return lag + periods;
+        }
+
+        put(op);
+        return lag;
+    }
+};
+
+/******************************************************************************
+ * DerivedExpression
+ ******************************************************************************/
+
+bool DerivedExpression::compile(const QString &text, const QStringList &derived,
+                                QString &error)
+{
+    *this = DerivedExpression();
+
+    ExpressionParser parser(text, derived, *this, error);
+    if (!parser.parse())
+    {
+        *this = DerivedExpression();
+        return false;
+    }
+    return true;
+}
+
+const QList<Property> &DerivedExpression::properties() const
+{
+    return used_properties;
+}
+
+const QList<int> &DerivedExpression::derivedProperties() const
+{
+    return used_derived;
+}
+
+/*
+ * Only the rows from lag rows before from are evaluated. Values looked up in
+ * rows before that (or before the start of the record) are taken as zero,
+ * which can only affect rows before from, which aren't kept.
+ */
+void DerivedExpression::evaluate(const PropertyRecord &record,
+                                 const QVector<QVector<double>> &derived,
+                                 const ParameterBlock &params,
+                                 QVector<double> &result, int from) const
+{
+    const int count = record.count();
+    result.resize(count);
+
+    if (from >= count || code.isEmpty())
+    {
+        return;
+    }
+
+    const int start = qMax(0, from - lag);
+    const int n = count - start;
+
+    /*
+     * The stack is depth columns of n rows, in one block
+     */
+    QVector<double> block(depth * n);
+    QVector<double*> stack(depth);
+    for (int i = 0; i < depth; i++)
+    {
+        stack[i] = block.data() + i * n;
+    }
+    int sp = 0;
+
+    for (const Instruction &instr : code)
+    {
+        double *a = sp >= 2 ? stack[sp - 2] : nullptr;
+        double *b = sp >= 1 ? stack[sp - 1] : nullptr;
+
+        switch (instr.op)
+        {
+        case Op::number:
+            std::fill(stack[sp], stack[sp] + n, instr.value);
+            sp++;
+            break;
+
+        case Op::property:
+            memcpy(stack[sp], record.columns[instr.arg].constData() + start,
+                   n * sizeof(double));
+            sp++;
+            break;
+
+        case Op::derived:
+            memcpy(stack[sp], derived[instr.arg].constData() + start,
+                   n * sizeof(double));
+            sp++;
+            break;
+
+        case Op::parameter:
+            std::fill(stack[sp], stack[sp] + n, params.values[instr.arg]);
+            sp++;
+            break;
+
+        case Op::add:
+            for (int i = 0; i < n; i++)
+            {
+                a[i] += b[i];
+            }
+            sp--;
+            break;
+
+        case Op::subtract:
+            for (int i = 0; i < n; i++)
+            {
+                a[i] -= b[i];
+            }
+            sp--;
+            break;
+
+        case Op::multiply:
+            for (int i = 0; i < n; i++)
+            {
+                a[i] *= b[i];
+            }
+            sp--;
+            break;
+
+        case Op::divide:
+            for (int i = 0; i < n; i++)
+            {
+                a[i] = b[i] == 0 ? 0 : a[i] / b[i];
+            }
+            sp--;
+            break;
+
+        case Op::negate:
+            for (int i = 0; i < n; i++)
+            {
+                b[i] = -b[i];
+            }
+            break;
+
+        case Op::abs:
+            for (int i = 0; i < n; i++)
+            {
+                b[i] = std::fabs(b[i]);
+            }
+            break;
+
+        case Op::min:
+            for (int i = 0; i < n; i++)
+            {
+                a[i] = qMin(a[i], b[i]);
+            }
+            sp--;
+            break;
+
+        case Op::max:
+            for (int i = 0; i < n; i++)
+            {
+                a[i] = qMax(a[i], b[i]);
+            }
+            sp--;
+            break;
+
+        case Op::prev:
+            for (int i = n - 1; i >= 0; i--)
+            {
+                b[i] = i >= instr.arg ? b[i - instr.arg] : 0;
+            }
+            break;
+        }
+    }
+
+    Q_ASSERT(sp == 1);
+    memcpy(result.data() + from, stack[0] + (from - start),
+           (count - from) * sizeof(double));
+}
+
+/******************************************************************************
+ * DerivedProperties
+ ******************************************************************************/
+
+void DerivedProperties::clear()
+{
+    definitions.clear();
+    expressions.clear();
+}
+
+bool DerivedProperties::add(const Definition &definition, QString &error)
+{
+    const QString &name = definition.name;
+
+    if (name.trimmed().isEmpty())
+    {
+        error = "A derived property must have a name";
+        return false;
+    }
+    if (name != name.trimmed() || name.contains('[') || name.contains(']'))
+    {
+        error = "\"" + name + "\": names can't contain brackets or start or"
+                " end with spaces";
+        return false;
+    }
+    if (Domain::propertyMap.contains(name) || indexOf(name) >= 0)
+    {
+        error = "There is already a property called \"" + name + "\"";
+        return false;
+    }
+
+    DerivedExpression expr;
+    QString message;
+    if (!expr.compile(definition.expression, names(), message))
+    {
+        error = name + ": " + message;
+        return false;
+    }
+
+    definitions.append(definition);
+    expressions.append(expr);
+    return true;
+}
+
+void DerivedProperties::read()
+{
+    clear();
+
+    QSettings settings;
+    int n = settings.beginReadArray("derived-properties");
+    for (int i = 0; i < n; i++)
+    {
+        settings.setArrayIndex(i);
+
+        Definition definition;
+        definition.name = settings.value("name").toString();
+        definition.expression = settings.value("expression").toString();
+
+        QString error;
+        if (!add(definition, error))
+        {
+            LOG_WARNING(LogCategory::engine) << "Derived property ignored:" << error;
+        }
+    }
+    settings.endArray();
+}
+
+void DerivedProperties::write() const
+{
+    QSettings settings;
+    settings.remove("derived-properties");
+    settings.beginWriteArray("derived-properties", definitions.count());
+    for (int i = 0; i < definitions.count(); i++)
+    {
+        settings.setArrayIndex(i);
+        settings.setValue("name", definitions[i].name);
+        settings.setValue("expression", definitions[i].expression);
+    }
+    settings.endArray();
+}
+
+int DerivedProperties::count() const
+{
+    return definitions.count();
+}
+
+bool DerivedProperties::isEmpty() const
+{
+    return definitions.isEmpty();
+}
+
+const DerivedProperties::Definition &DerivedProperties::definition(int k) const
+{
+    return definitions[k];
+}
+
+QStringList DerivedProperties::names() const
+{
+    QStringList list;
+    foreach (const Definition &definition, definitions)
+    {
+        list.append(definition.name);
+    }
+    return list;
+}
+
+int DerivedProperties::indexOf(const QString &name) const
+{
+    for (int k = 0; k < definitions.count(); k++)
+    {
+        if (definitions[k].name == name)
+        {
+            return k;
+        }
+    }
+    return -1;
+}
+
+/*
+ * A derived property can only refer to the ones before it, so working
+ * backwards from the end visits each one after everything that refers to it
+ */
+QList<Property> DerivedProperties::uses(const QList<int> &indices) const
+{
+    QVector<bool> wanted(count(), false);
+    foreach (int k, indices)
+    {
+        wanted[k] = true;
+    }
+
+    QList<Property> properties;
+    for (int k = count() - 1; k >= 0; k--)
+    {
+        if (!wanted[k])
+        {
+            continue;
+        }
+        foreach (Property p, expressions[k].properties())
+        {
+            if (!properties.contains(p))
+            {
+                properties.append(p);
+            }
+        }
+        foreach (int j, expressions[k].derivedProperties())
+        {
+            wanted[j] = true;
+        }
+    }
+    return properties;
+}
+
+void DerivedProperties::evaluate(const PropertyRecord &record,
+                                 const ParameterBlock &params,
+                                 QVector<QVector<double>> &columns, int from) const
+{
+    columns.resize(count());
+    for (int k = 0; k < count(); k++)
+    {
+        expressions[k].evaluate(record, columns, params, columns[k], from);
+    }
+}
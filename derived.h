@@ -0,0 +1,179 @@
+#ifndef DERIVED_H
+#define DERIVED_H
+
+#include "account.h"
+
+#include <QList>
+#include <QString>
+#include <QStringList>
+#include <QVector>
+
+/******************************************************************************
+ * A DerivedExpression is a formula for a user-defined property (see
+ * DerivedProperties), compiled into a short program for a stack machine.
+ * The program works on whole columns rather than single values: each
+ * instruction runs once per evaluation, over every period being evaluated,
+ * so the cost of a derived property is a few tight loops over the record
+ * rather than an interpreter step per value.
+ *
+ * An expression is made of
+ *
+ *     12, 0.5, 1e6      numbers
+ *     [name]            the value of a property in the same period, by the
+ *                       name shown in the property list (either a built-in
+ *                       property or a derived property defined before this
+ *                       one)
+ *     {key}             the value of a parameter of the domain, by its
+ *                       settings key (see Domain::parameterKeys), e.g.
+ *                       {income-tax-rate}
+ *     + - * /           arithmetic, with the usual precedence. Dividing by
+ *                       zero gives zero, as for the built-in percentages.
+ *     ( )               grouping
+ *     abs(x)            absolute value
+ *     min(x, y)         smaller and larger of two values
+ *     max(x, y)
+ *     prev(x)           the value of x one period (or n periods) earlier.
+ *     prev(x, n)        Periods before the first recorded one count as zero.
+ *
+ * so that, e.g., ([Consumption] - prev([Consumption])) * 100 /
+ * prev([Consumption]) is the growth in consumption as a percentage.
+ ******************************************************************************/
+
+class DerivedExpression
+{
+public:
+
+    /*
+     * Compile the text of an expression. Derived properties may be referred
+     * to by the names in derived, which are those defined before this one.
+     * On failure, returns false and sets error.
+     */
+    bool compile(const QString &text, const QStringList &derived, QString &error);
+
+    /*
+     * The built-in properties and (indices of) derived properties that are
+     * referred to directly
+     */
+    const QList<Property> &properties() const;
+    const QList<int> &derivedProperties() const;
+
+    /*
+     * Set rows from to record.count() - 1 of result to the values of the
+     * expression for the corresponding rows of the record, resizing result
+     * to record.count() and leaving the rows before from as they are.
+     * derived holds the columns of the derived properties defined before
+     * this one, which must have been evaluated at least as far.
+     */
+    void evaluate(const PropertyRecord &record, const QVector<QVector<double>> &derived,
+                  const ParameterBlock &params, QVector<double> &result,
+                  int from = 0) const;
+
+private:
+
+    enum class Op
+    {
+        number,         // push value
+        property,       // push column arg of the record
+        derived,        // push derived column arg
+        parameter,      // push parameter arg
+        add,
+        subtract,
+        multiply,
+        divide,
+        negate,
+        abs,
+        min,
+        max,
+        prev            // shift the top column down arg rows
+    };
+
+    struct Instruction
+    {
+        Op op;
+        int arg;
+        double value;
+    };
+
+    friend class ExpressionParser;
+
+    QVector<Instruction> code;
+    QList<Property> used_properties;
+    QList<int> used_derived;
+
+    int depth = 0;      // greatest number of columns on the stack
+    int lag = 0;        // greatest number of periods looked back
+};
+
+/******************************************************************************
+ * DerivedProperties holds the user-defined properties, each a name and an
+ * expression (see DerivedExpression). They are kept in settings, in the
+ * order in which they were defined, and are compiled when they are read.
+ * Their values are calculated from the record of a run (see PropertyRecord)
+ * when they are needed, rather than while the run is being made, so they
+ * cost nothing during the run and can be changed without running it again.
+ ******************************************************************************/
+
+class DerivedProperties
+{
+public:
+
+    struct Definition
+    {
+        QString name;
+        QString expression;
+    };
+
+    void clear();
+
+    /*
+     * Compile a definition and add it to the end of the list. The name must
+     * not be that of a built-in property or one already in the list, and the
+     * expression may only refer to the derived properties before it. On
+     * failure, returns false and sets error.
+     */
+    bool add(const Definition &definition, QString &error);
+
+    /*
+     * Replace the list with the definitions in settings ("derived-
+     * properties"), leaving out (and logging) any that can't be compiled.
+     * Domain::initialisePropertyMap must have been called first.
+     */
+    void read();
+
+    /*
+     * Replace the definitions in settings with this list
+     */
+    void write() const;
+
+    int count() const;
+    bool isEmpty() const;
+    const Definition &definition(int k) const;
+    QStringList names() const;
+
+    /*
+     * The index of the named property, or -1 if there isn't one
+     */
+    int indexOf(const QString &name) const;
+
+    /*
+     * The built-in properties that the given derived properties are
+     * calculated from, directly or through other derived properties (e.g. so
+     * that they can be recorded -- see Domain::setRecordedProperties)
+     */
+    QList<Property> uses(const QList<int> &indices) const;
+
+    /*
+     * Bring the column of each derived property up to date with the record,
+     * evaluating rows from onwards (see DerivedExpression::evaluate).
+     * columns is indexed as the list, and is resized as necessary.
+     */
+    void evaluate(const PropertyRecord &record, const ParameterBlock &params,
+                  QVector<QVector<double>> &columns, int from = 0) const;
+
+private:
+
+    QList<Definition> definitions;
+    QVector<DerivedExpression> expressions;
+};
+
+#endif // DERIVED_H
@@ -0,0 +1,88 @@
+#include "derivedpropertiesdialog.h"
+#include "ui_derivedpropertiesdialog.h"
+
+#include "account.h"
+#include "derived.h"
+
+#include <QMessageBox>
+#include <QTableWidgetItem>
+
+DerivedPropertiesDialog::DerivedPropertiesDialog(QWidget *parent) :
+    QDialog(parent),
+    ui(new Ui::DerivedPropertiesDialog)
+{
+    ui->setupUi(this);
+
+    ui->tableProperties->setColumnCount(2);
+    ui->tableProperties->setHorizontalHeaderLabels(
+                QStringList() << tr("Name") << tr("Expression"));
+
+    const DerivedProperties &derived = Domain::derivedProperties;
+    for (int k = 0; k < derived.count(); k++)
+    {
+        addRow(derived.definition(k).name, derived.definition(k).expression);
+    }
+    ui->tableProperties->resizeColumnToContents(0);
+}
+
+DerivedPropertiesDialog::~DerivedPropertiesDialog()
+{
+    delete ui;
+}
+
+void DerivedPropertiesDialog::addRow(const QString &name, const QString &expression)
+{
+    int row = ui->tableProperties->rowCount();
+    ui->tableProperties->insertRow(row);
+    ui->tableProperties->setItem(row, 0, new QTableWidgetItem(name));
+    ui->tableProperties->setItem(row, 1, new QTableWidgetItem(expression));
+}
+
+void DerivedPropertiesDialog::on_btnAdd_clicked()
+{
+    addRow(tr("New property"), "");
+    int row = ui->tableProperties->rowCount() - 1;
+    ui->tableProperties->setCurrentCell(row, 0);
+    ui->tableProperties->editItem(ui->tableProperties->item(row, 0));
+}
+
+void DerivedPropertiesDialog::on_btnRemove_clicked()
+{
+    int row = ui->tableProperties->currentRow();
+    if (row >= 0)
+    {
+        ui->tableProperties->removeRow(row);
+    }
+}
+
+/*
+ * Compile the whole list before saving any of it, so that settings never
+ * hold a list with errors in it
+ */
+void DerivedPropertiesDialog::accept()
+{
+    DerivedProperties derived;
+
+    for (int row = 0; row < ui->tableProperties->rowCount(); row++)
+    {
+        DerivedProperties::Definition definition;
+        QTableWidgetItem *name = ui->tableProperties->item(row, 0);
+        QTableWidgetItem *expression = ui->tableProperties->item(row, 1);
+        definition.name = name == nullptr ? QString() : name->text();
+        definition.expression = expression == nullptr ? QString() : expression->text();
+
+        QString error;
+        if (!derived.add(definition, error))
+        {
+            QMessageBox msgBox;
+            msgBox.setText(error);
+            msgBox.exec();
+            ui->tableProperties->setCurrentCell(row, 1);
+            return;
+        }
+    }
+
+    derived.write();
+
+    QDialog::accept();
+}
@@ -0,0 +1,35 @@
+#ifndef DERIVEDPROPERTIESDIALOG_H
+#define DERIVEDPROPERTIESDIALOG_H
+
+#include <QDialog>
+
+namespace Ui {
+class DerivedPropertiesDialog;
+}
+
+/*
+ * Edits the list of user-defined properties (see DerivedProperties). Each
+ * row is a name and an expression. The list is only saved to settings if
+ * every expression compiles.
+ */
+class DerivedPropertiesDialog : public QDialog
+{
+    Q_OBJECT
+
+public:
+    explicit DerivedPropertiesDialog(QWidget *parent = nullptr);
+    ~DerivedPropertiesDialog();
+
+    void accept() override;
+
+private slots:
+    void on_btnAdd_clicked();
+    void on_btnRemove_clicked();
+
+private:
+    Ui::DerivedPropertiesDialog *ui;
+
+    void addRow(const QString &name, const QString &expression);
+};
+
+#endif // DERIVEDPROPERTIESDIALOG_H
@@ -3,15 +3,25 @@
  */
 
 #include "account.h"
+#include "derived.h"
+#include "ensemble.h"
+#include "log.h"
+#include "parallel.h"
+#include "version.h"
 #include <math.h>
 #include "QtCore/qdebug.h"
+#include <QCryptographicHash>
+#include <QDataStream>
 #include <QSettings>
+#include <functional>
+#ifndef MICROSIM_HEADLESS
 #include <QListWidgetItem>
-#include <QSettings>
 #include <QMessageBox>
+#endif
 
 #define NUMBER_OF_BANKS 3
 #define CLEARING_FREQUENCY 10
+#define PURCHASE_SHARD_SIZE 16384   // workers per shard (see purchasePhase)
 
 /*
  * Statics
@@ -42,6 +52,8 @@ const QMap<ParamType,QString> Domain::parameterKeys     // static
 
 QMap<QString,Property> Domain::propertyMap;  // static, can't be const as we have to initialise it
 
+DerivedProperties Domain::derivedProperties;    // static
+
 void Domain::initialisePropertyMap()                    // static
 {
     static bool is_initialised = false;
@@ -130,11 +142,23 @@ Domain *Domain::getDomain(const QString &name)
 }
 
 
+void Domain::readSettings()
+{
+    QSettings settings;
+    inequality.setMode(Inequality::modeFromName(
+                           settings.value("inequality-mode", "exact").toString()));
+
+    seed = settings.value("random-seed", 1).toULongLong();
+    start_ups = settings.value("start-ups", 10).toInt();
+}
+
 void Domain::reset()
 {
-    qDebug() << "Initialising domain" << getName();
+    LOG_DEBUG(LogCategory::engine) << "Initialising domain" << getName();
     last_period = -1;
 
+    loadParameters();
+
     int pop = getParameterVal(ParamType::pop) * 100; // for internal use. For
                                                      // display, divide this by
                                                      // 100 to get the result
@@ -142,21 +166,55 @@ void Domain::reset()
                                                      // multiply by 10,000 for
                                                      // result in units
 
+    _population = getParameterVal(ParamType::pop);   // see getPopulation
+
     /*
-     * Remove old instances from the list of workers
+     * Clear the cached property values (see propertyRules). They are saved
+     * in checkpoints, and properties that aren't recorded keep their values
+     * from the previous run otherwise.
      */
-    for (int i = 0 ; i < workers.count(); i++)
+    _num_hired = _num_fired = _num_firms = _num_emps = _num_unemps = 0;
+    _num_gov_emps = _pop_size = 0;
+
+    _exp = _bens = _rcpts = _gov_bal = _prod_bal = _wages = _consumption = 0;
+    _bonuses = _dedns = _inc_tax = _sales_tax = _dom_bal = _loan_prob = 0;
+    _amount_owed = _deficit = _pc_active = _bus_size = _proc_exp = 0;
+    _productivity = _rel_productivity = _investment = _gdp = _profit = 0;
+    _gini = _mean = _spread = 0;
+
     {
-        delete(workers[i]);
+        std::lock_guard<std::mutex> lock(record_mutex);
+        record.clear();
+#ifndef MICROSIM_HEADLESS
+        band_lower.clear();
+        band_upper.clear();
+#endif
     }
+    _profiler.clear();
+
+    readSettings();
 
+    /*
+     * Remove old instances from the list of workers
+     */
     workers.clear();
 
+    /*
+     * Allocate and clear a slot in the WorkerStore for each worker before
+     * creating the workers themselves. Reserving space first ensures the
+     * workers are never moved, so pointers to them (e.g. in Firm::employees)
+     * stay valid.
+     */
+    wstore.reset(pop);
+
+    workers.reserve(pop);
     for (int i = 0 ; i < pop; i++)
     {
-        workers.append(new Worker(this));
+        workers.emplace_back(this, i);
     }
 
+    resetUnemployed();
+
     /*
      * Remove old instances from list of firms (this will include _gov)
      */
@@ -167,6 +225,12 @@ void Domain::reset()
 
     firms.clear();
 
+    /*
+     * New firms (including the government and banks) will register
+     * themselves as they are created
+     */
+    employers.clear();
+
     /*
      * Create a government with the required number of employees
      */
@@ -180,11 +244,11 @@ void Domain::reset()
      * Add firms
      */
 
-    QSettings settings;
-    int n = settings.value("start-ups", 10).toInt();
-    for (int i = 0; i < n; i++)
+    for (int i = 0; i < start_ups; i++)
     {
-        firms.append(new Firm(this));
+        Firm *firm = new Firm(this);
+        firm->_sector = &business;
+        firms.append(firm);
     }
 
     /*
@@ -207,6 +271,8 @@ void Domain::reset()
     {
         firm->init();
     }
+
+    recountTotals();
 }
 
 
@@ -216,7 +282,7 @@ void Domain::reset()
  */
 Domain::Domain(const QString &name)
 {
-    qDebug() << "Domain::Domain(" << name << ")";
+    LOG_DEBUG(LogCategory::engine) << "Domain::Domain(" << name << ")";
 
     /*
      * Set the domain's parameters. Note that this is driven by the
@@ -251,6 +317,16 @@ Domain::Domain(const QString &name)
     }
 
     _name = name;
+
+    /*
+     * FNV-1a hash of the name (qHash is seeded differently in each process)
+     */
+    domain_key = Q_UINT64_C(14695981039346656037);
+    foreach (char c, name.toUtf8())
+    {
+        domain_key = (domain_key ^ quint8(c)) * Q_UINT64_C(1099511628211);
+    }
+
     _currency = settings.value("Currency", "Units").toString();
     _abbrev = settings.value("Abbrev", "CU").toString();
 
@@ -263,15 +339,19 @@ Domain::Domain(const QString &name)
         }
         else
         {
-            QMessageBox msgBox;
             QString msgText;
 
             msgText = "Parameter \"" + key_string
                     + "\" is missing from settings for "
                     + name;
 
+#ifdef MICROSIM_HEADLESS
+            LOG_WARNING(LogCategory::engine) << msgText;
+#else
+            QMessageBox msgBox;
             msgBox.setText(msgText);
             msgBox.exec();
+#endif
         }
     }
     if (!is_default)
@@ -280,6 +360,8 @@ Domain::Domain(const QString &name)
     }
     settings.endGroup();        // Domains or Default
 
+    setRecordedProperties(QList<Property>());   // all of them
+
     /*
      * We separate out initialisation so we can reset everything before
      * (re)drawing the charts.
@@ -291,6 +373,59 @@ Domain::Domain(const QString &name)
      * Add this domain to the list of domains
      */
     domains.append(this);
+    _listed = true;
+}
+
+Domain *Domain::cloneDomain(const Domain *base,
+                            const QMap<ParamType,int> &overrides)  // static
+{
+    return new Domain(base, overrides);
+}
+
+/*
+ * Unlike the other constructor this doesn't read the parameters from
+ * settings (reset() still reads the general settings, e.g. start-ups)
+ */
+Domain::Domain(const Domain *base, const QMap<ParamType,int> &overrides)
+{
+    _name = base->_name;
+    _currency = base->_currency;
+    _abbrev = base->_abbrev;
+    domain_key = base->domain_key;
+
+    params = base->params;
+    for (auto it = overrides.constBegin(); it != overrides.constEnd(); ++it)
+    {
+        params[it.key()] = it.value();
+    }
+
+    record_plan = base->record_plan;
+
+    _gov = nullptr;
+    reset();
+
+    /*
+     * reset() reads these from settings, but the base may have overridden
+     * them
+     */
+    seed = base->seed;
+    inequality.setMode(base->inequality.mode());
+}
+
+Domain::~Domain()
+{
+    /*
+     * Clones (see cloneDomain) are deleted on other threads and were never
+     * on the list, so they mustn't look at it
+     */
+    if (_listed)
+    {
+        domains.removeOne(this);
+    }
+
+    qDeleteAll(firms);
+    qDeleteAll(banks);
+    delete _gov;
 }
 
 /*
@@ -302,66 +437,216 @@ int Domain::restoreDomains(QStringList &domainNameList)
     {
         createDomain(name);
     }
-    qDebug() << domains.count() << "domains created";
+    LOG_DEBUG(LogCategory::engine) << domains.count() << "domains created";
     return domains.count();
 }
 
-void Domain::drawCharts(QListWidget *propertyList)
+#ifndef MICROSIM_HEADLESS
+void Domain::redrawCharts(QListWidget *propertyList)
 {
-    qDebug() << "Domain::drawCharts() called. propertyList contains"
-             << propertyList->count() << "properties";
+    foreach(Domain *dom, domains)
+    {
+        dom->redrawChart(propertyList);
+    }
+}
 
-    /*
-     * Draw an unpopulated chart for each domain, creating the necessary
-     * series in a QMap but not yet attaching them to the chart
-     */
+void Domain::updateCharts()
+{
     foreach(Domain *dom, domains)
     {
-        qDebug() << "Initialising domain" << dom->getName();
-        dom->reset();
-        dom->drawChart(propertyList);
+        dom->updateChart();
     }
+}
 
-    /*
-     * Iterate for the required number of periods, populating the series
-     */
-    QSettings settings;
-    int iterations = settings.value("iterations", 100).toInt();
-    int start_period = settings.value("start-period").toInt();
+void Domain::redrawChart(QListWidget *propertyList)
+{
+    if (chart != nullptr)
+    {
+        drawChart(propertyList);
+        addSeriesToChart();
+    }
+}
+
+void Domain::updateChart()
+{
+    if (chart != nullptr)
+    {
+        updateSeries();
+    }
+}
 
-    for (int period = 0; period <= iterations + start_period; period++)
+bool Domain::recordsAvailable()
+{
+    foreach(Domain *dom, domains)
     {
-        foreach(Domain *dom, domains)
+        if (dom->snapshot().isEmpty())
         {
-            dom->iterate(period, period < start_period);
+            return false;
         }
     }
+    return true;
+}
 
-    /*
-     * Now add the populated series to each of the charts...
-     */
-    foreach(Domain *dom, domains)
+void Domain::runEnsemble(int max_runs, double tolerance, int iterations,
+                         int start_period, const std::atomic<bool> *cancel,
+                         std::atomic<int> *progress)
+{
+    QList<Property> properties;
+    for (int i = 0; i < int(Property::num_properties); i++)
     {
-        dom->addSeriesToChart();
+        properties.append(Property(i));
     }
 
+    Ensemble ensemble(this);
+    ensemble.setProperties(properties);
+    ensemble.setPeriods(iterations, start_period);
+    ensemble.setRuns(max_runs);
+    ensemble.setTolerance(tolerance);
+    ensemble.setCancelFlag(cancel);
+    ensemble.setProgressCounter(progress);
+
+    int runs = ensemble.run();
+    LOG_DEBUG(LogCategory::runs) << "Domain" << getName() << "ensemble of" << runs << "runs";
+
+    if (runs == 0)
+    {
+        return;
+    }
+
+    PropertyRecord mean, lower, upper;
+    mean.clear(ensemble.periods());
+    lower.clear(ensemble.periods());
+    upper.clear(ensemble.periods());
+
+    mean.first_period = lower.first_period = upper.first_period
+            = ensemble.firstPeriod();
+
+    for (int k = 0; k < properties.count(); k++)
+    {
+        for (int t = 0; t < ensemble.periods(); t++)
+        {
+            mean.columns[k].append(ensemble.mean(k, t));
+            lower.columns[k].append(ensemble.lower(k, t));
+            upper.columns[k].append(ensemble.upper(k, t));
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(record_mutex);
+    record = mean;
+    band_lower = lower;
+    band_upper = upper;
+}
+
+/*
+ * Convert a column of the record to points for a series
+ */
+static QVector<QPointF> toPoints(const PropertyRecord &record, Property p)
+{
+    const QVector<double> &column = record.column(p);
+
+    QVector<QPointF> points;
+    points.reserve(column.count());
+    for (int r = 0; r < column.count(); r++)
+    {
+        points.append(QPointF(record.first_period + r, column[r]));
+    }
+    return points;
+}
+
+static QVector<QPointF> toPoints(const PropertyRecord &record,
+                                 const QVector<double> &column)
+{
+    QVector<QPointF> points;
+    points.reserve(column.count());
+    for (int r = 0; r < column.count(); r++)
+    {
+        points.append(QPointF(record.first_period + r, column[r]));
+    }
+    return points;
+}
+
+/*
+ * Fill the series of the derived properties, which are calculated from the
+ * record here rather than recorded. In ensemble mode they are calculated
+ * from the mean, and there is no band around them.
+ */
+void Domain::updateDerivedSeries(const PropertyRecord &values)
+{
+    if (derived_series.isEmpty())
+    {
+        return;
+    }
+
+    ParameterBlock block;
+    block.load(params);
+
+    QVector<QVector<double>> columns;
+    derivedProperties.evaluate(values, block, columns);
+
+    for (auto it = derived_series.begin(); it != derived_series.end(); ++it)
+    {
+        it.value()->replace(toPoints(values, columns[it.key()]));
+    }
 }
 
 void Domain::addSeriesToChart()
 {
+    std::unique_lock<std::mutex> lock(record_mutex);
+    PropertyRecord values = record;
+    PropertyRecord lower_values = band_lower;
+    PropertyRecord upper_values = band_upper;
+    lock.unlock();
+
+
     auto it = series.begin();
     while (it != series.end())
     {
+        it.value()->replace(toPoints(values, it.key()));
         chart->addSeries(it.value());
+
+        /*
+         * In ensemble mode, shade the band around the mean in a paler version
+         * of the same colour. The bounding series belong to the area series,
+         * so they are deleted with it.
+         */
+        if (!lower_values.isEmpty())
+        {
+            QAreaSeries *band = new QAreaSeries();
+            QLineSeries *upper = new QLineSeries(band);
+            QLineSeries *lower = new QLineSeries(band);
+
+            upper->replace(toPoints(upper_values, it.key()));
+            lower->replace(toPoints(lower_values, it.key()));
+            band->setUpperSeries(upper);
+            band->setLowerSeries(lower);
+
+            band->setName(it.value()->name() + tr(" (5-95%)"));
+            QColor colour = it.value()->color();
+            colour.setAlpha(64);
+            band->setColor(colour);
+            band->setBorderColor(Qt::transparent);
+
+            chart->addSeries(band);
+        }
+
         ++it;
     }
+
+    updateDerivedSeries(values);
+    foreach (QLineSeries *ser, derived_series)
+    {
+        chart->addSeries(ser);
+    }
+
     chart->createDefaultAxes();
 
     /* TODO
      *
-     * prod should be a dynamic variable (_prod) accessible as a property
+     * prod should be a dynamic variable (_prod) accessible as a property.
+     * (getProductivity can't be called here as the domain may be running on
+     * another thread.)
      */
-    double prod = getProductivity();
+    // double prod = getProductivity();
 
     // We will need to re-instate these labels on the status bars
 //    inequalityLabel->setText(tr("Inequality: ") + QString::number(round(gini * 100)) + "%");
@@ -370,6 +655,281 @@ void Domain::addSeriesToChart()
     // emit drawingCompleted();
 }
 
+void Domain::updateSeries()
+{
+    PropertyRecord values = snapshot();
+
+    for (auto it = series.begin(); it != series.end(); ++it)
+    {
+        it.value()->replace(toPoints(values, it.key()));
+    }
+    updateDerivedSeries(values);
+
+    chart->createDefaultAxes();
+}
+#endif
+
+/*
+ * Called by the Firm constructor. Returns the index of the firm in the list
+ * of employers.
+ */
+int Domain::registerEmployer(Firm *firm)
+{
+    employers.append(firm);
+    return employers.count() - 1;
+}
+
+void Domain::resetUnemployed()
+{
+    int pop = static_cast<int>(workers.size());
+
+    unemployed.resize(pop);
+
+    int *pool = unemployed.data();
+    int *pool_pos = wstore.pool_pos.data();
+    int *employer = wstore.employer.data();
+
+    /*
+     * In ascending order, which is already a heap
+     */
+    for (int i = 0; i < pop; i++)
+    {
+        pool[i] = i;
+        pool_pos[i] = i;
+        employer[i] = -1;
+    }
+}
+
+void Domain::poolSiftUp(int pos)
+{
+    int *pool = unemployed.data();
+    int *pool_pos = wstore.pool_pos.data();
+    int ix = pool[pos];
+
+    while (pos > 0)
+    {
+        int parent = (pos - 1) / 2;
+        if (pool[parent] < ix)
+        {
+            break;
+        }
+        pool[pos] = pool[parent];
+        pool_pos[pool[pos]] = pos;
+        pos = parent;
+    }
+
+    pool[pos] = ix;
+    pool_pos[ix] = pos;
+}
+
+void Domain::poolSiftDown(int pos)
+{
+    int *pool = unemployed.data();
+    int *pool_pos = wstore.pool_pos.data();
+    int count = unemployed.count();
+    int ix = pool[pos];
+
+    for (;;)
+    {
+        int child = 2 * pos + 1;
+        if (child >= count)
+        {
+            break;
+        }
+        if (child + 1 < count && pool[child + 1] < pool[child])
+        {
+            child++;
+        }
+        if (ix < pool[child])
+        {
+            break;
+        }
+        pool[pos] = pool[child];
+        pool_pos[pool[pos]] = pos;
+        pos = child;
+    }
+
+    pool[pos] = ix;
+    pool_pos[ix] = pos;
+}
+
+Worker *Domain::nextUnemployed()
+{
+    return unemployed.isEmpty() ? nullptr : &workers[unemployed.first()];
+}
+
+void Domain::hire(Worker *w, Firm *f)
+{
+    int pos = wstore.pool_pos[w->ix];
+    Q_ASSERT(pos >= 0);
+
+    /*
+     * Move the last worker in the pool into the hired worker's place and
+     * then up or down to where it belongs
+     */
+    int last = unemployed.last();
+    unemployed.removeLast();
+    wstore.pool_pos[w->ix] = -1;
+    if (pos < unemployed.count())
+    {
+        unemployed[pos] = last;
+        if (last < w->ix)
+        {
+            poolSiftUp(pos);
+        }
+        else
+        {
+            poolSiftDown(pos);
+        }
+    }
+
+    w->setEmployer(f);
+    f->employees.append(w);
+    _profiler.count(ProfileCounter::hires);
+
+    if (f->_sector != nullptr)
+    {
+        f->_sector->employees++;
+    }
+}
+
+void Domain::fire(Worker *w)
+{
+    Q_ASSERT(wstore.pool_pos[w->ix] < 0);
+
+    Firm *f = w->getEmployer();
+    if (f != nullptr && f->_sector != nullptr)
+    {
+        f->_sector->employees--;
+    }
+
+    w->setEmployer(nullptr);
+    unemployed.append(w->ix);
+    poolSiftUp(unemployed.count() - 1);
+    _profiler.count(ProfileCounter::fires);
+}
+
+/*
+ * This visits every firm and worker, so it should only be used where the
+ * totals can't be kept up to date incrementally (see SectorTotals)
+ */
+void Domain::recountTotals()
+{
+    business.clear();
+    for (int i = 0; i < firms.count(); i++)
+    {
+        Firm *f = firms[i];
+        business.employees += f->employees.count();
+        business.balance += f->balance;
+        business.owed += f->owed_to_bank;
+        business.wages += f->wages_paid;
+        business.sales_receipts += f->sales_receipts;
+        business.sales_tax += f->sales_tax_paid;
+        business.investment += f->investment;
+    }
+
+    households.clear();
+    const double *balance = wstore.balance.constData();
+    const double *purchases = wstore.purchases.constData();
+    const double *inc_tax = wstore.inc_tax.constData();
+    for (int i = 0, c = wstore.count(); i < c; i++)
+    {
+        households.balance += balance[i];
+        households.purchases += purchases[i];
+        households.inc_tax += inc_tax[i];
+    }
+}
+
+void Domain::purchasePhase(int period)
+{
+    const int pop = static_cast<int>(workers.size());
+    const int num_firms = firms.count();
+    const int num_shards = (pop + PURCHASE_SHARD_SIZE - 1) / PURCHASE_SHARD_SIZE;
+
+    /*
+     * Read the parameters once, here, rather than for every worker
+     */
+    const double thresh = parameter(ParamType::inc_thresh);
+    const double prop_con = parameter(ParamType::prop_con);
+
+    purchase_shards.resize(num_shards);
+
+    double *balance = wstore.balance.data();
+    double *purchases = wstore.purchases.data();
+
+    parallelFor(num_shards, [&](int s) {
+        PurchaseShard &shard = purchase_shards[s];
+        shard.receipts.fill(0.0, num_firms);
+        shard.purchases = 0;
+        shard.count = 0;
+
+        double *receipts = shard.receipts.data();
+
+        int end = std::min(pop, (s + 1) * PURCHASE_SHARD_SIZE);
+        for (int i = s * PURCHASE_SHARD_SIZE; i < end; i++)
+        {
+            Worker &w = workers[size_t(i)];
+            if (period <= w.last_triggered)    // to prevent double counting
+            {
+                continue;
+            }
+            w.last_triggered = period;
+
+            double purch;
+            if (balance[i] <= thresh)
+            {
+                purch = balance[i];
+            }
+            else
+            {
+                purch = (((balance[i] - thresh) * prop_con) / 100 ) + thresh;
+            }
+
+            /*
+             * As Worker::trigger, choosing a firm as selectRandomFirm does.
+             * Each worker has its own random stream, so the choice doesn't
+             * depend on which shard or thread the worker is in.
+             */
+            if (purch > 0 && purch <= balance[i] && num_firms > 0)
+            {
+                RandomStream rs = randomStream(RandomStream::Purpose::purchase,
+                                               quint64(i));
+                int f = int(rs.bounded(quint32(num_firms)));
+                receipts[f] += purch;
+                balance[i] -= purch;
+                purchases[i] += purch;
+                shard.purchases += purch;
+                shard.count++;
+            }
+        }
+    });
+
+    /*
+     * Merge the shards in order, on this thread. Firms pay sales tax to the
+     * government as they are credited.
+     */
+    for (int s = 0; s < num_shards; s++)
+    {
+        households.balance -= purchase_shards[s].purchases;
+        households.purchases += purchase_shards[s].purchases;
+        _profiler.count(ProfileCounter::transactions, purchase_shards[s].count);
+    }
+
+    for (int f = 0; f < num_firms; f++)
+    {
+        double total = 0;
+        for (int s = 0; s < num_shards; s++)
+        {
+            total += purchase_shards[s].receipts[f];
+        }
+
+        if (total > 0)
+        {
+            firms[f]->creditSales(total);
+        }
+    }
+}
+
 Firm *Domain::createFirm(bool state_supported)
 {
     Firm *firm = new Firm(this, state_supported);
@@ -379,43 +939,45 @@ Firm *Domain::createFirm(bool state_supported)
 //        QSettings settings;
 //        hireSome(firm, getStdWage(), 0, settings.value("government-employees").toInt());
     }
+    firm->_sector = &business;
     firms.append(firm);
     return firm;
 }
 
-/*
- * Returns any firm except the government (which is not in the list of firms)
- * and the firm indicated by the exclude argument. If there are none nullptr is
- * returned.
- */
-Firm *Domain::selectRandomFirm(Firm *exclude)
+Firm *Domain::selectRandomFirm(RandomStream &rs, Firm *exclude)
 {
-    Firm *res = nullptr;
     int n = firms.size();
+    int excluded = exclude == nullptr ? -1 : firms.indexOf(exclude);
 
-    if (n == 0)
+    if (excluded >= 0)
     {
-        res = nullptr;
+        n--;
     }
-    else
+
+    if (n <= 0)
     {
-        /*
-         * Warning: this could go on forever if there's only one firm and it's
-         * excluded. This shouldn't be possible normally.
-         */
-        while ( (res = firms[ (qrand() % (firms.size() - 1)) ]) == exclude );
+        return nullptr;
     }
 
-    return res;
+    /*
+     * Choose from the remaining firms and skip over the excluded one
+     */
+    int i = int(rs.bounded(quint32(n)));
+    if (excluded >= 0 && i >= excluded)
+    {
+        i++;
+    }
+
+    return firms[i];
 }
 
 /*
  * This function returns a pointer to one of the banks belonging to the domain,
  * chosen at random.
  */
-Bank *Domain::selectRandomBank()
+Bank *Domain::selectRandomBank(RandomStream &rs)
 {
-    return banks[(qrand() % (banks.size() - 1))];   // *** CHECK THIS! ***
+    return banks.isEmpty() ? nullptr : banks[int(rs.bounded(quint32(banks.size())))];
 }
 
 /*
@@ -431,43 +993,71 @@ Property Domain::getProperty(QString propertyName)
     return it.value();
 }
 
+static inline double valueOf(const double *values, Property p)
+{
+    return values[static_cast<int>(p)];
+}
+
 /*
  * Properties are domain values that are liable to change at each iteration.
- * This function returns the current value of each property. Note that is is
- * important for the order of properties inside the switch to ne maintained
- * as some properties are dependent of properties defined earlier.
+ * Each one has a rule giving the properties it is calculated from and how to
+ * calculate it (see PropertyRule). Rules that depend on other properties
+ * read them from the values already calculated for the period rather than
+ * from the cached fields (_exp etc.), so the order in which the properties
+ * are listed doesn't matter. The cached fields are still set, as they are
+ * saved in checkpoints and some of the get...() functions use them.
  */
-double Domain::getPropertyVal(Property p)
+const QVector<PropertyRule> &Domain::propertyRules()   // static
 {
-    switch(p)
-    {
-    case Property::num_gov_emps:
-        return _gov->getNumEmployees();
-
-    case Property::pop_size:
-        _pop_size = getPopulation();
-        return double(_pop_size);
-
-    case Property::gov_exp:
-        _exp = _gov->getExpenditure();
-        return _exp;
-
-    case Property::bens_paid:
-        _bens = _gov->getBenefitsPaid();
-        return _bens;
-
-    case Property::gov_exp_plus:
-        return _exp + _bens;
-
-    case Property::gov_recpts:
-        _rcpts = _gov->getReceipts();
-        return _rcpts;
-
-    case Property::deficit:
-        _deficit = _exp + _bens - _rcpts;
-        return _deficit;
+    static const QVector<PropertyRule> rules = []() {
+
+        QVector<PropertyRule> r(static_cast<int>(Property::num_properties));
+
+        auto rule = [&r](Property p, QVector<Property> depends,
+                         PropertyRule::Evaluator evaluate) {
+            r[static_cast<int>(p)].depends = depends;
+            r[static_cast<int>(p)].evaluate = evaluate;
+        };
+
+        rule(Property::num_gov_emps, {}, [](Domain *dom, const double *) {
+            dom->_num_gov_emps = dom->_gov->getNumEmployees();
+            return double(dom->_num_gov_emps);
+        });
+
+        rule(Property::pop_size, {}, [](Domain *dom, const double *) {
+            dom->_pop_size = dom->getPopulation();
+            return double(dom->_pop_size);
+        });
+
+        rule(Property::gov_exp, {}, [](Domain *dom, const double *) {
+            dom->_exp = dom->_gov->getExpenditure();
+            return dom->_exp;
+        });
+
+        rule(Property::bens_paid, {}, [](Domain *dom, const double *) {
+            dom->_bens = dom->_gov->getBenefitsPaid();
+            return dom->_bens;
+        });
+
+        rule(Property::gov_exp_plus, {Property::gov_exp, Property::bens_paid},
+             [](Domain *, const double *v) {
+            return valueOf(v, Property::gov_exp) + valueOf(v, Property::bens_paid);
+        });
+
+        rule(Property::gov_recpts, {}, [](Domain *dom, const double *) {
+            dom->_rcpts = dom->_gov->getReceipts();
+            return dom->_rcpts;
+        });
+
+        rule(Property::deficit,
+             {Property::gov_exp, Property::bens_paid, Property::gov_recpts},
+             [](Domain *dom, const double *v) {
+            dom->_deficit = valueOf(v, Property::gov_exp)
+                    + valueOf(v, Property::bens_paid)
+                    - valueOf(v, Property::gov_recpts);
+            return dom->_deficit;
+        });
 
-    case Property::gov_bal:
         /*
          * This will always be negative as the government is never in receipt
          * of its own currency. It amounts to the sum of all government
@@ -476,153 +1066,307 @@ double Domain::getPropertyVal(Property p)
          * taken as offsetting expenditure. To find the 'deficit' (see above)
          * you have to add tax receipts.
          */
-        _gov_bal = _gov->getBalance();
-        return _gov_bal;
+        rule(Property::gov_bal, {}, [](Domain *dom, const double *) {
+            dom->_gov_bal = dom->_gov->getBalance();
+            return dom->_gov_bal;
+        });
+
+        rule(Property::num_firms, {}, [](Domain *dom, const double *) {
+            dom->_num_firms = dom->firms.count();
+            return double(dom->_num_firms);
+        });
+
+        rule(Property::num_emps, {}, [](Domain *dom, const double *) {
+            dom->_num_emps = dom->getNumEmployed();
+            return double(dom->_num_emps);
+        });
+
+        rule(Property::pc_emps, {Property::num_emps, Property::pop_size},
+             [](Domain *, const double *v) {
+            double pop = valueOf(v, Property::pop_size);
+            return pop > 0 ? valueOf(v, Property::num_emps) * 100 / pop : 0.0;
+        });
+
+        rule(Property::num_unemps, {}, [](Domain *dom, const double *) {
+            dom->_num_unemps = dom->getNumUnemployed();
+            return double(dom->_num_unemps);
+        });
+
+        rule(Property::pc_unemps, {Property::num_unemps, Property::pop_size},
+             [](Domain *, const double *v) {
+            double pop = valueOf(v, Property::pop_size);
+            return pop > 0 ? valueOf(v, Property::num_unemps) * 100 / pop : 0.0;
+        });
+
+        rule(Property::pc_active, {Property::num_emps, Property::num_unemps},
+             [](Domain *dom, const double *v) {
+            dom->_pc_active = (valueOf(v, Property::num_emps)
+                               + valueOf(v, Property::num_unemps)) / 10;  // assuming granularity 1000
+            return dom->_pc_active;
+        });
+
+        rule(Property::num_hired, {}, [](Domain *dom, const double *) {
+            return double(dom->_num_hired);
+        });
+
+        rule(Property::num_fired, {}, [](Domain *dom, const double *) {
+            return double(dom->_num_fired);
+        });
+
+        rule(Property::amount_owed, {}, [](Domain *dom, const double *) {
+            dom->_amount_owed = dom->getAmountOwed();
+            return dom->_amount_owed;
+        });
+
+        rule(Property::prod_bal, {Property::amount_owed}, [](Domain *dom, const double *v) {
+            dom->_prod_bal = dom->getProdBal();                 // ignoring loans
+            return dom->_prod_bal - valueOf(v, Property::amount_owed);
+                                                // but show minus loans
+                                                // see http://bilbo.economicoutlook.net/blog/?p=32396
+                                                // where domestic sector is taken
+                                                // to include banks
+        });
 
-    case Property::num_firms:
-        _num_firms = firms.count();
-        //qDebug() << "_num_firms =" << _num_firms;
-        return double(_num_firms);
+        rule(Property::wages, {}, [](Domain *dom, const double *) {
+            dom->_wages = dom->getWagesPaid();  // not cumulative -- consider adding cumulative amount
+            return dom->_wages;
+        });
 
-    case Property::num_emps:
-        _num_emps = getNumEmployed();
-        return double(_num_emps);
+        rule(Property::consumption, {}, [](Domain *dom, const double *) {
+            dom->_consumption = dom->getPurchasesMade();    // not cumulative -- consider adding cumulative amount
+            return dom->_consumption;
+        });
 
-    case Property::pc_emps:
-        return (_pop_size > 0 ? double(_num_emps * 100) / _pop_size : 0.0);
+        rule(Property::deficit_pc, {Property::deficit, Property::consumption},
+             [](Domain *, const double *v) {
+            double consumption = valueOf(v, Property::consumption);
+            return abs(consumption) < 1.0
+                    ? 0.0 : (valueOf(v, Property::deficit) * 100) / consumption;
+        });
 
-    case Property::num_unemps:
-        _num_unemps = getNumUnemployed();
-        return double(_num_unemps);
+        /*
+         * Calculated in the inequality phase of iterate()
+         */
+        rule(Property::gini, {}, [](Domain *dom, const double *) {
+            return dom->_gini;
+        });
+
+        rule(Property::mean, {}, [](Domain *dom, const double *) {
+            return dom->_mean;
+        });
+
+        rule(Property::spread, {}, [](Domain *dom, const double *) {
+            return dom->_spread;
+        });
+
+        rule(Property::bonuses, {}, [](Domain *dom, const double *) {
+            dom->_bonuses = dom->getBonusesPaid();
+            return dom->_bonuses;
+        });
+
+        rule(Property::dedns, {}, [](Domain *dom, const double *) {
+            return dom->_dedns;
+        });
+
+        rule(Property::inc_tax, {}, [](Domain *dom, const double *) {
+            dom->_inc_tax = dom->getIncTaxPaid();
+            return dom->_inc_tax;
+        });
+
+        rule(Property::sales_tax, {}, [](Domain *dom, const double *) {
+            dom->_sales_tax = dom->getSalesTaxPaid();
+            return dom->_sales_tax;
+        });
+
+        rule(Property::dom_bal, {}, [](Domain *dom, const double *) {
+            dom->_dom_bal = dom->getWorkersBal();
+            return dom->_dom_bal;
+        });
+
+        /*
+         * The government is counted as a firm. This uses its own counts
+         * rather than the num_firms and num_emps properties, which don't
+         * include the government.
+         */
+        rule(Property::bus_size, {}, [](Domain *dom, const double *) {
+            int num_firms = dom->firms.count() + 1;
+            int num_emps = dom->_gov->employees.count() + dom->business.employees;
+            dom->_bus_size = num_emps / num_firms;
+            return dom->_bus_size;
+        });
+
+        rule(Property::hundred, {}, [](Domain *, const double *) {
+            return 100.0;
+        });
+
+        rule(Property::zero, {}, [](Domain *, const double *) {
+            return 0.0;
+        });
+
+        rule(Property::procurement, {}, [](Domain *dom, const double *) {
+            dom->_proc_exp = dom->getProcurementExpenditure();  // government purchases
+            return dom->_proc_exp;
+        });
 
-    case Property::pc_unemps:
-        return (_pop_size > 0 ? double(_num_unemps * 100) / _pop_size : 0);
+        /*
+         * getProductivity() uses _pop_size
+         */
+        rule(Property::productivity, {Property::pop_size}, [](Domain *dom, const double *) {
+            dom->_productivity = dom->getProductivity();
+            return dom->_productivity;
+        });
+
+        rule(Property::rel_productivity,
+             {Property::productivity, Property::pop_size, Property::num_emps},
+             [](Domain *dom, const double *v) {
+            double num_emps = valueOf(v, Property::num_emps);
+            if (num_emps == 0)
+            {
+                dom->_rel_productivity = 1.0;   // default
+            }
+            else
+            {
+                dom->_rel_productivity = (valueOf(v, Property::productivity)
+                                          * valueOf(v, Property::pop_size)) / num_emps;
+            }
+            return dom->_rel_productivity;
+        });
+
+        rule(Property::unbudgeted, {}, [](Domain *dom, const double *) {
+            return dom->_gov->getUnbudgetedExp();
+        });
 
-    case Property::pc_active:
-        _pc_active = double(_num_emps + _num_unemps) / 10;  // assuming granularity 1000
-        return _pc_active;
+        /*
+         * The following properties may need reinstating
+         *
+         *
 
-    case Property::num_hired:
-        return double(_num_hired);
+        investment:
+            _investment = getInvestment();
 
-    case Property::num_fired:
-        return double(_num_fired);
+        gdp:
+            //_gdp = _consumption + _investment + _exp + _bens;
+            _gdp = _consumption - _investment;  // https://en.wikipedia.org/wiki/Gross_domestic_product
 
-    case Property::prod_bal:
-        _amount_owed = getAmountOwed();
-        _prod_bal = getProdBal();               // ignoring loans
-        return _prod_bal - _amount_owed;        // but show minus loans
-                                                // see http://bilbo.economicoutlook.net/blog/?p=32396
-                                                // where domestic sector is taken
-                                                // to include banks
+        profit:
+            // ***** I don't think we should be subtracting income tax here!
+            _profit = _gdp - _wages - _inc_tax - _sales_tax;
+        */
 
-    case Property::wages:
-        _wages = getWagesPaid();                // not cumulative -- consider adding cumulative amount
-        return _wages;
+        for (int i = 0; i < r.count(); i++)
+        {
+            Q_ASSERT(r[i].evaluate != nullptr);
+        }
 
-    case Property::consumption:
-        _consumption = getPurchasesMade();      // not cumulative -- consider adding cumulative amount
-        return _consumption;
+        return r;
+    }();
 
-    case Property::deficit_pc:
-        return abs(_consumption) < 1.0 ? 0.0 : (_deficit * 100) / _consumption;
+    return rules;
+}
 
-    case Property::gini:
-        return _gini;
+double Domain::getPropertyVal(Property p)
+{
+    PropertyPlan plan;
+    plan.compile(propertyRules(), QList<Property>() << p);
 
-    case Property::mean:
-        return _mean;
+    double values[static_cast<int>(Property::num_properties)] = {};
+    plan.evaluate(this, values);
 
-    case Property::spread:
-        return _spread;
+    return valueOf(values, p);
+}
 
-    case Property::bonuses:
-        _bonuses = getBonusesPaid();
-        return _bonuses;
+void Domain::setRecordedProperties(const QList<Property> &properties)
+{
+    record_plan.compile(propertyRules(), properties);
+}
 
-    case Property::dedns:
-        return _dedns;
+const PropertyRecord &Domain::recorded() const
+{
+    return record;
+}
 
-    case Property::inc_tax:
-        _inc_tax = getIncTaxPaid();
-        return _inc_tax;
+PropertyRecord Domain::snapshot() const
+{
+    std::lock_guard<std::mutex> lock(record_mutex);
+    return record;
+}
 
-    case Property::sales_tax:
-        _sales_tax = getSalesTaxPaid();
-        return _sales_tax;
+Profiler &Domain::profiler()
+{
+    return _profiler;
+}
 
-    case Property::dom_bal:
-        _dom_bal = getWorkersBal();
-        return _dom_bal;
+void Domain::restoreRecord(const PropertyRecord &values)
+{
+    std::lock_guard<std::mutex> lock(record_mutex);
+    record = values;
+}
 
-    case Property::amount_owed:
-        //_amount_owed = getAmountOwed();
-        return _amount_owed;
+QByteArray Domain::runHash(int iterations, int start_period) const
+{
+    QByteArray data;
+    QDataStream out(&data, QIODevice::WriteOnly);
 
-    case Property::bus_size:
-        _num_firms = 1;                             // government is a firm
-        _num_emps = _gov->employees.count();
-        foreach(Firm *f, firms)
-        {
-            ++_num_firms;
-            //qDebug() << "Firm has" << f->employees.count();
-            _num_emps += f->employees.count();
-        }
-        qDebug() << "_num_emps =" << _num_emps;
-        _bus_size = _num_emps  / _num_firms;
-        return _bus_size;
+    out << quint32(ENGINE_VERSION) << _name << _currency << _abbrev;
 
-    case Property::hundred:
-        return 100.0;
+    for (auto it = params.constBegin(); it != params.constEnd(); ++it)
+    {
+        out << qint32(it.key()) << qint32(it.value());
+    }
 
-    case Property::zero:
-        return 0.0;
+    out << qint32(start_ups) << seed
+        << Inequality::modeName(inequality.mode())
+        << qint32(iterations) << qint32(start_period);
 
-    case Property::procurement:
-        _proc_exp = getProcurementExpenditure();    // government purchases
-        return _proc_exp;
+    return QCryptographicHash::hash(data, QCryptographicHash::Sha1);
+}
 
-    case Property::productivity:
-        _productivity = getProductivity();
-        return _productivity;
+void Domain::reserveRecord(int periods)
+{
+    std::lock_guard<std::mutex> lock(record_mutex);
+    record.clear(periods);
+}
 
-    case Property::rel_productivity:
-      if (_num_emps == 0) {
-        Q_ASSERT(_rel_productivity != 0.0);
-        _rel_productivity = 1.0; // default
-      } else {
-        _rel_productivity = (_productivity * _pop_size) / _num_emps;
-      }
-      return _rel_productivity;
+void Domain::recordProperties(int period)
+{
+    /*
+     * Evaluate the properties first so the lock is only held while they are
+     * appended
+     */
+    double values[int(Property::num_properties)] = {};
+    record_plan.evaluate(this, values);
 
-    case Property::unbudgeted:
-        return _gov->getUnbudgetedExp();
+    std::lock_guard<std::mutex> lock(record_mutex);
 
+    if (record.isEmpty())
+    {
+        record.first_period = period;
+    }
 
-    /*
-     * The following properties may need reinstating
-     *
-     *
+    for (int i = 0; i < int(Property::num_properties); i++)
+    {
+        record.columns[i].append(values[i]);
+    }
+}
 
-    case Property::investment:
-        _investment = getInvestment();
-        return _investment;
+RandomStream Domain::randomStream(RandomStream::Purpose purpose, quint64 agent)
+{
+    return RandomStream(seed, domain_key, last_period, agent, purpose);
+}
 
-    case Property::gdp:
-        //_gdp = _consumption + _investment + _exp + _bens;
-        _gdp = _consumption - _investment;  // https://en.wikipedia.org/wiki/Gross_domestic_product
-        return _gdp;
+void Domain::setRandomSeed(quint64 seed)
+{
+    this->seed = seed;
+}
 
-    case Property::profit:
-        // ***** I don't think we should be subtracting income tax here!
-        _profit = _gdp - _wages - _inc_tax - _sales_tax;
-        return _profit;
-    */
+quint64 Domain::randomSeed() const
+{
+    return seed;
+}
 
-    case Property::num_properties:
-        Q_ASSERT(false);
-        return 0;                       // prevent compiler warning
-    }
+void Domain::setInequalityMode(Inequality::Mode mode)
+{
+    inequality.setMode(mode);
 }
 
 /*
@@ -647,6 +1391,7 @@ double Domain::getProductivity()
 }
 
 
+#ifndef MICROSIM_HEADLESS
 void Domain::setChartView(QChartView *chartView)
 {
     _chartView = chartView;
@@ -655,11 +1400,11 @@ void Domain::setChartView(QChartView *chartView)
 
 /*
  * drawChart() simply sets up a chart but doesn't populate it.
- * See drawCharts...
+ * See redrawCharts...
  */
 void Domain::drawChart(QListWidget *propertyList)
 {
-    qDebug() << "Domain::drawChart(...) called";
+    LOG_DEBUG(LogCategory::gui) << "Domain::drawChart(...) called";
 
     /*
      * Note that the parameters may have been changed since the last time
@@ -671,6 +1416,7 @@ void Domain::drawChart(QListWidget *propertyList)
 
     chart->removeAllSeries();   // built-in chart series
     series.clear();             // our global copy, used to hold generated data points
+    derived_series.clear();
 
     chart->legend()->setAlignment(Qt::AlignTop);
     chart->legend()->show();
@@ -679,7 +1425,7 @@ void Domain::drawChart(QListWidget *propertyList)
 
     Q_ASSERT(propertyList->count() > 0);
 
-    for (int i = 0; i < int(Property::num_properties); i++)
+    for (int i = 0; i < propertyList->count(); i++)
     {
         /*
          * We need to construct a line series for each selected property. We
@@ -695,20 +1441,30 @@ void Domain::drawChart(QListWidget *propertyList)
             QString series_name = item->text();
             QLineSeries *ser = new QLineSeries();
 
-            Property p = propertyMap[series_name];
-
-
             ser->setName(series_name);
 
             /*
              * This just inserts the series into our list of series. It doesn't
-             * add it to the chart
+             * add it to the chart. Items that aren't built-in properties are
+             * derived properties (see MainWindow::createDockWindows).
              */
             //series.insert(static_cast<Property>(i), ser);
-            series.insert(p, ser);
+            if (propertyMap.contains(series_name))
+            {
+                series.insert(propertyMap[series_name], ser);
+            }
+            else if (derivedProperties.indexOf(series_name) >= 0)
+            {
+                derived_series.insert(derivedProperties.indexOf(series_name), ser);
+            }
+            else
+            {
+                delete ser;
+            }
         }
     }
 }
+#endif
 
 // NEXT: IN PROGRESS...
 
@@ -716,12 +1472,24 @@ void Domain::iterate(int period, bool silent)
 {
     Q_ASSERT(period > last_period);
 
+    /*
+     * Each phase ends with a call to endPhase, which times it if profiling is
+     * enabled
+     */
+    _profiler.beginPeriod(period);
+
     // -------------------------------------------
     // Initialisation phase
     // -------------------------------------------
 
     last_period = period;
 
+    /*
+     * Take the parameters for this period, so that nothing from here on has
+     * to look them up in params
+     */
+    loadParameters();
+
     if (period == 0)
     {
         /*
@@ -743,10 +1511,13 @@ void Domain::iterate(int period, bool silent)
         /*
          * Initialise workers
          */
-        for (int i = 0; i < workers.count(); i++)
+        for (size_t i = 0; i < workers.size(); i++)
         {
-            workers[i]->init();
+            workers[i].init();
         }
+
+        resetUnemployed();
+        recountTotals();
     }
 
     /*
@@ -756,6 +1527,8 @@ void Domain::iterate(int period, bool silent)
     _num_fired = 0;
     _dedns = 0;             // TODO: CHECK THIS
 
+    _profiler.endPhase(ProfilePhase::initialisation);
+
     // -------------------------------------------
     // Trigger phase
     // -------------------------------------------
@@ -765,6 +1538,7 @@ void Domain::iterate(int period, bool silent)
      * workers before they are triggered
      */
     _gov->trigger(period);
+    _profiler.endPhase(ProfilePhase::government);
 
     // Triggered firms will pay deductions to government and wages to
     // workers. Firms will also fire any workers they can't afford to pay.
@@ -773,12 +1547,11 @@ void Domain::iterate(int period, bool silent)
     {
         firms[i]->trigger(period);
     }
+    _profiler.endPhase(ProfilePhase::firms);
 
     // Trigger workers to make purchases
-    for (int i = 0; i < workers.count(); i++)
-    {
-        workers[i]->trigger(period);
-    }
+    purchasePhase(period);
+    _profiler.endPhase(ProfilePhase::workers);
 
 
     // -------------------------------------------
@@ -791,83 +1564,40 @@ void Domain::iterate(int period, bool silent)
     {
         firms[i]->epilogue();
     }
+    _profiler.endPhase(ProfilePhase::firm_epilogue);
+
+    // Same for workers so they can keep rolling averages up to date. This is
+    // equivalent to calling Worker::epilogue for each worker but runs
+    // directly over the WorkerStore.
+    const int pop = static_cast<int>(workers.size());
 
-    // Same for workers so they can keep rolling averages up to date
-    for (int i = 0, c = workers.count(); i < c; i++)
+    const double *wages = wstore.wages.constData();
+    const int *employer = wstore.employer.constData();
+    double *average_wages = wstore.average_wages.data();
+
+    for (int i = 0; i < pop; i++)
     {
-        workers[i]->epilogue(period);
+        average_wages[i] = (wages[i] + average_wages[i]) / 2;
     }
+    _profiler.endPhase(ProfilePhase::worker_epilogue);
 
     /*
      * Wage-related derived properties (Gini, spread and mean)
      */
+    double *n = inequality.values(pop);
 
-    const int pop = workers.count();
-
-    double total = 0;
-    double rms = 0;
-
-    double a = 0;
-
-    double n[pop];
-
-    int i;
-
-    for (i = 0; i < pop; i++)
+    for (int i = 0; i < pop; i++)
     {
-        Worker *w = workers[i];
-        n[i] = w->getAverageWages();        // extend as required
-        Q_ASSERT(n[i] >= 0);
-
-        total += n[i];  // for RMS
+        // As Worker::getAverageWages() -- extend as required
+        n[i] = employer[i] < 0 ? 0 : average_wages[i];
     }
 
-    _mean = double(total / pop);
-    Q_ASSERT(_mean >= 0.0);
+    inequality.calculate(pop, period == 0);
 
-    if (period == 0)
-    {
-        _gini = 0;
-        _spread = 0;
-    }
-    else
-    {
-        std::sort(n, n + pop);                  // ascending order
-
-        for (i = 1; i < pop; i++)
-        {
-            double d = (n[i - 1] - _mean);
-            rms +=  d * d;
-        }
-        rms = sqrt(rms / pop);
-
-        for (i = 1; i < pop; i++)
-        {
-            n[i] += n[i - 1];                    // make values cumulative
-        }
-
-        _spread = _mean > 0 ? ((rms * 3) / _mean) : 0;
-
-        double a_tot = (total * pop) / 2;        // area A+B
-
-        for (int i = 1; i < pop; i++)
-        {
-            double diff = ((total * i) / pop) - n[i - 1];
-            Q_ASSERT(diff >= 0);
-            a += diff;                          // area A
-        }
-
-        _gini = (round(double(a * 100) / double(a_tot)))/100;
-
-        if (_gini > 100 || _gini < 0)
-        {
-            Q_ASSERT(_gini >= 0 && _gini <= 1);
-        }
-
-        qDebug() << "a =" << a << ", a_tot =" << a_tot << "gini =" << _gini
-                 << "RMS =" << rms << "range ±" << (_spread * 100)
-                 << "% of mean, mean =" << _mean;
-    }
+    _gini = inequality.gini();
+    _mean = inequality.mean();
+    _spread = inequality.spread();
+    _profiler.endPhase(ProfilePhase::inequality);
 
 
     /*
@@ -883,19 +1613,15 @@ void Domain::iterate(int period, bool silent)
     // -------------------------------------------
 
     /*
-     * Append the values from this iteration to the series
+     * Record the values from this iteration, and let any other observers
+     * (e.g. the batch runner) know they're there
      */
-    for (auto it = series.begin(); it != series.end(); ++it)
+    if (!silent)
     {
-        Property p = it.key();
-        QLineSeries *s = series[p];
-        double value = getPropertyVal(p);
-
-        if (!silent)
-        {
-            s->append(period, value);
-        }
+        recordProperties(period);
+        emit iterated(period);
     }
+    _profiler.endPhase(ProfilePhase::record);
 
 
     // -------------------------------------------
@@ -903,15 +1629,24 @@ void Domain::iterate(int period, bool silent)
     // -------------------------------------------
 
     // Create a new firm, possibly
-    if (qrand() % 100 < getFCP())
+    RandomStream rs = randomStream(RandomStream::Purpose::firm_creation,
+                                   DOMAIN_AGENT);
+    if (int(rs.bounded(100)) < getFCP())
     {
-        qDebug() << "Creating new firm";
+        LOG_DEBUG(LogCategory::engine) << "Creating new firm";
         createFirm();
 
 
-        qDebug() << "*** Number of firms =" << firms.count();
+        LOG_DEBUG(LogCategory::engine) << "*** Number of firms =" << firms.count();
     }
+    _profiler.endPhase(ProfilePhase::exogenous);
+
+    _profiler.endPeriod();
+}
 
+int Domain::lastPeriod() const
+{
+    return last_period;
 }
 
 Government *Domain::government()
@@ -935,21 +1670,17 @@ int Domain::getPopulation()
 
 int Domain::getNumEmployed()
 {
-    int n = 0;
-    for (int i = 0; i < firms.count(); i++)
-    {
-        n += firms[i]->employees.count();
-    }
-
-    return n;
+    return business.employees;
 }
 
 int Domain::getNumEmployedBy(Firm *firm)
 {
     int n = 0;
-    for (int i = 0; i < workers.count(); i++)
+    const int ix = firm->_employer_ix;
+    const int *employer = wstore.employer.constData();
+    for (int i = 0, c = wstore.count(); i < c; i++)
     {
-        if (workers[i]->isEmployedBy(firm))
+        if (employer[i] == ix)
         {
             n++;
         }
@@ -960,38 +1691,17 @@ int Domain::getNumEmployedBy(Firm *firm)
 
 int Domain::getNumUnemployed()
 {
-    int n = 0;
-    for (int i = 0; i < workers.count(); i++)
-    {
-        if (!workers[i]->isEmployed())
-        {
-            n++;
-        }
-    }
-
-    return n;
+    return unemployed.count();
 }
 
 double Domain::getPurchasesMade()
 {
-    double tot = 0;
-    for (int i = 0; i < workers.count(); i++)
-    {
-        tot += workers[i]->getPurchasesMade();
-    }
-
-    return tot;
+    return households.purchases;
 }
 
 double Domain::getSalesReceipts()
 {
-    double tot = 0;
-    for (int i = 0; i < firms.count(); i++)
-    {
-        tot += firms[i]->getSalesReceipts();
-    }
-
-    return tot;
+    return business.sales_receipts;
 }
 
 double Domain::getBonusesPaid()
@@ -1012,35 +1722,17 @@ double Domain::getDednsPaid()
 
 double Domain::getIncTaxPaid()
 {
-    double tot = 0;
-    for (int i = 0; i < workers.count(); i++)
-    {
-        tot += workers[i]->getIncTaxPaid();
-    }
-
-    return tot;
+    return households.inc_tax;
 }
 
 double Domain::getSalesTaxPaid()
 {
-    double tot = 0;
-    for (int i = 0; i < firms.count(); i++)
-    {
-        tot += firms[i]->getSalesTaxPaid();
-    }
-
-    return tot;
+    return business.sales_tax;
 }
 
 double Domain::getWorkersBal()
 {
-    double tot = 0.0;
-    for (int i = 0; i < workers.count(); i++)
-    {
-        tot += workers[i]->getBalance();
-    }
-
-    return tot;
+    return households.balance;
 }
 
 // TODO: At present only businesses can get loans, but this should be extended
@@ -1048,12 +1740,7 @@ double Domain::getWorkersBal()
 // central bank -- i.e. from the government.
 double Domain::getAmountOwed()
 {
-    double tot = 0;
-    for (int i = 0; i < firms.count(); i++)
-    {
-        tot += firms[i]->getAmountOwed();
-    }
-    return tot;
+    return business.owed;
 }
 
 int Domain::getNumHired()
@@ -1068,40 +1755,99 @@ int Domain::getNumFired()
 
 double Domain::getProdBal()
 {
-    double bal = 0;
-    for (int i = 0; i < firms.count(); i++)
-    {
-        bal += firms[i]->getBalance();
-    }
-
-    return bal;
+    return business.balance;
 }
 
 double Domain::getWagesPaid()
 {
-    double tot = 0.0;
-    for (int i = 0; i < firms.count(); i++)
+    return business.wages;
+}
+
+double Domain::getInvestment()
+{
+    return business.investment;
+}
+
+void ParameterBlock::load(const QMap<ParamType,int> &params)
+{
+    for (int i = 0; i < static_cast<int>(ParamType::num_params); i++)
     {
-        tot += firms[i]->getWagesPaid();
+        values[i] = params.value(ParamType(i), 0);
     }
+}
 
-    return tot;
+void Domain::loadParameters()
+{
+    param_block.load(params);
 }
 
-double Domain::getInvestment()
+/*
+ * The steps are put in order by a depth-first search of the dependencies,
+ * each property being added after everything it depends on. A property that
+ * is reached again while its own dependencies are still being searched is
+ * part of a cycle.
+ */
+void PropertyPlan::compile(const QVector<PropertyRule> &rules,
+                           const QList<Property> &wanted)
 {
-    double tot = 0.0;
-    for (int i = 0; i < firms.count(); i++)
+    enum { unvisited, visiting, done };
+    QVector<int> state(rules.count(), unvisited);
+
+    steps.clear();
+
+    std::function<void(int)> visit = [&](int index) {
+        if (state[index] == done)
+        {
+            return;
+        }
+        if (state[index] == visiting)
+        {
+            LOG_WARNING(LogCategory::engine) << "Properties depend on each other in a cycle";
+            Q_ASSERT(false);
+            return;
+        }
+
+        state[index] = visiting;
+        foreach (Property p, rules[index].depends)
+        {
+            visit(static_cast<int>(p));
+        }
+        state[index] = done;
+
+        steps.append({index, rules[index].evaluate});
+    };
+
+    if (wanted.isEmpty())
     {
-        tot += firms[i]->getInvestment();
+        for (int i = 0; i < rules.count(); i++)
+        {
+            visit(i);
+        }
+    }
+    else
+    {
+        foreach (Property p, wanted)
+        {
+            visit(static_cast<int>(p));
+        }
     }
+}
 
-    return tot;
+bool PropertyPlan::includes(Property p) const
+{
+    for (const Step &step : steps)
+    {
+        if (step.index == static_cast<int>(p))
+        {
+            return true;
+        }
+    }
+    return false;
 }
 
 int Domain::getParameterVal(ParamType type)
 {
-    return params[type];
+    return static_cast<int>(param_block[type]);
 }
 
 /*
@@ -1172,7 +1918,7 @@ int Domain::getUBR()
  */
 int Domain::getDistributionRate()
 {
-    return params[ParamType::distrib];
+    return getParameterVal(ParamType::distrib);
 }
 
 int Domain::getPropInv()
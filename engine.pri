@@ -0,0 +1,40 @@
+#-------------------------------------------------
+#
+# Simulation engine. These sources depend only on QtCore when built with
+# MICROSIM_HEADLESS defined, and are shared by the GUI (microsim.pro) and the
+# batch runner (microsim-batch.pro).
+#
+#-------------------------------------------------
+
+SOURCES += \
+    $$PWD/domain.cpp \
+    $$PWD/account.cpp \
+    $$PWD/worker.cpp \
+    $$PWD/firm.cpp \
+    $$PWD/government.cpp \
+    $$PWD/bank.cpp \
+    $$PWD/checkpoint.cpp \
+    $$PWD/derived.cpp \
+    $$PWD/exporter.cpp \
+    $$PWD/inequality.cpp \
+    $$PWD/log.cpp \
+    $$PWD/parallel.cpp \
+    $$PWD/profiler.cpp \
+    $$PWD/resultcache.cpp \
+    $$PWD/resultfile.cpp \
+    $$PWD/sweep.cpp \
+    $$PWD/ensemble.cpp
+
+HEADERS += \
+    $$PWD/account.h \
+    $$PWD/derived.h \
+    $$PWD/exporter.h \
+    $$PWD/inequality.h \
+    $$PWD/log.h \
+    $$PWD/parallel.h \
+    $$PWD/profiler.h \
+    $$PWD/randomstream.h \
+    $$PWD/resultcache.h \
+    $$PWD/resultfile.h \
+    $$PWD/sweep.h \
+    $$PWD/ensemble.h
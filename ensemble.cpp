@@ -0,0 +1,345 @@
+#include "ensemble.h"
+#include "log.h"
+#include "parallel.h"
+
+#include <algorithm>
+#include <math.h>
+
+/*
+ * StreamingQuantile
+ */
+
+StreamingQuantile::StreamingQuantile(double p)
+{
+    this->p = p;
+}
+
+void StreamingQuantile::add(double x)
+{
+    if (count < 5)
+    {
+        q[count++] = x;
+        if (count == 5)
+        {
+            std::sort(q, q + 5);
+            for (int i = 0; i < 5; i++)
+            {
+                n[i] = i;
+            }
+            np[0] = 0;
+            np[1] = 2 * p;
+            np[2] = 4 * p;
+            np[3] = 2 + 2 * p;
+            np[4] = 4;
+            dn[0] = 0;
+            dn[1] = p / 2;
+            dn[2] = p;
+            dn[3] = (1 + p) / 2;
+            dn[4] = 1;
+        }
+        return;
+    }
+
+    count++;
+
+    /*
+     * Find the cell containing x, extending the range if necessary
+     */
+    int k;
+    if (x < q[0])
+    {
+        q[0] = x;
+        k = 0;
+    }
+    else if (x >= q[4])
+    {
+        q[4] = x;
+        k = 3;
+    }
+    else
+    {
+        k = 0;
+        while (x >= q[k + 1])
+        {
+            k++;
+        }
+    }
+
+    for (int i = k + 1; i < 5; i++)
+    {
+        n[i]++;
+    }
+    for (int i = 0; i < 5; i++)
+    {
+        np[i] += dn[i];
+    }
+
+    /*
+     * Move the middle markers towards their desired positions
+     */
+    for (int i = 1; i < 4; i++)
+    {
+        double d = np[i] - n[i];
+        if ((d >= 1 && n[i + 1] - n[i] > 1) || (d <= -1 && n[i - 1] - n[i] < -1))
+        {
+            int s = d > 0 ? 1 : -1;
+            double qp = parabolic(i, s);
+            q[i] = (q[i - 1] < qp && qp < q[i + 1]) ? qp : linear(i, s);
+            n[i] += s;
+        }
+    }
+}
+
+double StreamingQuantile::parabolic(int i, int d) const
+{
+    return q[i] + d / (n[i + 1] - n[i - 1])
+            * ((n[i] - n[i - 1] + d) * (q[i + 1] - q[i]) / (n[i + 1] - n[i])
+               + (n[i + 1] - n[i] - d) * (q[i] - q[i - 1]) / (n[i] - n[i - 1]));
+}
+
+double StreamingQuantile::linear(int i, int d) const
+{
+    return q[i] + d * (q[i + d] - q[i]) / (n[i + d] - n[i]);
+}
+
+double StreamingQuantile::value() const
+{
+    if (count > 5)
+    {
+        return q[2];
+    }
+
+    if (count == 0)
+    {
+        return 0;
+    }
+
+    double v[5];
+    std::copy(q, q + count, v);
+    std::sort(v, v + count);
+
+    double pos = p * (count - 1);
+    int lo = int(floor(pos));
+    int hi = std::min(lo + 1, count - 1);
+    return v[lo] + (pos - lo) * (v[hi] - v[lo]);
+}
+
+/*
+ * Ensemble
+ */
+
+Ensemble::Ensemble(const Domain *base)
+{
+    this->base = base;
+}
+
+void Ensemble::setProperties(const QList<Property> &properties)
+{
+    this->properties = properties;
+}
+
+void Ensemble::setPeriods(int iterations, int start_period)
+{
+    this->iterations = iterations;
+    this->start_period = start_period;
+}
+
+void Ensemble::setRuns(int max_runs, int batch_size)
+{
+    this->max_runs = max_runs;
+    this->batch_size = std::max(1, batch_size);
+}
+
+void Ensemble::setTolerance(double tolerance)
+{
+    this->tolerance = tolerance;
+}
+
+void Ensemble::setBand(double lower, double upper)
+{
+    lower_p = lower;
+    upper_p = upper;
+}
+
+void Ensemble::setCancelFlag(const std::atomic<bool> *cancel)
+{
+    this->cancel = cancel;
+}
+
+void Ensemble::setProgressCounter(std::atomic<int> *progress)
+{
+    this->progress = progress;
+}
+
+int Ensemble::runs() const
+{
+    return _runs;
+}
+
+int Ensemble::periods() const
+{
+    return iterations + 1;
+}
+
+int Ensemble::firstPeriod() const
+{
+    return start_period;
+}
+
+Ensemble::Cell &Ensemble::cell(int k, int t)
+{
+    return cells[k * periods() + t];
+}
+
+const Ensemble::Cell &Ensemble::cell(int k, int t) const
+{
+    return cells[k * periods() + t];
+}
+
+double Ensemble::mean(int k, int t) const
+{
+    return cell(k, t).mean;
+}
+
+double Ensemble::lower(int k, int t) const
+{
+    return cell(k, t).lower.value();
+}
+
+double Ensemble::upper(int k, int t) const
+{
+    return cell(k, t).upper.value();
+}
+
+int Ensemble::run()
+{
+    Cell empty;
+    empty.lower = StreamingQuantile(lower_p);
+    empty.upper = StreamingQuantile(upper_p);
+
+    cells.fill(empty, properties.count() * periods());
+    _runs = 0;
+
+    QVector<double> previous;
+    QVector<QVector<double>> batch;
+
+    while (_runs < max_runs)
+    {
+        int n = std::min(batch_size, max_runs - _runs);
+        batch.resize(n);
+
+        /*
+         * Run k of the ensemble uses the base domain's seed plus k
+         */
+        quint64 first_seed = base->randomSeed() + quint64(_runs);
+
+        parallelFor(n, [&](int i) {
+            batch[i] = runOne(first_seed + quint64(i));
+        });
+
+        /*
+         * Runs in a cancelled batch may not have finished
+         */
+        if (cancel != nullptr && *cancel)
+        {
+            break;
+        }
+
+        for (int i = 0; i < n; i++)
+        {
+            add(batch[i]);
+        }
+
+        if (tolerance > 0 && converged(previous))
+        {
+            LOG_DEBUG(LogCategory::runs) << "Ensemble converged after" << _runs << "runs";
+            break;
+        }
+    }
+
+    return _runs;
+}
+
+QVector<double> Ensemble::runOne(quint64 seed) const
+{
+    Domain *dom = Domain::cloneDomain(base, QMap<ParamType,int>());
+    dom->setRandomSeed(seed);
+    dom->setRecordedProperties(properties);
+
+    dom->reserveRecord(periods());
+
+    for (int period = 0; period <= iterations + start_period; period++)
+    {
+        if (cancel != nullptr && *cancel)
+        {
+            break;
+        }
+
+        dom->iterate(period, period < start_period);
+
+        if (progress != nullptr)
+        {
+            ++*progress;
+        }
+    }
+
+    /*
+     * The record is already laid out by property, so the values are just
+     * its columns one after the other
+     */
+    QVector<double> values;
+    values.reserve(properties.count() * periods());
+    foreach (Property p, properties)
+    {
+        values += dom->recorded().column(p);
+    }
+
+    delete dom;
+
+    return values;
+}
+
+void Ensemble::add(const QVector<double> &values)
+{
+    _runs++;
+
+    for (int i = 0; i < cells.count(); i++)
+    {
+        Cell &c = cells[i];
+        double v = values[i];
+        c.mean += (v - c.mean) / _runs;
+        c.lower.add(v);
+        c.upper.add(v);
+    }
+}
+
+bool Ensemble::converged(QVector<double> &previous) const
+{
+    QVector<double> current;
+    current.reserve(cells.count() * 3);
+    for (int i = 0; i < cells.count(); i++)
+    {
+        current.append(cells[i].mean);
+        current.append(cells[i].lower.value());
+        current.append(cells[i].upper.value());
+    }
+
+    bool result = previous.count() == current.count();
+
+    for (int k = 0; result && k < properties.count(); k++)
+    {
+        double scale = 0;
+        for (int t = 0; t < periods(); t++)
+        {
+            scale = std::max(scale, fabs(cell(k, t).mean));
+        }
+
+        for (int i = k * periods() * 3; result && i < (k + 1) * periods() * 3; i++)
+        {
+            result = fabs(current[i] - previous[i]) <= tolerance * scale;
+        }
+    }
+
+    previous = current;
+    return result;
+}
@@ -0,0 +1,168 @@
+#ifndef ENSEMBLE_H
+#define ENSEMBLE_H
+
+#include "account.h"
+
+#include <QList>
+#include <QVector>
+
+#include <atomic>
+
+/******************************************************************************
+ * StreamingQuantile estimates a quantile of a stream of values without
+ * keeping them, using the P-square algorithm (Jain and Chlamtac, 1985). It
+ * holds five markers whatever the number of values. The first five values are
+ * kept and the quantile is exact (by interpolation) until there are more.
+ * After that it is an estimate, which improves as values are added.
+ ******************************************************************************/
+
+class StreamingQuantile
+{
+public:
+
+    StreamingQuantile(double p = 0.5);
+
+    void add(double x);
+    double value() const;
+
+private:
+
+    double p;
+    int count = 0;
+
+    double q[5] = {};   // marker heights
+    double n[5] = {};   // marker positions
+    double np[5] = {};  // desired marker positions
+    double dn[5] = {};  // increments in desired positions
+
+    double parabolic(int i, int d) const;
+    double linear(int i, int d) const;
+};
+
+/******************************************************************************
+ * Ensemble runs the same domain many times with different random seeds and
+ * calculates, for each selected property and each recorded period, the mean
+ * and a band between two percentiles (by default the 5th and 95th) across the
+ * runs.
+ *
+ * The statistics are updated as each run finishes, in a single pass, so only
+ * the runs in progress keep their values. Runs are made in batches of a fixed
+ * size, in parallel, and are added to the statistics in seed order at the end
+ * of each batch, so the results don't depend on the number of threads.
+ *
+ * If a tolerance is set, the ensemble stops early once a batch changes no
+ * mean or band value by more than that fraction of the largest absolute mean
+ * of the property concerned.
+ ******************************************************************************/
+
+class Ensemble
+{
+public:
+
+    Ensemble(const Domain *base);
+
+    /*
+     * The properties to record, in Property order. Each run only evaluates
+     * these (see Domain::setRecordedProperties).
+     */
+    void setProperties(const QList<Property> &properties);
+
+    void setPeriods(int iterations, int start_period);
+
+    /*
+     * Run at most max_runs times, batch_size runs at a time
+     */
+    void setRuns(int max_runs, int batch_size = 8);
+
+    /*
+     * Stop when a batch changes the results by less than this fraction (see
+     * above). Zero (the default) means always make max_runs runs.
+     */
+    void setTolerance(double tolerance);
+
+    /*
+     * The percentiles bounding the band, as fractions (e.g. 0.05 and 0.95)
+     */
+    void setBand(double lower, double upper);
+
+    /*
+     * Optional: stop as soon as *cancel becomes true (any batch in progress
+     * is then discarded), and add one to *progress for each period run
+     */
+    void setCancelFlag(const std::atomic<bool> *cancel);
+    void setProgressCounter(std::atomic<int> *progress);
+
+    /*
+     * Make the runs and return the number made (and added to the statistics)
+     */
+    int run();
+
+    int runs() const;
+
+    /*
+     * The number of recorded periods and the first of them
+     */
+    int periods() const;
+    int firstPeriod() const;
+
+    /*
+     * Results for the k'th property (in the order given to setProperties)
+     * and the t'th recorded period
+     */
+    double mean(int k, int t) const;
+    double lower(int k, int t) const;
+    double upper(int k, int t) const;
+
+private:
+
+    struct Cell
+    {
+        double mean = 0;
+        StreamingQuantile lower;
+        StreamingQuantile upper;
+    };
+
+    const Domain *base;
+
+    QList<Property> properties;
+
+    int iterations = 100;
+    int start_period = 0;
+    int max_runs = 32;
+    int batch_size = 8;
+    double tolerance = 0;
+    double lower_p = 0.05;
+    double upper_p = 0.95;
+
+    const std::atomic<bool> *cancel = nullptr;
+    std::atomic<int> *progress = nullptr;
+
+    int _runs = 0;
+
+    /*
+     * One cell per property per recorded period, property-major
+     */
+    QVector<Cell> cells;
+
+    Cell &cell(int k, int t);
+    const Cell &cell(int k, int t) const;
+
+    /*
+     * Run the domain with the given seed, returning the values of the
+     * properties in the same layout as cells
+     */
+    QVector<double> runOne(quint64 seed) const;
+
+    /*
+     * Add the values from one run to the statistics
+     */
+    void add(const QVector<double> &values);
+
+    /*
+     * Check whether the statistics have changed by less than the tolerance
+     * since the values in previous were taken, and update previous
+     */
+    bool converged(QVector<double> &previous) const;
+};
+
+#endif // ENSEMBLE_H
@@ -0,0 +1,265 @@
+#include "exporter.h"
+
+#include <QLocale>
+#include <QSaveFile>
+
+#include <charconv>
+#include <string.h>
+
+/*
+ * Size of DelimitedWriter's buffer. This is large enough that the cost of
+ * each write to the device is negligible, and small enough not to matter.
+ */
+#define EXPORT_BUFFER_BYTES (1 << 20)
+
+/*
+ * Room to leave for a single number (the longest double is 24 characters)
+ */
+#define EXPORT_NUMBER_BYTES 32
+
+/*
+ * Number of rows written between checks for cancellation (or a failed write)
+ */
+#define EXPORT_CHECK_ROWS 1024
+
+DelimitedWriter::DelimitedWriter(QIODevice *device, char sep)
+{
+    this->device = device;
+    this->sep = sep;
+    buffer = new char[EXPORT_BUFFER_BYTES];
+}
+
+DelimitedWriter::~DelimitedWriter()
+{
+    flush();
+    delete[] buffer;
+}
+
+bool DelimitedWriter::ok() const
+{
+    return !failed;
+}
+
+bool DelimitedWriter::flush()
+{
+    if (used > 0 && !failed)
+    {
+        failed = device->write(buffer, used) != used;
+    }
+    used = 0;
+    return !failed;
+}
+
+char *DelimitedWriter::reserve(int bytes)
+{
+    Q_ASSERT(bytes <= EXPORT_BUFFER_BYTES);
+
+    if (used + bytes > EXPORT_BUFFER_BYTES)
+    {
+        flush();
+    }
+    return buffer + used;
+}
+
+void DelimitedWriter::separate()
+{
+    if (row_started)
+    {
+        *reserve(1) = sep;
+        used++;
+    }
+    row_started = true;
+}
+
+QByteArray DelimitedWriter::encode(const QString &text) const
+{
+    QByteArray bytes = text.toUtf8();
+
+    if (sep == '\t')
+    {
+        bytes.replace('\t', ' ').replace('\n', ' ').replace('\r', ' ');
+    }
+    else if (bytes.contains(sep) || bytes.contains('"')
+             || bytes.contains('\n') || bytes.contains('\r'))
+    {
+        bytes.replace("\"", "\"\"");
+        bytes.prepend('"');
+        bytes.append('"');
+    }
+    return bytes;
+}
+
+void DelimitedWriter::field(const QString &text)
+{
+    encodedField(encode(text));
+}
+
+void DelimitedWriter::encodedField(const QByteArray &bytes)
+{
+    separate();
+
+    /*
+     * Copy the text a buffer-full at a time, as it may be longer than the
+     * buffer
+     */
+    const char *p = bytes.constData();
+    int remaining = bytes.size();
+    while (remaining > 0)
+    {
+        if (used == EXPORT_BUFFER_BYTES)
+        {
+            flush();
+        }
+        int n = qMin(remaining, EXPORT_BUFFER_BYTES - used);
+        memcpy(buffer + used, p, size_t(n));
+        used += n;
+        p += n;
+        remaining -= n;
+    }
+}
+
+void DelimitedWriter::field(int value)
+{
+    separate();
+
+    char *p = reserve(EXPORT_NUMBER_BYTES);
+    used += int(std::to_chars(p, p + EXPORT_NUMBER_BYTES, value).ptr - p);
+}
+
+void DelimitedWriter::field(double value)
+{
+    separate();
+
+    char *p = reserve(EXPORT_NUMBER_BYTES);
+
+#ifdef __cpp_lib_to_chars
+    used += int(std::to_chars(p, p + EXPORT_NUMBER_BYTES, value).ptr - p);
+#else
+    /*
+     * Some standard libraries don't yet have std::to_chars for floating point
+     * values, so fall back to Qt's (locale-independent) formatting
+     */
+    QByteArray text = QLocale::c().toString(value, 'g',
+                                            QLocale::FloatingPointShortest).toLatin1();
+    memcpy(p, text.constData(), size_t(text.size()));
+    used += text.size();
+#endif
+}
+
+void DelimitedWriter::endRow()
+{
+    *reserve(1) = '\n';
+    used++;
+    row_started = false;
+}
+
+Exporter::Exporter(Format format)
+{
+    sep = format == Format::csv ? ',' : '\t';
+}
+
+void Exporter::setProperties(const QMap<Property,QString> &properties)
+{
+    this->properties = properties;
+}
+
+void Exporter::setDerivedNames(const QStringList &names)
+{
+    derived_names = names;
+}
+
+void Exporter::addRecord(const QString &name, const PropertyRecord &record,
+                         const QVector<QVector<double>> &derived)
+{
+    Q_ASSERT(derived.count() == derived_names.count());
+    entries.append({name, record, derived});
+}
+
+void Exporter::setCancelFlag(const std::atomic<bool> *cancel)
+{
+    this->cancel = cancel;
+}
+
+bool Exporter::write(const QString &fileName, QString &error)
+{
+    QSaveFile file(fileName);
+    if (!file.open(QIODevice::WriteOnly))
+    {
+        error = "Cannot open " + fileName + " for writing";
+        return false;
+    }
+
+    if (!write(&file))
+    {
+        file.cancelWriting();
+        error = (cancel != nullptr && *cancel)
+                ? "Export of " + fileName + " cancelled"
+                : "Error writing " + fileName;
+        return false;
+    }
+
+    if (!file.commit())
+    {
+        error = "Error writing " + fileName;
+        return false;
+    }
+    return true;
+}
+
+bool Exporter::write(QIODevice *device)
+{
+    DelimitedWriter out(device, sep);
+
+    out.field(QString("Domain"));
+    out.field(QString("Period"));
+    foreach (const QString &name, properties.values())
+    {
+        out.field(name);
+    }
+    foreach (const QString &name, derived_names)
+    {
+        out.field(name);
+    }
+    out.endRow();
+
+    /*
+     * Look up the columns once for each domain rather than for each value
+     */
+    const QList<Property> selected = properties.keys();
+    QVector<const double *> columns(selected.count() + derived_names.count());
+
+    int rows = 0;
+
+    foreach (const Entry &entry, entries)
+    {
+        const QByteArray name = out.encode(entry.name);
+        for (int k = 0; k < selected.count(); k++)
+        {
+            columns[k] = entry.record.column(selected[k]).constData();
+        }
+        for (int k = 0; k < derived_names.count(); k++)
+        {
+            columns[selected.count() + k] = entry.derived[k].constData();
+        }
+
+        const int periods = entry.record.count();
+        for (int t = 0; t < periods; t++)
+        {
+            out.encodedField(name);
+            out.field(entry.record.first_period + t);
+            for (int k = 0; k < columns.count(); k++)
+            {
+                out.field(columns[k][t]);
+            }
+            out.endRow();
+
+            if (++rows % EXPORT_CHECK_ROWS == 0
+                    && ((cancel != nullptr && *cancel) || !out.ok()))
+            {
+                return false;
+            }
+        }
+    }
+
+    return out.flush();
+}
@@ -0,0 +1,159 @@
+#ifndef EXPORTER_H
+#define EXPORTER_H
+
+#include "account.h"
+
+#include <QByteArray>
+#include <QIODevice>
+#include <QList>
+#include <QMap>
+#include <QString>
+#include <QStringList>
+#include <QVector>
+
+#include <atomic>
+
+/******************************************************************************
+ * DelimitedWriter writes rows of comma- or tab-separated values to a device.
+ *
+ * Fields are formatted straight into a fixed-size buffer, which is written to
+ * the device in one go whenever it fills up, so the memory used doesn't
+ * depend on how much is written. Numbers are formatted without going through
+ * QString or the C library's locale-dependent functions: doubles are written
+ * in the shortest form that reads back as the same value.
+ *
+ * Text fields are quoted (for CSV) only when they contain the separator, a
+ * quote or a line break. Tab-separated fields can't be quoted, so any tabs
+ * and line breaks in them are replaced by spaces.
+ ******************************************************************************/
+
+class DelimitedWriter
+{
+public:
+
+    DelimitedWriter(QIODevice *device, char sep = '\t');
+    ~DelimitedWriter();
+
+    void field(const QString &text);
+
+    /*
+     * Encode a text field (quoting it if necessary) once, so that it can be
+     * written many times with encodedField()
+     */
+    QByteArray encode(const QString &text) const;
+    void encodedField(const QByteArray &bytes);
+
+    void field(int value);
+    void field(double value);
+
+    /*
+     * End the current row
+     */
+    void endRow();
+
+    /*
+     * Write whatever is in the buffer to the device. Returns false if any
+     * write has failed.
+     */
+    bool flush();
+
+    bool ok() const;
+
+private:
+
+    QIODevice *device;
+    char sep;
+    bool failed = false;
+    bool row_started = false;
+
+    char *buffer;
+    int used = 0;
+
+    /*
+     * Make room for at least the given number of bytes and return a pointer
+     * to it
+     */
+    char *reserve(int bytes);
+
+    void separate();
+};
+
+/******************************************************************************
+ * Exporter writes the recorded values (see Domain::recorded) of a number of
+ * domains as a table with one row for each domain and period, and one column
+ * for each selected property. The rows for each domain are in period order,
+ * and the domains are in the order they were added.
+ *
+ * The values are read directly from the records, which are implicitly shared
+ * copies taken when the domains are added, so a domain may go on running (or
+ * be reset) while the export is being written. Apart from those the memory
+ * used is just DelimitedWriter's buffer, however long the runs.
+ *
+ * write() can be called on any thread, and can be cancelled (see
+ * setCancelFlag).
+ ******************************************************************************/
+
+class Exporter
+{
+public:
+
+    enum class Format
+    {
+        csv,
+        tsv
+    };
+
+    Exporter(Format format = Format::csv);
+
+    /*
+     * The properties to write, in the order of the columns, and the names to
+     * use for them in the header
+     */
+    void setProperties(const QMap<Property,QString> &properties);
+
+    /*
+     * The names of the derived properties (see DerivedProperties) to write
+     * after those, if any
+     */
+    void setDerivedNames(const QStringList &names);
+
+    /*
+     * Add a domain's record under the given name, with a column of values
+     * for each of the derived properties, calculated from the record
+     */
+    void addRecord(const QString &name, const PropertyRecord &record,
+                   const QVector<QVector<double>> &derived = QVector<QVector<double>>());
+
+    void setCancelFlag(const std::atomic<bool> *cancel);
+
+    /*
+     * Write the table to the given file, replacing it only if the whole table
+     * has been written. On failure or cancellation, returns false and sets
+     * error.
+     */
+    bool write(const QString &fileName, QString &error);
+
+    /*
+     * Write the table to an open device. Returns false if it couldn't be
+     * written or was cancelled.
+     */
+    bool write(QIODevice *device);
+
+private:
+
+    struct Entry
+    {
+        QString name;
+        PropertyRecord record;
+        QVector<QVector<double>> derived;
+    };
+
+    char sep;
+    QMap<Property,QString> properties;
+    QStringList derived_names;
+    QList<Entry> entries;
+
+    const std::atomic<bool> *cancel = nullptr;
+};
+
+#endif // EXPORTER_H
@@ -27,6 +27,7 @@
 // ***
 
 #include "account.h"
+#include "log.h"
 #include <cassert>
 #include <QtMath>
 #include <QDebug>
@@ -34,6 +35,7 @@
 Firm::Firm(Domain *domain, bool state_supported) : Account(domain)
 {
     _state_supported = state_supported;
+    _employer_ix = domain->registerEmployer(this);
 }
 
 void Firm::init()
@@ -86,22 +88,27 @@ void Firm::trigger(int period)
                 //qDebug() << "Firm::trigger(): paying loan interest of" << interest;
                 if (!transferSafely(_bank, interest, this))
                 {
-                    qDebug() << "Firm::trigger(): failed to transfer interest to bank";
+                    LOG_DEBUG(LogCategory::transactions) << "Firm::trigger(): failed to transfer interest to bank";
                 }
             }
             else if (interest < 1.0 && owed_to_bank > 0)
             {
-                qDebug() << "Firm::trigger(): adding interest of"
+                LOG_DEBUG(LogCategory::transactions) << "Firm::trigger(): adding interest of"
                          << interest
                          << "to loan";
-                owed_to_bank += interest;
+                adjustOwed(interest);
             }
         }
 
         if (employees.count() > 0)
         {
-            wages_paid += payWages();
-            balance -= wages_paid;
+            double paid = payWages();
+            wages_paid += paid;
+            adjustBalance(-wages_paid);
+            if (_sector != nullptr)
+            {
+                _sector->wages += paid;
+            }
         }
     }
 }
@@ -111,14 +118,17 @@ double Firm::payWages()
     double amt_paid = 0;
     num_just_fired = 0;
 
-    int dedns_rate = _domain->getPreTaxDedns();
+    double dedns_rate = _domain->parameter(ParamType::dedns);
+
+    RandomStream rs = _domain->randomStream(RandomStream::Purpose::loan_approval,
+                                            quint64(_employer_ix));
     int num_employees = static_cast<int> (employees.count());
 
     for (int i = 0; i < num_employees; i++)
     {
         Worker *w = employees[i];
 
-        double wage_due = w->agreed_wage;
+        double wage_due = w->agreedWage();
         double dedns = (dedns_rate * wage_due) / 100;
         double funds_available = getBalance();
 
@@ -149,7 +159,7 @@ double Firm::payWages()
                 _domain->government()->debit(this, shortfall);
 
                 // Transfer the funds to the firm
-                qDebug() << "crediting" << shortfall;
+                LOG_DEBUG(LogCategory::transactions) << "crediting" << shortfall;
                 credit(shortfall, this);
 
                 ok_to_pay = true;
@@ -161,10 +171,10 @@ double Firm::payWages()
                  * policy. Policy is determined by getLoanProb(), which
                  * returns an integer from 0 (= never) to 4 (= always).
                  */
-                if (qrand() % 4 < _domain->getLoanProb())
+                if (int(rs.bounded(4)) < _domain->parameter(ParamType::loan_prob))
                 {
                     // Apply a bank loan to cover the shortfall
-                    _bank->lend(shortfall, _domain->getBusRate(), this);
+                    _bank->lend(shortfall, _domain->parameter(ParamType::bus_int), this);
                     ok_to_pay = true;
                 }
             }
@@ -214,7 +224,7 @@ double Firm::payWages()
 void Firm::fire(Worker *w)
 {
     employees.removeOne(w);
-    w->employer = nullptr;
+    _domain->fire(w);
     num_fired++;
 }
 
@@ -225,7 +235,7 @@ void Firm::fire(int ix)
 {
     Worker *w = employees.at(ix);
     employees.removeAt(ix);
-    w->employer = nullptr;
+    _domain->fire(w);
     num_fired++;
 }
 
@@ -258,6 +268,10 @@ void Firm::epilogue()
     }
     */
 
+    if (_sector != nullptr)
+    {
+        _sector->investment -= investment;
+    }
     investment = 0;
 
     if (balance > wages_paid)
@@ -287,7 +301,7 @@ void Firm::epilogue()
             investible += (bonus_funds - bonuses_paid);
         }
 
-        balance -= bonuses_paid;
+        adjustBalance(-bonuses_paid);
 
         if (!(isGovernment() || balance >= 0))
         {
@@ -344,21 +358,28 @@ void Firm::epilogue()
                     // inflation.
                     // ***
 
-                    Firm *supplier = _domain->selectRandomFirm(this);
+                    RandomStream rs = _domain->randomStream(
+                                RandomStream::Purpose::supplier,
+                                quint64(_employer_ix));
+                    Firm *supplier = _domain->selectRandomFirm(rs, this);
 
                     // ***
                     // We must allow for the possibility that there are no firms
                     // from which to select a supplier. This will be the case if
                     // parameters were set up with fewer than two startups, and
-                    // selectRandomFirm(this) will then have returned nullptr.
+                    // selectRandomFirm(rs, this) will then have returned nullptr.
                     // ***
 
                     if (supplier != nullptr)
                     {
                         //qDebug() << "crediting" << excess << "to supplier";
                         supplier->credit(excess, this);
-                        balance -= excess;
+                        adjustBalance(-excess);
                         investment = excess;
+                        if (_sector != nullptr)
+                        {
+                            _sector->investment += excess;
+                        }
 
                         /*
                          * Update productivity
@@ -393,23 +414,19 @@ void Firm::epilogue()
 }
 
 /*
- * We no longer keep a separate list of unemployed workers.
+ * Hire the next worker from the domain's unemployed pool
  */
 Worker *Firm::hire(double wage)
 {
-    foreach (Worker *w, _domain->workers)
+    Worker *w = _domain->nextUnemployed();
+    if (w != nullptr)
     {
-        if (w->employer == nullptr) // unemployed
-        {
-            employees.append(w);
-            w->setAgreedWage(wage); // TODO: should check wage acceptable
-            w->setEmployer(this);
-            num_hired += 1;
-            return w;
-        }
+        w->setAgreedWage(wage); // TODO: should check wage acceptable
+        _domain->hire(w, this);
+        num_hired += 1;
     }
 
-    return nullptr;
+    return w;
 }
 
 /*
@@ -428,7 +445,7 @@ double Firm::hireSome(double wage, int number_to_hire)
         }
         else
         {
-            wages_due += w->agreed_wage;
+            wages_due += w->agreedWage();
         }
     }
     // qDebug() << employees.count() << "employees hired";
@@ -436,10 +453,77 @@ double Firm::hireSome(double wage, int number_to_hire)
 }
 
 
+double Firm::getBalance()
+{
+    return balance;
+}
+
+double Firm::getAmountOwed()
+{
+    return owed_to_bank;
+}
+
+// Use transferSafely() in preference to credit() as credit() doesn't upate our
+// balance. recipient will be nullptr if trying to transfer to a non-existent
+// startup.
+bool Firm::transferSafely(Account *recipient, double amount, Account *creditor)
+{
+    if (amount > balance || recipient == nullptr)
+    {
+        // TODO: This needs to go into a log somewhere
+        LOG_DEBUG(LogCategory::transactions) << "Firm::transferSafely(): done (insufficient funds or no recipient)";
+        // Q_ASSERT(false);
+        return false;
+    }
+    else
+    {
+        // qDebug() << "crediting" << amount;
+        recipient->credit(amount, creditor);
+        adjustBalance(-amount);
+        return true;
+    }
+}
+
+void Firm::adjustBalance(double amount)
+{
+    balance += amount;
+    if (_sector != nullptr)
+    {
+        _sector->balance += amount;
+    }
+}
+
+void Firm::adjustOwed(double amount)
+{
+    owed_to_bank += amount;
+    if (_sector != nullptr)
+    {
+        _sector->owed += amount;
+    }
+}
+
+void Firm::loan(double amount, double rate, Account *creditor)
+{
+    adjustBalance(amount);
+    if (creditor->isBank())
+    {
+        // TODO: Note that if interest rate changes on subsequent loans, the
+        // new rate will replace the old rate for the whole amount. This is not
+        // very realistic and should be changed eventually.
+        adjustOwed(amount);
+        interest_rate = double(rate);
+    }
+    else
+    {
+        qCritical() << "Only bank loans allowed at present";
+    }
+}
+
 void Firm::credit(double amount, Account *creditor, bool force)
 {
     //qDebug() << "Firm::credit (" << amount << ", ...)";
-    Account::credit(amount);
+    adjustBalance(amount);
+    _domain->_profiler.count(ProfileCounter::transactions);
 
     // If state-supported the reason we are being credited must be that we have
     // asked for additional support to pay wages, in which case we have now
@@ -449,19 +533,45 @@ void Firm::credit(double amount, Account *creditor, bool force)
 
     if (!creditor->isGovernment() || force)
     {
-        sales_receipts += amount;
-
-        // Base class credits account but doesn't pay tax. We assume seller,
-        // not buyer, is responsible for paying sales tax and that payments
-        // to a Firm are always for purchases and therefore subject to
-        // sales tax.
-        int r = _domain->getSalesTaxRate();
-        if (r > 0)
-        {
-            double t = (amount * r) / 100;
-            qDebug() << "Firm::credit() paying sales tax" << t << "on" << amount;
-            if (transferSafely(_domain->government(), t, this)) {
-                sales_tax_paid += t;
+        recordSale(amount);
+    }
+}
+
+/*
+ * Credit the firm with the takings from any number of sales at once. Used by
+ * Domain::purchasePhase, which totals the purchases made from each firm.
+ */
+void Firm::creditSales(double amount)
+{
+    adjustBalance(amount);
+    recordSale(amount);
+}
+
+/*
+ * The firm has already been credited with the amount of the sale
+ */
+void Firm::recordSale(double amount)
+{
+    sales_receipts += amount;
+    if (_sector != nullptr)
+    {
+        _sector->sales_receipts += amount;
+    }
+
+    // Base class credits account but doesn't pay tax. We assume seller,
+    // not buyer, is responsible for paying sales tax and that payments
+    // to a Firm are always for purchases and therefore subject to
+    // sales tax.
+    double r = _domain->parameter(ParamType::sales_tax_rate);
+    if (r > 0)
+    {
+        double t = (amount * r) / 100;
+        LOG_DEBUG(LogCategory::transactions) << "Firm::credit() paying sales tax" << t << "on" << amount;
+        if (transferSafely(_domain->government(), t, this)) {
+            sales_tax_paid += t;
+            if (_sector != nullptr)
+            {
+                _sector->sales_tax += t;
             }
         }
     }
@@ -469,8 +579,8 @@ void Firm::credit(double amount, Account *creditor, bool force)
 
 size_t Firm::getNumEmployees()
 {
-    return 0;  // FIX: IMPORTANT
-};
+    return static_cast<size_t> (employees.count());
+}
 
 double Firm::getProductivity()
 {
@@ -502,13 +612,6 @@ double Firm::getSalesReceipts()
     return sales_receipts;
 }
 
-/*
-size_t Firm::getNumEmployees()
-{
-    return static_cast<size_t> (employees.count());
-}
-*/
-
 int Firm::getNumHired()
 {
     return num_hired;
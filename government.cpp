@@ -1,10 +1,11 @@
 
 #include "account.h"
+#include "log.h"
 #include <QDebug>
 
 void Government::reset()
 {
-    qDebug() << "Government::reset() called";
+    LOG_DEBUG(LogCategory::engine) << "Government::reset() called";
 
     _isGovernment = true;
 
@@ -34,14 +35,14 @@ Government::Government(Domain *domain, int size) : Bank(domain)
      * for demo purposes later on.
      */
 
-    qDebug() << "Government::Government (...) called for domain"
+    LOG_DEBUG(LogCategory::engine) << "Government::Government (...) called for domain"
              << domain->getName() << "size =" << size;
 
     reset();
 
     if (hireSome(domain->getStdWage(), size) < size)
     {
-        qDebug() << "Government cannot hire " << size << "workers";
+        LOG_WARNING(LogCategory::engine) << "Government cannot hire " << size << "workers";
         Q_ASSERT(false);
     }
 }
@@ -86,7 +87,7 @@ double Government::debit(Account *requester, double amount)
 
 void Government::trigger(int period)
 {
-    qDebug() << "Government::trigger (" << period << "), last_triggered ="
+    LOG_DEBUG(LogCategory::engine) << "Government::trigger (" << period << "), last_triggered ="
              << last_triggered;
 
     Q_ASSERT(period > last_triggered);
@@ -110,7 +111,9 @@ void Government::trigger(int period)
     /*
      * transferSafely() updates both balances (payer and payee)
      */
-    transferSafely(_domain->selectRandomFirm(), amt, this);
+    RandomStream rs = _domain->randomStream(RandomStream::Purpose::procurement,
+                                            quint64(_employer_ix));
+    transferSafely(_domain->selectRandomFirm(rs), amt, this);
 
     proc += amt;    // procurement
     exp += amt;     // govt expenditure
@@ -136,7 +139,7 @@ bool Government::transferSafely(Account *recipient, double amount, Account *)
      * sales tax like any other purchases
      */
     if (recipient != nullptr) {
-        qDebug() << "Government making payment of" << amount;
+        LOG_DEBUG(LogCategory::transactions) << "Government making payment of" << amount;
         recipient->credit(amount, this, true);
         balance -= amount;
     }
@@ -155,8 +158,9 @@ bool Government::transferSafely(Account *recipient, double amount, Account *)
 void Government::credit(double amount, Account*, bool)
 {
     //qDebug() << "Government receiving tax payment of" << amount;
-    Account::credit(amount);
+    adjustBalance(amount);
     rec += amount;
+    _domain->_profiler.count(ProfileCounter::transactions);
 }
 
 /*
@@ -165,15 +169,11 @@ void Government::credit(double amount, Account*, bool)
 double Government::payBenefits(double amount)
 {
     double amt_paid = 0;
-    for (int i = 0; i < _domain->workers.count(); i++)
+    const int *pool = _domain->unemployed.constData();
+    for (int i = 0, c = _domain->unemployed.count(); i < c; i++)
     {
-        Worker *w = _domain->workers[i];
-        if (!w->isEmployed())
-        {
-            w->credit(amount);
-            amt_paid += amount;
-        }
+        _domain->workers[pool[i]].credit(amount);
+        amt_paid += amount;
     }
     return amt_paid;
 }
-
@@ -0,0 +1,355 @@
+#include "inequality.h"
+#include "log.h"
+#include "parallel.h"
+
+#include <QDebug>
+
+#include <algorithm>
+#include <math.h>
+#include <vector>
+
+/*
+ * Number of bins used in approximate mode. The error bound (see inequality.h)
+ * is roughly inversely proportional to this.
+ */
+static const int NUMBER_OF_BINS = 4096;
+
+/*
+ * Below this number of values a single-threaded sort is faster than starting
+ * threads
+ */
+static const int PARALLEL_SORT_THRESHOLD = 1 << 16;
+
+static const int MAX_SORT_THREADS = 8;
+
+Inequality::Inequality()
+{
+}
+
+Inequality::Mode Inequality::modeFromName(const QString &name)
+{
+    return name == "approximate" ? Mode::approximate : Mode::exact;
+}
+
+QString Inequality::modeName(Mode mode)
+{
+    return mode == Mode::approximate ? "approximate" : "exact";
+}
+
+void Inequality::setMode(Mode mode)
+{
+    _mode = mode;
+}
+
+Inequality::Mode Inequality::mode() const
+{
+    return _mode;
+}
+
+double *Inequality::values(int n)
+{
+    if (buffer.size() < n)
+    {
+        buffer.resize(n);
+    }
+    return buffer.data();
+}
+
+double Inequality::gini() const
+{
+    return _gini;
+}
+
+double Inequality::mean() const
+{
+    return _mean;
+}
+
+double Inequality::spread() const
+{
+    return _spread;
+}
+
+double Inequality::error() const
+{
+    return _error;
+}
+
+void Inequality::calculate(int n, bool mean_only)
+{
+    _error = 0;
+
+    if (n == 0)
+    {
+        _mean = 0;
+        _gini = 0;
+        _spread = 0;
+    }
+    else if (mean_only)
+    {
+        const double *v = buffer.constData();
+        double total = 0;
+        for (int i = 0; i < n; i++)
+        {
+            total += v[i];
+        }
+
+        _mean = double(total / n);
+        _gini = 0;
+        _spread = 0;
+    }
+    else if (_mode == Mode::exact)
+    {
+        calculateExact(n);
+    }
+    else
+    {
+        calculateApproximate(n);
+    }
+
+    Q_ASSERT(_mean >= 0.0);
+}
+
+/*
+ * This is the calculation that used to be done in Domain::iterate, and gives
+ * exactly the same results. Note that the RMS deviation leaves out the
+ * largest value.
+ */
+void Inequality::calculateExact(int n)
+{
+    double *v = buffer.data();
+
+    double total = 0;
+    double rms = 0;
+    double a = 0;
+
+    int i;
+
+    for (i = 0; i < n; i++)
+    {
+        Q_ASSERT(v[i] >= 0);
+        total += v[i];
+    }
+
+    _mean = double(total / n);
+
+    sort(n);                                    // ascending order
+
+    for (i = 1; i < n; i++)
+    {
+        double d = (v[i - 1] - _mean);
+        rms +=  d * d;
+    }
+    rms = sqrt(rms / n);
+
+    for (i = 1; i < n; i++)
+    {
+        v[i] += v[i - 1];                       // make values cumulative
+    }
+
+    _spread = _mean > 0 ? ((rms * 3) / _mean) : 0;
+
+    double a_tot = (total * n) / 2;             // area A+B
+
+    for (i = 1; i < n; i++)
+    {
+        double diff = ((total * i) / n) - v[i - 1];
+        Q_ASSERT(diff >= 0);
+        a += diff;                              // area A
+    }
+
+    _gini = (round(double(a * 100) / double(a_tot)))/100;
+
+    if (_gini > 100 || _gini < 0)
+    {
+        Q_ASSERT(_gini >= 0 && _gini <= 1);
+    }
+
+    LOG_DEBUG(LogCategory::inequality) << "a =" << a << ", a_tot =" << a_tot << "gini =" << _gini
+             << "RMS =" << rms << "range ±" << (_spread * 100)
+             << "% of mean, mean =" << _mean;
+}
+
+/*
+ * Area A in the exact calculation is
+ *
+ *     sum for i = 1 to n-1 of (total * i / n - c[i-1])
+ *
+ * where c is the cumulative sum of the sorted values v. This reduces to
+ *
+ *     total * (n - 1) / 2 + total - sum for j = 0 to n-1 of (n - j) * v[j]
+ *
+ * The values in any one bin occupy consecutive positions in sorted order, so
+ * if bin b starts at position s_b, holds m_b values and has sum S_b, its
+ * contribution to the last sum can be approximated by
+ *
+ *     S_b * (n - s_b - (m_b - 1) / 2)
+ *
+ * which is exact if all the values in the bin are equal. Otherwise the error
+ * is at most m_b^2 * (hi_b - lo_b) / 4, since the weights (n - j) differ from
+ * their average by at most m_b / 2 and the values differ from theirs by at
+ * most (hi_b - lo_b). Dividing by area A+B (= total * n / 2) gives the bound
+ * on the Gini coefficient stated in inequality.h.
+ *
+ * The sum of squared deviations needed for the spread can be found exactly
+ * without sorting, and the largest value (left out of the RMS, as in the exact
+ * calculation) is simply the maximum.
+ */
+void Inequality::calculateApproximate(int n)
+{
+    const double *v = buffer.constData();
+
+    double total = 0;
+    double sum_sq = 0;
+    double lo = v[0];
+    double hi = v[0];
+
+    for (int i = 0; i < n; i++)
+    {
+        double x = v[i];
+        Q_ASSERT(x >= 0);
+        total += x;
+        sum_sq += x * x;
+        if (x < lo)
+        {
+            lo = x;
+        }
+        if (x > hi)
+        {
+            hi = x;
+        }
+    }
+
+    _mean = double(total / n);
+
+    /*
+     * Spread
+     */
+    double dev_sq = sum_sq - 2 * _mean * total + n * _mean * _mean;
+    dev_sq -= (hi - _mean) * (hi - _mean);
+    double rms = sqrt(std::max(dev_sq, 0.0) / n);
+
+    _spread = _mean > 0 ? ((rms * 3) / _mean) : 0;
+
+    /*
+     * Gini
+     */
+    bin_count.fill(0, NUMBER_OF_BINS);
+    bin_sum.fill(0.0, NUMBER_OF_BINS);
+    bin_min.fill(hi, NUMBER_OF_BINS);
+    bin_max.fill(lo, NUMBER_OF_BINS);
+
+    int *count = bin_count.data();
+    double *sum = bin_sum.data();
+    double *min = bin_min.data();
+    double *max = bin_max.data();
+
+    double scale = hi > lo ? NUMBER_OF_BINS / (hi - lo) : 0;
+
+    for (int i = 0; i < n; i++)
+    {
+        double x = v[i];
+        int b = std::min(int((x - lo) * scale), NUMBER_OF_BINS - 1);
+        count[b]++;
+        sum[b] += x;
+        if (x < min[b])
+        {
+            min[b] = x;
+        }
+        if (x > max[b])
+        {
+            max[b] = x;
+        }
+    }
+
+    double weighted = 0;
+    double err = 0;
+    int start = 0;
+
+    for (int b = 0; b < NUMBER_OF_BINS; b++)
+    {
+        int m = count[b];
+        if (m > 0)
+        {
+            weighted += sum[b] * (n - start - double(m - 1) / 2);
+            err += double(m) * m * (max[b] - min[b]);
+            start += m;
+        }
+    }
+
+    double a = (total * (n - 1)) / 2 + total - weighted;
+    double a_tot = (total * n) / 2;
+
+    _gini = (round(double(a * 100) / double(a_tot)))/100;
+    _gini = std::max(0.0, std::min(_gini, 1.0));
+
+    _error = total > 0 ? err / (2 * total * n) : 0;
+
+    LOG_DEBUG(LogCategory::inequality) << "a ≈" << a << ", a_tot =" << a_tot << "gini ≈" << _gini
+             << "(±" << _error << ") RMS =" << rms << "range ±"
+             << (_spread * 100) << "% of mean, mean =" << _mean;
+}
+
+void Inequality::sort(int n)
+{
+    double *v = buffer.data();
+
+    /*
+     * If we are already running in parallel (e.g. with other domains) the
+     * chunks would be sorted serially anyway, so don't bother splitting
+     */
+    int threads = Parallel::nested()
+            ? 1 : std::min(Parallel::idealThreadCount(), MAX_SORT_THREADS);
+
+    if (n < PARALLEL_SORT_THRESHOLD || threads < 2)
+    {
+        std::sort(v, v + n);
+        return;
+    }
+
+    /*
+     * Sort equal-sized chunks in parallel
+     */
+    std::vector<int> bounds(threads + 1);
+    for (int t = 0; t <= threads; t++)
+    {
+        bounds[t] = int((qint64(n) * t) / threads);
+    }
+
+    parallelFor(threads, [v, &bounds](int t) {
+        std::sort(v + bounds[t], v + bounds[t + 1]);
+    });
+
+    /*
+     * Merge adjacent pairs of runs, doubling the run length each time and
+     * switching between the buffer and the scratch area, which is reused on
+     * subsequent calls
+     */
+    if (scratch.size() < n)
+    {
+        scratch.resize(n);
+    }
+
+    double *from = v;
+    double *to = scratch.data();
+
+    for (int width = 1; width < threads; width *= 2)
+    {
+        int pairs = (threads + 2 * width - 1) / (2 * width);
+
+        parallelFor(pairs, [from, to, &bounds, width, threads](int k) {
+            int t = k * 2 * width;
+            int lo = bounds[t];
+            int mid = bounds[std::min(t + width, threads)];
+            int hi = bounds[std::min(t + 2 * width, threads)];
+            std::merge(from + lo, from + mid, from + mid, from + hi, to + lo);
+        });
+
+        std::swap(from, to);
+    }
+
+    if (from != v)
+    {
+        std::copy(from, from + n, v);
+    }
+}
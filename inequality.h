@@ -0,0 +1,112 @@
+#ifndef INEQUALITY_H
+#define INEQUALITY_H
+
+#include <QVector>
+#include <QString>
+
+/******************************************************************************
+ * Inequality calculates the Gini coefficient, mean and spread of a set of
+ * values (in practice the average wages of all the workers in a domain). The
+ * caller fills the buffer returned by values() and then calls calculate().
+ * The buffer is kept between calls so that no allocation is needed once it
+ * has reached the size of the population.
+ *
+ * There are two modes:
+ *
+ *   exact        The values are sorted (in parallel for large populations) and
+ *                the results are exactly those of the original calculation in
+ *                Domain::iterate.
+ *
+ *   approximate  The values are put into a fixed number of equal-width bins in
+ *                O(n) time without sorting. The mean and spread are still
+ *                exact (apart from rounding) but the Gini coefficient is
+ *                calculated as if every value in a bin were equal to the mean
+ *                of that bin. If bin b holds m_b values lying between lo_b and
+ *                hi_b, the error in the (unrounded) Gini coefficient is at
+ *                most
+ *
+ *                    sum over b of (m_b^2 * (hi_b - lo_b)) / (2 * mean * n^2)
+ *
+ *                which is available from error() after each calculation. Bins
+ *                in which all the values are equal (e.g. the zero wages of
+ *                the unemployed) contribute nothing to the error.
+ ******************************************************************************/
+
+class Inequality
+{
+public:
+
+    enum class Mode
+    {
+        exact,
+        approximate
+    };
+
+    Inequality();
+
+    /*
+     * Conversion to and from the names used in settings ("inequality-mode")
+     * and on the command line. Unknown names give exact mode.
+     */
+    static Mode modeFromName(const QString &name);
+    static QString modeName(Mode mode);
+
+    void setMode(Mode mode);
+    Mode mode() const;
+
+    /*
+     * Return a buffer with room for n values, to be filled by the caller
+     * before calling calculate(n). The contents are overwritten by
+     * calculate().
+     */
+    double *values(int n);
+
+    /*
+     * Calculate the statistics for the first n values in the buffer. If
+     * mean_only is true the Gini coefficient and spread are set to zero
+     * (as they are in the first period of a run).
+     */
+    void calculate(int n, bool mean_only = false);
+
+    double gini() const;
+    double mean() const;
+    double spread() const;
+
+    /*
+     * Upper bound on the error in the last Gini coefficient before rounding
+     * (always zero in exact mode)
+     */
+    double error() const;
+
+private:
+
+    Mode _mode = Mode::exact;
+
+    QVector<double> buffer;
+    QVector<double> scratch;    // for merging after a parallel sort
+
+    /*
+     * Per-bin counts, sums and ranges for approximate mode, kept between
+     * calls for the same reason as buffer
+     */
+    QVector<int> bin_count;
+    QVector<double> bin_sum;
+    QVector<double> bin_min;
+    QVector<double> bin_max;
+
+    double _gini = 0;
+    double _mean = 0;
+    double _spread = 0;
+    double _error = 0;
+
+    void calculateExact(int n);
+    void calculateApproximate(int n);
+
+    /*
+     * Sort the first n values in the buffer in ascending order, using more
+     * than one thread if n is large enough to make it worthwhile
+     */
+    void sort(int n);
+};
+
+#endif // INEQUALITY_H
@@ -0,0 +1,372 @@
+#include "log.h"
+
+#include <QSettings>
+#include <QStringList>
+
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#include <stdint.h>
+#include <stdio.h>
+
+/*
+ * Number of messages the queue can hold (a power of two). Messages made
+ * while it is full are dropped.
+ */
+#define LOG_QUEUE_SIZE 8192
+
+/*
+ * Interval at which the queue is emptied, unless flush() is called
+ */
+#define LOG_DRAIN_MS 20
+
+/*
+ * Set when the queue (a static) has been destroyed, e.g. if a message is made
+ * while the program is exiting. A plain atomic flag has no destructor, so it
+ * can still be read then.
+ */
+static std::atomic<bool> queue_destroyed(false);
+
+/*
+ * A message as it is written, ending with a newline
+ */
+static QByteArray formatMessage(LogLevel level, LogCategory category, const QString &text)
+{
+    QByteArray out;
+
+    switch (level)
+    {
+    case LogLevel::debug:
+        out += "Debug: ";
+        break;
+    case LogLevel::info:
+        out += "Info: ";
+        break;
+    case LogLevel::warning:
+        out += "Warning: ";
+        break;
+    case LogLevel::critical:
+        out += "Critical: ";
+        break;
+    case LogLevel::fatal:
+        out += "Fatal: ";
+        break;
+    }
+
+    if (category != LogCategory::general)
+    {
+        out += "[" + Log::categoryName(category).toLatin1() + "] ";
+    }
+
+    out += text.toLocal8Bit();
+    out += "\n";
+    return out;
+}
+
+/*
+ * The queue of messages waiting to be written. Any number of threads can add
+ * to it without taking a lock (it is a bounded queue after Dmitry Vyukov's
+ * design, in which each cell holds a sequence number saying whose turn it is
+ * to use it); its own thread takes them off.
+ */
+class LogQueue
+{
+public:
+
+    LogQueue();
+    ~LogQueue();
+
+    void push(LogLevel level, LogCategory category, const QString &text);
+    void flush();
+
+private:
+
+    struct Cell
+    {
+        std::atomic<size_t> sequence;
+        LogLevel level;
+        LogCategory category;
+        QString text;
+    };
+
+    Cell *cells;
+    std::atomic<size_t> enqueue_pos;
+    std::atomic<size_t> dequeue_pos;
+    std::atomic<int> dropped;
+
+    std::thread thread;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable drained;
+    bool stopping = false;
+
+    /*
+     * Write whatever is in the queue. Only called on the queue's own thread
+     * (or after it has stopped).
+     */
+    void drain();
+
+    void run();
+};
+
+LogQueue::LogQueue()
+{
+    cells = new Cell[LOG_QUEUE_SIZE];
+    for (size_t i = 0; i < LOG_QUEUE_SIZE; i++)
+    {
+        cells[i].sequence.store(i, std::memory_order_relaxed);
+    }
+    enqueue_pos = 0;
+    dequeue_pos = 0;
+    dropped = 0;
+
+    thread = std::thread(&LogQueue::run, this);
+}
+
+LogQueue::~LogQueue()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wake.notify_one();
+    thread.join();
+
+    drain();
+    delete[] cells;
+
+    queue_destroyed = true;
+}
+
+void LogQueue::push(LogLevel level, LogCategory category, const QString &text)
+{
+    size_t pos = enqueue_pos.load(std::memory_order_relaxed);
+    Cell *cell;
+
+    for (;;)
+    {
+        cell = &cells[pos & (LOG_QUEUE_SIZE - 1)];
+        size_t seq = cell->sequence.load(std::memory_order_acquire);
+        intptr_t diff = intptr_t(seq) - intptr_t(pos);
+
+        if (diff == 0)
+        {
+            if (enqueue_pos.compare_exchange_weak(pos, pos + 1,
+                                                  std::memory_order_relaxed))
+            {
+                break;
+            }
+        }
+        else if (diff < 0)
+        {
+            // Full
+            dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        else
+        {
+            pos = enqueue_pos.load(std::memory_order_relaxed);
+        }
+    }
+
+    cell->level = level;
+    cell->category = category;
+    cell->text = text;
+    cell->sequence.store(pos + 1, std::memory_order_release);
+}
+
+void LogQueue::drain()
+{
+    QByteArray out;
+    size_t pos = dequeue_pos.load(std::memory_order_relaxed);
+
+    for (;;)
+    {
+        Cell &cell = cells[pos & (LOG_QUEUE_SIZE - 1)];
+        size_t seq = cell.sequence.load(std::memory_order_acquire);
+        if (intptr_t(seq) - intptr_t(pos + 1) < 0)
+        {
+            break;      // empty (or the next message isn't complete yet)
+        }
+
+        out += formatMessage(cell.level, cell.category, cell.text);
+
+        cell.text = QString();
+        cell.sequence.store(pos + LOG_QUEUE_SIZE, std::memory_order_release);
+        pos++;
+    }
+
+    int lost = dropped.exchange(0, std::memory_order_relaxed);
+    if (lost > 0)
+    {
+        out += "Warning: " + QByteArray::number(lost)
+                + " log messages were dropped\n";
+    }
+
+    if (!out.isEmpty())
+    {
+        fwrite(out.constData(), 1, size_t(out.size()), stderr);
+        fflush(stderr);
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        dequeue_pos.store(pos, std::memory_order_release);
+    }
+    drained.notify_all();
+}
+
+void LogQueue::run()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    while (!stopping)
+    {
+        wake.wait_for(lock, std::chrono::milliseconds(LOG_DRAIN_MS));
+        lock.unlock();
+        drain();
+        lock.lock();
+    }
+}
+
+void LogQueue::flush()
+{
+    size_t target = enqueue_pos.load(std::memory_order_acquire);
+
+    std::unique_lock<std::mutex> lock(mutex);
+    while (!stopping && dequeue_pos.load(std::memory_order_acquire) < target)
+    {
+        wake.notify_one();
+        drained.wait_for(lock, std::chrono::milliseconds(LOG_DRAIN_MS));
+    }
+}
+
+static LogQueue &queue()
+{
+    static LogQueue q;
+    return q;
+}
+
+/******************************************************************************
+ * Log
+ ******************************************************************************/
+
+std::atomic<unsigned> Log::enabled_categories(
+        ~((1u << unsigned(LogCategory::transactions))
+          | (1u << unsigned(LogCategory::inequality))));
+
+Log::Message::Message(LogLevel level, LogCategory category)
+    : stream(&text)
+{
+    this->level = level;
+    this->category = category;
+    stream.noquote();
+}
+
+Log::Message::~Message()
+{
+    /*
+     * QDebug puts a space after each item
+     */
+    if (text.endsWith(' '))
+    {
+        text.chop(1);
+    }
+    Log::write(level, category, text);
+}
+
+void Log::setEnabled(LogCategory category, bool enabled)
+{
+    if (enabled)
+    {
+        enabled_categories.fetch_or(1u << unsigned(category));
+    }
+    else
+    {
+        enabled_categories.fetch_and(~(1u << unsigned(category)));
+    }
+}
+
+void Log::readSettings()
+{
+    QSettings settings;
+
+    if (!settings.contains("log-categories"))
+    {
+        return;
+    }
+
+    /*
+     * QSettings reads a comma-separated value as a list
+     */
+    QStringList names;
+    foreach (QString item, settings.value("log-categories").toStringList())
+    {
+#if QT_VERSION >= QT_VERSION_CHECK(5, 14, 0)
+        foreach (QString name, item.split(',', Qt::SkipEmptyParts))
+#else
+        foreach (QString name, item.split(',', QString::SkipEmptyParts))
+#endif
+        {
+            names.append(name.trimmed());
+        }
+    }
+
+    for (int i = 0; i < int(LogCategory::num_categories); i++)
+    {
+        LogCategory category = LogCategory(i);
+        setEnabled(category, names.contains("all")
+                   || names.contains(categoryName(category)));
+    }
+}
+
+QString Log::categoryName(LogCategory category)
+{
+    switch (category)
+    {
+    case LogCategory::general:
+        return "general";
+    case LogCategory::engine:
+        return "engine";
+    case LogCategory::transactions:
+        return "transactions";
+    case LogCategory::inequality:
+        return "inequality";
+    case LogCategory::runs:
+        return "runs";
+    case LogCategory::gui:
+        return "gui";
+    default:
+        return "?";
+    }
+}
+
+void Log::write(LogLevel level, LogCategory category, const QString &text)
+{
+    /*
+     * Critical and fatal messages are written straight away (after the ones
+     * already queued), as they can't be dropped and may be followed by a
+     * crash or abort()
+     */
+    if (level >= LogLevel::critical)
+    {
+        flush();
+        QByteArray out = formatMessage(level, category, text);
+        fwrite(out.constData(), 1, size_t(out.size()), stderr);
+        fflush(stderr);
+        return;
+    }
+
+    if (!queue_destroyed)
+    {
+        queue().push(level, category, text);
+    }
+}
+
+void Log::flush()
+{
+    if (!queue_destroyed)
+    {
+        queue().flush();
+    }
+}
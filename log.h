@@ -0,0 +1,180 @@
+#ifndef LOG_H
+#define LOG_H
+
+#include <QDebug>
+#include <QString>
+
+#include <atomic>
+
+/******************************************************************************
+ * Logging for the engine.
+ *
+ * qDebug() formats and writes each message as soon as it is made, which in
+ * the per-transaction and per-period paths costs more than the economics.
+ * Messages made with the LOG_ macros below instead cost nothing when they are
+ * filtered out, and otherwise are only formatted and put in a queue. A
+ * background thread takes them off the queue and writes them to stderr a
+ * batch at a time.
+ *
+ * Messages are filtered in two ways:
+ *
+ *   - At compile time, by level. Messages below OBSON_LOG_LEVEL are compiled
+ *     out altogether (though they are still checked by the compiler). It
+ *     defaults to LOG_LEVEL_DEBUG, or to LOG_LEVEL_WARNING if
+ *     QT_NO_DEBUG_OUTPUT is defined. LOG_LEVEL_NONE removes all logging.
+ *
+ *   - At run time, by category (see Log::setEnabled and Log::readSettings).
+ *     A disabled category costs a single test of a flag.
+ *
+ * The queue is a fixed-size ring buffer that threads add to without taking a
+ * lock. If it is full (i.e. messages are being made faster than they can be
+ * written) further messages are dropped rather than holding up the model, and
+ * the number dropped is reported. Critical and fatal messages bypass the
+ * queue, so they are never dropped.
+ *
+ * Usage:
+ *
+ *     LOG_DEBUG(LogCategory::transactions) << "paying" << amount;
+ *
+ * The message is formatted as by qDebug().noquote(), with spaces between the
+ * items.
+ ******************************************************************************/
+
+#define LOG_LEVEL_DEBUG     0
+#define LOG_LEVEL_INFO      1
+#define LOG_LEVEL_WARNING   2
+#define LOG_LEVEL_CRITICAL  3
+#define LOG_LEVEL_NONE      4
+
+#ifndef OBSON_LOG_LEVEL
+#ifdef QT_NO_DEBUG_OUTPUT
+#define OBSON_LOG_LEVEL LOG_LEVEL_WARNING
+#else
+#define OBSON_LOG_LEVEL LOG_LEVEL_DEBUG
+#endif
+#endif
+
+enum class LogLevel
+{
+    debug,
+    info,
+    warning,
+    critical,
+    fatal           // only from qFatal(), which then aborts
+};
+
+/*
+ * Categories that can be switched on and off at run time. The names used in
+ * settings are given by Log::categoryName.
+ */
+enum class LogCategory
+{
+    general,        // anything not in another category, e.g. from qDebug()
+    engine,         // domain creation, resets, firm creation etc.
+    transactions,   // individual payments (many per agent per period)
+    inequality,     // the Gini calculation each period
+    runs,           // running, caching and ensembles
+    gui,
+
+    num_categories  // must be last
+};
+
+class Log
+{
+public:
+
+    /*
+     * A message being formatted. It is queued when it is destroyed (i.e. at
+     * the end of the statement).
+     */
+    class Message
+    {
+    public:
+
+        Message(LogLevel level, LogCategory category);
+        ~Message();
+
+        template <typename T>
+        Message &operator<<(const T &value)
+        {
+            stream << value;
+            return *this;
+        }
+
+    private:
+
+        LogLevel level;
+        LogCategory category;
+        QString text;
+        QDebug stream;
+    };
+
+    static bool isEnabled(LogCategory category)
+    {
+        return (enabled_categories.load(std::memory_order_relaxed)
+                & (1u << unsigned(category))) != 0;
+    }
+
+    static void setEnabled(LogCategory category, bool enabled);
+
+    /*
+     * Enable just the categories listed (by name, separated by commas) in the
+     * "log-categories" setting. By default every category except
+     * transactions and inequality (which log every payment and every period
+     * respectively) is enabled.
+     */
+    static void readSettings();
+
+    static QString categoryName(LogCategory category);
+
+    /*
+     * Queue a message that has already been formatted. Critical and fatal
+     * messages are not queued but written at once, after flushing the queue.
+     */
+    static void write(LogLevel level, LogCategory category, const QString &text);
+
+    /*
+     * Wait until every message queued so far has been written
+     */
+    static void flush();
+
+private:
+
+    static std::atomic<unsigned> enabled_categories;
+};
+
+#define LOG_AT(level, category) \
+    if (!Log::isEnabled(category)) {} else Log::Message(level, category)
+
+/*
+ * A message that has been compiled out. The condition is a constant, so the
+ * compiler removes the statement, but the message is still checked.
+ */
+#define LOG_NEVER(level, category) \
+    if (true) {} else Log::Message(level, category)
+
+#if OBSON_LOG_LEVEL <= LOG_LEVEL_DEBUG
+#define LOG_DEBUG(category) LOG_AT(LogLevel::debug, category)
+#else
+#define LOG_DEBUG(category) LOG_NEVER(LogLevel::debug, category)
+#endif
+
+#if OBSON_LOG_LEVEL <= LOG_LEVEL_INFO
+#define LOG_INFO(category) LOG_AT(LogLevel::info, category)
+#else
+#define LOG_INFO(category) LOG_NEVER(LogLevel::info, category)
+#endif
+
+#if OBSON_LOG_LEVEL <= LOG_LEVEL_WARNING
+#define LOG_WARNING(category) LOG_AT(LogLevel::warning, category)
+#else
+#define LOG_WARNING(category) LOG_NEVER(LogLevel::warning, category)
+#endif
+
+#if OBSON_LOG_LEVEL <= LOG_LEVEL_CRITICAL
+#define LOG_CRITICAL(category) LOG_AT(LogLevel::critical, category)
+#else
+#define LOG_CRITICAL(category) LOG_NEVER(LogLevel::critical, category)
+#endif
+
+#endif // LOG_H
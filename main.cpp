@@ -1,53 +1,44 @@
 #include "mainwindow.h"
+#include "log.h"
 #include <QApplication>
-#include <stdio.h>
 #include <stdlib.h>
 #include <QIcon>
 
+/*
+ * Messages from qDebug() etc. (mainly from the GUI, and from Qt itself) are
+ * queued and written on the logging thread along with the engine's (see
+ * log.h), rather than being written while the thread that made them waits.
+ * Where they come from is only added to warnings and errors.
+ */
 void myMessageOutput(QtMsgType type, const QMessageLogContext &context, const QString &msg)
 {
-    QByteArray localMsg = msg.toLocal8Bit();
-    switch (type) {
-    case QtDebugMsg:
-        fprintf(stderr, "Debug: %s (%s:%u, %s)\n", localMsg.constData(), context.file, context.line, context.function);
-        break;
-    case QtInfoMsg:
-        fprintf(stderr, "Info: %s (%s:%u, %s)\n", localMsg.constData(), context.file, context.line, context.function);
-        break;
-    case QtWarningMsg:
-        fprintf(stderr, "Warning: %s (%s:%u, %s)\n", localMsg.constData(), context.file, context.line, context.function);
-        break;
-    case QtCriticalMsg:
-        fprintf(stderr, "Critical: %s (%s:%u, %s)\n", localMsg.constData(), context.file, context.line, context.function);
-        break;
-    case QtFatalMsg:
-        fprintf(stderr, "Fatal: %s (%s:%u, %s)\n", localMsg.constData(), context.file, context.line, context.function);
-        abort();
-    }
-}
-#if 0
-void myMessageOutput(QtMsgType type, const QMessageLogContext&, const QString&msg)
-{
-    QByteArray localMsg = msg.toLocal8Bit();
+    auto where = [&context]() {
+        return QString(" (%1:%2, %3)").arg(context.file).arg(context.line)
+                .arg(context.function);
+    };
+
     switch (type) {
     case QtDebugMsg:
-        fprintf(stderr, "Debug: %s\n", localMsg.constData());
+        if (Log::isEnabled(LogCategory::general)) {
+            Log::write(LogLevel::debug, LogCategory::general, msg);
+        }
         break;
     case QtInfoMsg:
-        fprintf(stderr, "Info: %s\n", localMsg.constData());
+        if (Log::isEnabled(LogCategory::general)) {
+            Log::write(LogLevel::info, LogCategory::general, msg);
+        }
         break;
     case QtWarningMsg:
-        fprintf(stderr, "Warning: %s\n", localMsg.constData());
+        Log::write(LogLevel::warning, LogCategory::general, msg + where());
         break;
     case QtCriticalMsg:
-        fprintf(stderr, "Critical: %s\n", localMsg.constData());
+        Log::write(LogLevel::critical, LogCategory::general, msg + where());
         break;
     case QtFatalMsg:
-        fprintf(stderr, "Fatal: %s\n", localMsg.constData());
+        Log::write(LogLevel::fatal, LogCategory::general, msg + where());
         abort();
     }
 }
-#endif
 
 int main(int argc, char *argv[])
 {
@@ -88,6 +79,8 @@ int main(int argc, char *argv[])
     QSettings settings;
     settings.setFallbacksEnabled(false);
 
+    Log::readSettings();
+
     MainWindow mainwindow;
     //mainwindow.setWindowIcon(QIcon(":/obson.icns"));
     mainwindow.show();
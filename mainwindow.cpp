@@ -18,6 +18,7 @@
 #include <QDockWidget>
 #include <QDialogButtonBox>
 #include <QFileDialog>
+#include <QInputDialog>
 #include <QUrl>
 #include <QDebug>
 
@@ -26,8 +27,18 @@
 #include "version.h"
 #include "saveprofiledialog.h"
 #include "statsdialog.h"
+#include "timingdialog.h"
 #include "removeprofiledialog.h"
 #include "createdomaindlg.h"
+#include "derived.h"
+#include "derivedpropertiesdialog.h"
+#include "simulationrunner.h"
+#include "exporter.h"
+#include "profiler.h"
+#include "resultfile.h"
+#include "sweep.h"
+
+#include <algorithm>
 
 MainWindow::MainWindow()
 {
@@ -46,6 +57,15 @@ MainWindow::MainWindow()
     statsDialog = new StatsDialog(this);
     statsDialog->setWindowFlags(Qt::Tool);
 
+    timingDialog = new TimingDialog(this);
+    timingDialog->setWindowFlags(Qt::Tool);
+
+    /*
+     * Whether to time each phase of each period (see Profiler). This is set
+     * before the first run so that it is timed too.
+     */
+    Profiler::setEnabled(settings.value("record-timings", false).toBool());
+
     qDebug() << "Settings are in" << settings.fileName();
 
     /*
@@ -76,6 +96,13 @@ MainWindow::MainWindow()
      */
     chartProfile = settings.value("current-profile", "").toString();
 
+    /*
+     * The domains are run on a background thread (see SimulationRunner)
+     */
+    runner = new SimulationRunner(this);
+    connect(runner, &SimulationRunner::progress, this, &MainWindow::showProgress);
+    connect(runner, &SimulationRunner::runFinished, this, &MainWindow::runFinished);
+
     /*
      * Allocate signals to menus
      */
@@ -105,18 +132,26 @@ MainWindow::MainWindow()
     setCentralWidget(&mdi);
 
     /*
-     * Call drawCharts(propertyList), which does all the real work.
+     * Start the first run. This returns straight away, so the window is shown
+     * while the domains are running and the charts fill in as they go.
      */
-    qDebug() << "calling Domain::drawCharts() with" << propertyList->count()
+    qDebug() << "starting run with" << propertyList->count()
              << "propertyList items";
-    Domain::drawCharts(propertyList);
-
-    qDebug() << "********* returned from drawCharts **********";
+    runner->startRun(propertyList);
 }
 
 MainWindow::~MainWindow()
 {
-    // Nothing to do...
+    /*
+     * The run must be stopped before the charts it updates are deleted
+     */
+    runner->cancelRun();
+
+    if (exportThread != nullptr)
+    {
+        export_cancelled = true;
+        exportThread->wait();
+    }
 }
 
 void MainWindow::show()
@@ -167,6 +202,11 @@ void MainWindow::createActions()
     // saveCSVAction->setDisabled(!isBehaviourSelected());
     connect(saveCSVAction, &QAction::triggered, this, &MainWindow::saveCSV);
 
+    // Open a binary results file
+    openResultsAction = new QAction(tr("&Open results file..."), this);
+    openResultsAction->setStatusTip(tr("Show the results saved in a binary results file"));
+    connect(openResultsAction, &QAction::triggered, this, &MainWindow::openResults);
+
     // Save profile
     const QIcon profileIcon = QIcon(":/chart-1.icns");
     saveProfileAction = new QAction(profileIcon, tr("&Save chart profile..."), this);
@@ -197,6 +237,11 @@ void MainWindow::createActions()
     setOptionsAction->setStatusTip(tr("Modify the global options"));
     connect(setOptionsAction, &QAction::triggered, this, &MainWindow::setOptions);
 
+    // Derived properties
+    derivedAction = new QAction(tr("D&erived properties..."), this);
+    derivedAction->setStatusTip(tr("Define properties calculated from the others"));
+    connect(derivedAction, &QAction::triggered, this, &MainWindow::editDerivedProperties);
+
     // About Obson
     aboutAction = new QAction(tr("&About"), this);
     aboutAction->setStatusTip(tr("Show version information"));
@@ -213,6 +258,17 @@ void MainWindow::createActions()
     statsAction->setEnabled(false);
     connect(statsAction, &QAction::triggered, this, &MainWindow::showStatistics);
 
+    // Timings
+    timingsAction = new QAction(tr("&Timings..."), this);
+    timingsAction->setStatusTip(tr("Show the time spent in each phase of the model"));
+    connect(timingsAction, &QAction::triggered, this, &MainWindow::showTimings);
+
+    recordTimingsAction = new QAction(tr("&Record timings"), this);
+    recordTimingsAction->setStatusTip(tr("Time each phase of each period when running the model"));
+    recordTimingsAction->setCheckable(true);
+    recordTimingsAction->setChecked(Profiler::isEnabled());
+    connect(recordTimingsAction, &QAction::toggled, this, &MainWindow::recordTimings);
+
     // Help (documentation)
     const QIcon helpIcon = QIcon(":/help-2.icns");
     helpAction = new QAction(helpIcon, tr("Open documentation in browser"), this);
@@ -225,6 +281,13 @@ void MainWindow::createActions()
     runAction->setStatusTip(tr("Update chart"));
     connect(runAction, &QAction::triggered, this, &MainWindow::drawChartNormal);
 
+    // Cancel the run in progress
+    const QIcon cancelIcon = QIcon(":/close.icns");
+    cancelAction = new QAction(cancelIcon, tr("&Stop the run"), this);
+    cancelAction->setStatusTip(tr("Stop updating the chart"));
+    cancelAction->setEnabled(false);
+    connect(cancelAction, &QAction::triggered, this, &MainWindow::cancelRun);
+
     // Close
     const QIcon closeIcon = QIcon(":/exit.icns");
     closeAction = new QAction(closeIcon, tr("&Quit..."), this);
@@ -242,11 +305,13 @@ void MainWindow::createMenus()
     qDebug() << "Adding File menu";
     fileMenu = myMenuBar->addMenu(tr("&File"));
     fileMenu->addAction(runAction);
+    fileMenu->addAction(cancelAction);
     fileMenu->addSeparator();
     fileMenu->addAction(domainAction);
     fileMenu->addSeparator();
     //fileMenu->addAction(removeAction);
     fileMenu->addSeparator();
+    fileMenu->addAction(openResultsAction);
     fileMenu->addAction(saveCSVAction);
     fileMenu->addAction(saveProfileAction);
 
@@ -255,11 +320,14 @@ void MainWindow::createMenus()
     editMenu->addAction(changeAction);
     setOptionsAction->setMenuRole(QAction::ApplicationSpecificRole);
     editMenu->addAction(setOptionsAction);
+    editMenu->addAction(derivedAction);
     //editMenu->addAction(notesAction);
 
     qDebug() << "Adding View menu";
     viewMenu = myMenuBar->addMenu(tr("&View")); // add zoom here eventually
     //viewMenu->addAction(coloursAction);
+    viewMenu->addAction(recordTimingsAction);
+    viewMenu->addAction(timingsAction);
 
     qDebug() << "Adding Help menu";
     helpMenu = myMenuBar->addMenu(tr("&Help"));
@@ -282,6 +350,7 @@ void MainWindow::createMenus()
     myToolBar->addAction(saveProfileAction);
     myToolBar->addAction(removeProfileAction);
     myToolBar->addAction(runAction);
+    myToolBar->addAction(cancelAction);
     //myToolBar->addAction(coloursAction);
     myToolBar->addAction(statsAction);
     myToolBar->addAction(helpAction);
@@ -290,15 +359,37 @@ void MainWindow::createMenus()
     qDebug() << "Menus and tools created";
 }
 
+/*
+ * Export the recorded values of the checked properties (or of all properties,
+ * if none are checked) for every domain. The file is written on a background
+ * thread from copies of the records, so the GUI stays responsive and a run
+ * may carry on in the meantime.
+ */
 void MainWindow::saveCSV()
 {
-#if 0   // this needs rewriting or removing
     qDebug() << "MainWindow::saveCSV():  called";
 
-    Behaviour *model = currentBehaviour();
-    QString filename = QFileDialog::getSaveFileName(this, tr("Save As"),
-                                QDir::homePath() + QDir::separator() + model->name() + ".csv",
-                                tr("CSV files (*.csv)"));
+    if (exportThread != nullptr)
+    {
+        statusBar()->showMessage(tr("An export is already in progress"), 2000);
+        return;
+    }
+
+    if (Domain::domains.isEmpty())
+    {
+        QMessageBox msgBox;
+        msgBox.setText("There are no domains to export");
+        msgBox.exec();
+        return;
+    }
+
+    QString filter;
+    QString filename = QFileDialog::getSaveFileName(
+                this, tr("Save As"),
+                QDir::homePath() + QDir::separator() + "obson.csv",
+                tr("CSV files (*.csv);;Tab-separated files (*.tsv *.txt);;"
+                   "Obson results files (*" RESULT_FILE_SUFFIX ")"),
+                &filter);
 
     if (filename.isEmpty()) {
         qDebug() << "MainWindow::saveCSV():  no file selected";
@@ -307,55 +398,243 @@ void MainWindow::saveCSV()
 
     qDebug() << "MainWindow::saveCSV():  output file =" << filename;
 
-    // Open the selected file for writing
-    QFile csv(filename);
-    if (!csv.open(QIODevice::WriteOnly | QIODevice::Text)) {
-        // TODO: Replace this with a proper messagebox
-        QErrorMessage msg;
-        msg.showMessage(tr("Cannot open file ") + filename);
+    const DerivedProperties &derived = Domain::derivedProperties;
+
+    QMap<Property,QString> columns;
+    QList<int> derived_columns;
+    for (int i = 0; i < propertyList->count(); i++)
+    {
+        QListWidgetItem *item = propertyList->item(i);
+        if (item->checkState() && Domain::propertyMap.contains(item->text()))
+        {
+            columns[Domain::propertyMap[item->text()]] = item->text();
+        }
+        else if (item->checkState() && derived.indexOf(item->text()) >= 0)
+        {
+            derived_columns.append(derived.indexOf(item->text()));
+        }
+    }
+
+    if (columns.isEmpty() && derived_columns.isEmpty())
+    {
+        foreach (QString name, Domain::propertyMap.keys())
+        {
+            columns[Domain::propertyMap[name]] = name;
+        }
+        for (int k = 0; k < derived.count(); k++)
+        {
+            derived_columns.append(k);
+        }
+    }
+
+    QStringList derived_names;
+    foreach (int k, derived_columns)
+    {
+        derived_names.append(derived.definition(k).name);
+    }
+
+    /*
+     * Take a copy of each domain's record, and calculate the derived
+     * properties from it (which is quick compared with writing them)
+     */
+    QList<ResultRunInfo> infos;
+    QList<PropertyRecord> records;
+    QList<QVector<QVector<double>>> derived_values;
+    foreach (Domain *dom, Domain::domains)
+    {
+        infos.append(ResultRunInfo::fromDomain(dom));
+        records.append(dom->snapshot());
+
+        QVector<QVector<double>> values;
+        if (!derived_columns.isEmpty())
+        {
+            ParameterBlock block;
+            block.load(dom->params);
+
+            QVector<QVector<double>> all;
+            derived.evaluate(records.last(), block, all);
+            foreach (int k, derived_columns)
+            {
+                values.append(all[k]);
+            }
+        }
+        derived_values.append(values);
+    }
+
+    export_cancelled = false;
+
+    /*
+     * A binary results file (see resultfile.h) can be opened again with
+     * openResults
+     */
+    if (filename.endsWith(RESULT_FILE_SUFFIX)
+            || (!filename.endsWith(".csv") && filter.startsWith("Obson")))
+    {
+        exportThread = QThread::create([this, infos, records, columns, derived_names,
+                                        derived_values, filename]() {
+            ResultFileWriter writer;
+            export_ok = writer.open(filename, export_error);
+            for (int i = 0; export_ok && !export_cancelled && i < infos.count(); i++)
+            {
+                writer.addRecord(infos[i], records[i], columns, derived_names,
+                                 derived_values[i]);
+            }
+            export_ok = export_ok && !export_cancelled && writer.close(export_error);
+        });
+        connect(exportThread, &QThread::finished, this, &MainWindow::exportFinished);
+
+        statusBar()->showMessage(tr("Exporting to ") + filename);
+        exportThread->start();
         return;
     }
 
-    QTextStream out(&csv);
+    bool tsv = filename.endsWith(".tsv") || filename.endsWith(".txt")
+            || (!filename.endsWith(".csv") && filter.startsWith("Tab"));
 
-    // Output headers and set up points lists for series
-    bool first = true;
-    int iters = getIters(), n = 0;
-    QList<QPointF>lists[iters];
-    for (int j = 0; j < propertyList->count(); j++)
+    Exporter *exporter = new Exporter(tsv ? Exporter::Format::tsv
+                                          : Exporter::Format::csv);
+    exporter->setProperties(columns);
+    exporter->setDerivedNames(derived_names);
+    for (int i = 0; i < infos.count(); i++)
     {
-        QListWidgetItem *item;
-        item = propertyList->item(j);
-        bool selected = item->checkState();
-        if (selected)
+        exporter->addRecord(infos[i].name, records[i], derived_values[i]);
+    }
+
+    exporter->setCancelFlag(&export_cancelled);
+
+    exportThread = QThread::create([this, exporter, filename]() {
+        export_ok = exporter->write(filename, export_error);
+        delete exporter;
+    });
+    connect(exportThread, &QThread::finished, this, &MainWindow::exportFinished);
+
+    statusBar()->showMessage(tr("Exporting to ") + filename);
+    exportThread->start();
+}
+
+/*
+ * Show the runs in a binary results file (see resultfile.h) without running
+ * the model. Each run is shown in the chart of the domain it is named after,
+ * or in a new domain with the run's parameters if there isn't one.
+ */
+void MainWindow::openResults()
+{
+    QString filename = QFileDialog::getOpenFileName(
+                this, tr("Open results"), QDir::homePath(),
+                tr("Obson results files (*" RESULT_FILE_SUFFIX ");;All files (*)"));
+
+    if (filename.isEmpty())
+    {
+        return;
+    }
+
+    ResultFile results;
+    QString error;
+    if (!results.open(filename, error))
+    {
+        QMessageBox msgBox;
+        msgBox.setText(error);
+        msgBox.exec();
+        return;
+    }
+
+    /*
+     * Each run is shown in the domain it was made from. A sweep file holds a
+     * run for each point, so rather than make a domain for every one, ask
+     * which point to show. The points are written in the order they finish,
+     * so they are listed here by point number (keeping the runs that aren't
+     * sweep points, numbered -1, in file order).
+     */
+    QMap<QString,QList<int>> runs;
+    QVector<int> points(results.runCount());
+    for (int i = 0; i < results.runCount(); i++)
+    {
+        runs[Sweep::domainName(results.run(i).name, &points[i])].append(i);
+    }
+
+    for (auto it = runs.begin(); it != runs.end(); ++it)
+    {
+        std::stable_sort(it.value().begin(), it.value().end(),
+                         [&points](int a, int b) { return points[a] < points[b]; });
+    }
+
+    QList<int> chosen;
+    for (auto it = runs.constBegin(); it != runs.constEnd(); ++it)
+    {
+        int run = it.value().first();
+        if (it.value().count() > 1)
         {
-            if (first) {
-                first = false;
-                out << "\"Period\"";
+            QStringList names;
+            foreach (int i, it.value())
+            {
+                names.append(results.run(i).name);
             }
-            QString series_name = item->text();
-            out << ",\"" << series_name << "\"";
-            Behaviour::Property prop = propertyMap[series_name];
-            lists[n++] = _currentBehaviour->series[prop]->points();
+
+            bool ok;
+            QString name = QInputDialog::getItem(this, tr("Open results"),
+                                                 tr("Run of %1 to show:").arg(it.key()),
+                                                 names, 0, false, &ok);
+            if (!ok)
+            {
+                return;
+            }
+            run = it.value().at(names.indexOf(name));
         }
+        chosen.append(run);
     }
 
-    int start = getStartPeriod();
-    for (int i = 0; i < iters; i++)
+    runner->cancelRun();
+
+    foreach (int i, chosen)
     {
-        first = true;
-        for (int j = 0; j < n; j++)
+        const ResultRunInfo &info = results.run(i);
+
+        QString name = Sweep::domainName(info.name);
+        Domain *dom = Domain::getDomain(name);
+        if (dom == nullptr)
         {
-            if (first) {
-                out << "\n\"" << i + start << "\"";
-                first = false;
+            dom = Domain::createDomain(name);
+            for (auto it = info.parameters.constBegin();
+                 it != info.parameters.constEnd(); ++it)
+            {
+                ParamType param;
+                if (Sweep::parameterFromKey(it.key(), param))
+                {
+                    dom->params[param] = it.value();
+                }
             }
+            createChartWindow(dom)->show();
+        }
+
+        PropertyRecord record;
+        results.toRecord(i, record);
+        dom->restoreRecord(record);
+        runner->invalidate(dom);
+    }
+
+    Domain::redrawCharts(propertyList);
+    statusBar()->showMessage(tr("Opened ") + filename, 2000);
+}
 
-            // Output the ith value in the series
-            out << ",\"" << lists[j].at(i).y() << "\"";
+void MainWindow::exportFinished()
+{
+    exportThread->deleteLater();
+    exportThread = nullptr;
+
+    if (export_ok)
+    {
+        statusBar()->showMessage(tr("Export complete"), 2000);
+    }
+    else
+    {
+        statusBar()->clearMessage();
+        if (!export_cancelled)
+        {
+            QMessageBox msgBox;
+            msgBox.setText(export_error);
+            msgBox.exec();
         }
     }
-#endif
 }
 
 void MainWindow::nyi()
@@ -512,7 +791,19 @@ void MainWindow::createDomain()
 
     if (dlg.exec() == QDialog::Accepted)
     {
-        Domain::createDomain(dlg.getDomainName());
+        // The running domains mustn't be changed under it
+        runner->cancelRun();
+        Domain *dom = Domain::createDomain(dlg.getDomainName());
+
+        /*
+         * Give the new domain a chart and run it. The other domains haven't
+         * changed, so they aren't run again (see SimulationRunner).
+         */
+        if (dom != nullptr)
+        {
+            createChartWindow(dom)->show();
+            runner->startRun(propertyList);
+        }
     }
 }
 
@@ -542,6 +833,12 @@ void MainWindow::editParameters()
         qDebug() << "returned from DomainParametersDialog with domain name"
                  << domainName;
 
+        /*
+         * The new parameters pre-empt the run in progress, which must be
+         * stopped before they are changed
+         */
+        runner->cancelRun();
+
         QSettings settings;
         int val;
         /*
@@ -634,7 +931,7 @@ void MainWindow::editParameters()
         settings.endGroup();
         settings.endGroup();
 
-        Domain::drawCharts(propertyList);
+        runner->startRun(propertyList);
     }
 }
 
@@ -674,7 +971,54 @@ void MainWindow::setOptions()
     dlg.setModal(true);
     if (dlg.exec() == QDialog::Accepted && !Domain::domains.isEmpty())
     {
-        Domain::drawCharts(propertyList);
+        runner->startRun(propertyList);
+    }
+}
+
+/*
+ * Changing the derived properties doesn't need a run, as they are calculated
+ * from the recorded values when the charts are drawn
+ */
+void MainWindow::editDerivedProperties()
+{
+    DerivedPropertiesDialog dlg(this);
+    dlg.setModal(true);
+    if (dlg.exec() == QDialog::Accepted)
+    {
+        Domain::derivedProperties.read();
+        updateDerivedItems();
+        redrawCharts();
+    }
+}
+
+void MainWindow::updateDerivedItems()
+{
+    QStringList checked;
+    while (propertyList->count() > Domain::propertyMap.count())
+    {
+        QListWidgetItem *item = propertyList->takeItem(propertyList->count() - 1);
+        if (item->checkState())
+        {
+            checked.append(item->text());
+        }
+        delete item;
+    }
+
+    const DerivedProperties &derived = Domain::derivedProperties;
+    for (int k = 0; k < derived.count(); k++)
+    {
+        QListWidgetItem *item = new QListWidgetItem;
+        item->setText(derived.definition(k).name);
+        item->setToolTip(derived.definition(k).expression);
+
+        QFont font = item->font();
+        font.setItalic(true);
+        item->setFont(font);
+
+        item->setCheckState(checked.contains(item->text()) ? Qt::Checked : Qt::Unchecked);
+        item->setFlags(Qt::ItemIsSelectable | Qt::ItemIsUserCheckable | Qt::ItemIsEnabled);
+
+        propertyList->addItem(item);
     }
 }
 
@@ -684,8 +1028,14 @@ void MainWindow::createStatusBar()
     productivityLabel = new QLabel;
     infoLabel = new QLabel;
 
+    progressBar = new QProgressBar;
+    progressBar->setMaximumWidth(200);
+    progressBar->setTextVisible(false);
+    progressBar->hide();
+
     statusBar()->addPermanentWidget(inequalityLabel);
     statusBar()->addPermanentWidget(productivityLabel);
+    statusBar()->addPermanentWidget(progressBar);
     statusBar()->addPermanentWidget(infoLabel);
 
     infoLabel->setText(tr("Obson economic modelling"));
@@ -700,7 +1050,7 @@ void MainWindow::propertyChanged()
     qDebug() << "MainWindow::propertyChanged()";
     if (!changing_profile)
     {
-        Domain::drawCharts(propertyList);
+        redrawCharts();
     }
     profile_changed = true;
 }
@@ -762,6 +1112,12 @@ void MainWindow::createDockWindows()
         propertyList->addItem(item);
     }
 
+    /*
+     * The derived properties (shown in italics) follow the built-in ones
+     */
+    Domain::derivedProperties.read();
+    updateDerivedItems();
+
     /*
      * Add the property list widget to the dock and put the dock on the right
      * of the window
@@ -833,15 +1189,7 @@ int MainWindow::createSubWindows()
          * and set the chartview as the chartview for each domain
          */
         foreach(Domain *dom, Domain::domains){
-            QString title = dom->getName();
-            QMdiSubWindow *w = new QMdiSubWindow();
-
-            w->setWindowTitle(title);
-            w->resize(470, 370);
-            mdi.addSubWindow(w);
-            QChartView *chartView = createChart();
-            w->setWidget(chartView);
-            dom->setChartView(chartView);
+            createChartWindow(dom);
         }
     }
     else
@@ -859,6 +1207,21 @@ int MainWindow::createSubWindows()
     return domainNameList.count();
 }
 
+QMdiSubWindow *MainWindow::createChartWindow(Domain *dom)
+{
+    QString title = dom->getName();
+    QMdiSubWindow *w = new QMdiSubWindow();
+
+    w->setWindowTitle(title);
+    w->resize(470, 370);
+    mdi.addSubWindow(w);
+    QChartView *chartView = createChart();
+    w->setWidget(chartView);
+    dom->setChartView(chartView);
+
+    return w;
+}
+
 void MainWindow::showStatistics()
 {
     if (!property_selected) {
@@ -872,6 +1235,36 @@ void MainWindow::showStatistics()
     }
 }
 
+void MainWindow::showTimings()
+{
+    timingDialog->refresh();
+    timingDialog->show();
+    timingDialog->raise();
+}
+
+/*
+ * Turning timings on reruns every domain from the start (rather than loading
+ * its results from the cache or leaving it as it is) so that there is
+ * something to show. Turning them off leaves the timings already recorded.
+ */
+void MainWindow::recordTimings(bool record)
+{
+    QSettings settings;
+    settings.setValue("record-timings", record);
+
+    runner->cancelRun();
+    Profiler::setEnabled(record);
+
+    if (record)
+    {
+        foreach (Domain *dom, Domain::domains)
+        {
+            runner->invalidate(dom);
+        }
+        runner->startRun(propertyList);
+    }
+}
+
 int MainWindow::loadProfileList()
 {
     return 0;
@@ -884,8 +1277,50 @@ int MainWindow::getPeriod()
 
 void MainWindow::drawChartNormal()
 {
-    qDebug() << "Calling Domain::drawCharts() from drawChartNormal";
-    Domain::drawCharts(propertyList);
+    qDebug() << "Starting run from drawChartNormal";
+    runner->startRun(propertyList);
+}
+
+/*
+ * Redraw the charts from the recorded values, unless there aren't any yet and
+ * no run is in progress to provide them, in which case start a run
+ */
+void MainWindow::redrawCharts()
+{
+    if (runner->isRunning() || Domain::recordsAvailable())
+    {
+        Domain::redrawCharts(propertyList);
+    }
+    else
+    {
+        runner->startRun(propertyList);
+    }
+}
+
+void MainWindow::cancelRun()
+{
+    runner->cancelRun();
+}
+
+void MainWindow::showProgress(int periods_done, int periods_total)
+{
+    cancelAction->setEnabled(true);
+    progressBar->setRange(0, periods_total);
+    progressBar->setValue(periods_done);
+    progressBar->show();
+}
+
+void MainWindow::runFinished(bool cancelled)
+{
+    cancelAction->setEnabled(false);
+    progressBar->hide();
+    statusBar()->showMessage(cancelled ? tr("Run stopped") : tr("Run complete"),
+                             2000);
+
+    if (timingDialog->isVisible())
+    {
+        timingDialog->refresh();
+    }
 }
 
 int MainWindow::magnitude(double y)
@@ -967,8 +1402,11 @@ void MainWindow::changeProfile(QListWidgetItem *item)
      * changeProfile that can be queried by propertyChanged, and if it is set
      * drawCharts should not the called. The flag should be reset immediately
      * after contral is returned from drawCharts here...
+     *
+     * Changing profile only changes which properties are shown, so the charts
+     * are redrawn from the recorded values without running the model again.
      */
-    Domain::drawCharts(propertyList);
+    redrawCharts();
 
     changing_profile = false;
 
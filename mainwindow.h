@@ -3,6 +3,7 @@
 
 
 #include <string.h>
+#include <atomic>
 
 #include <QMainWindow>
 #include "parameterwizard.h"
@@ -22,6 +23,12 @@
 
 #include "statsdialog.h"
 
+class Domain;
+class TimingDialog;
+class QProgressBar;
+class QThread;
+class SimulationRunner;
+
 #define QT_DEBUG
 
 namespace Ui {
@@ -80,6 +87,11 @@ protected:
     // Domain *getDomain(QString);
 
     int loadDomains(QListWidget *domainList);
+
+    /*
+     * Create an MDI subwindow holding a new chart for the domain
+     */
+    QMdiSubWindow *createChartWindow(Domain *dom);
     // int loadDomainList();
     int loadProfileList();
 
@@ -87,6 +99,8 @@ protected:
     int getPeriod();
 
     void saveCSV();
+    void exportFinished();
+    void openResults();
     void editParameters();
     void createDomain();
     void createProfile();
@@ -101,8 +115,11 @@ protected:
     void errorMessage [[noreturn]] (QString);
 
     void setOptions();
+    void editDerivedProperties();
     void showWiki();
     void showStatistics();  // will replace showStats()
+    void showTimings();
+    void recordTimings(bool record);
     //void showStats(QListWidgetItem *current, QListWidgetItem *prev);
     void updateStatsDialog(QListWidgetItem *current/*, QListWidgetItem *previous*/);
 
@@ -120,6 +137,7 @@ protected:
     QMenu *helpMenu;
 
     QAction *saveCSVAction;
+    QAction *openResultsAction;
     QAction *saveProfileAction;
     QAction *removeProfileAction;
     QAction *changeAction;
@@ -127,9 +145,13 @@ protected:
     QAction *aboutAction;
     QAction *aboutQtAction;
     QAction *setOptionsAction;
+    QAction *derivedAction;
     QAction *helpAction;
     QAction *statsAction;
+    QAction *timingsAction;
+    QAction *recordTimingsAction;
     QAction *runAction;
+    QAction *cancelAction;
     QAction *randomAction;
     QAction *closeAction;
 
@@ -148,6 +170,7 @@ private:
     QString chartProfile;
 
     StatsDialog *statsDialog;
+    TimingDialog *timingDialog;
 
     bool first_time_shown;
     bool first_time_loaded;
@@ -167,6 +190,12 @@ private:
     void createStatusBar();
     void createDockWindows();
 
+    /*
+     * Replace the derived properties at the end of the property list with
+     * the current ones, keeping the check marks of any that are still there
+     */
+    void updateDerivedItems();
+
     int createSubWindows();
 
     /*
@@ -174,6 +203,10 @@ private:
     void drawChartRandomised();
     */
     void drawChartNormal();
+    void redrawCharts();
+    void cancelRun();
+    void showProgress(int periods_done, int periods_total);
+    void runFinished(bool cancelled);
     void selectProfile(QString text);
     //void changeBehaviour(QListWidgetItem*);
     void changeProfile(QListWidgetItem*);
@@ -196,6 +229,17 @@ private:
     QLabel *productivityLabel;
     QLabel *inequalityLabel;
     QLabel *infoLabel;
+    QProgressBar *progressBar;
+
+    SimulationRunner *runner;
+
+    /*
+     * The export in progress, if any (see saveCSV), and its outcome
+     */
+    QThread *exportThread = nullptr;
+    std::atomic<bool> export_cancelled;
+    bool export_ok = false;
+    QString export_error;
 
     enum Opr
     {
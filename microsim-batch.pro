@@ -0,0 +1,28 @@
+#-------------------------------------------------
+#
+# Headless batch runner. Builds the simulation engine against QtCore only, so
+# it can be run on machines without a display (or without QtCharts and
+# QtWidgets installed). See batch.cpp for usage.
+#
+#-------------------------------------------------
+
+QT      -= gui
+QT      += core
+
+TARGET = obson-batch
+TEMPLATE = app
+
+CONFIG += c++17 console
+CONFIG -= app_bundle
+
+DEFINES += QT_DEPRECATED_WARNINGS
+DEFINES += MICROSIM_HEADLESS
+# DEFINES += QT_NO_DEBUG_OUTPUT
+
+include(engine.pri)
+
+SOURCES += \
+    batch.cpp
+
+HEADERS += \
+    version.h
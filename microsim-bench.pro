@@ -0,0 +1,29 @@
+#-------------------------------------------------
+#
+# Engine benchmarks. Like the batch runner, builds the simulation engine
+# against QtCore only. See bench.cpp for usage.
+#
+#-------------------------------------------------
+
+QT      -= gui
+QT      += core
+
+TARGET = obson-bench
+TEMPLATE = app
+
+CONFIG += c++17 console release
+CONFIG -= app_bundle
+
+DEFINES += QT_DEPRECATED_WARNINGS
+DEFINES += MICROSIM_HEADLESS
+
+# Debug output and logging below warnings would distort the timings
+DEFINES += QT_NO_DEBUG_OUTPUT
+
+include(engine.pri)
+
+SOURCES += \
+    bench.cpp
+
+HEADERS += \
+    version.h
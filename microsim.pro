@@ -12,7 +12,7 @@ greaterThan(QT_MAJOR_VERSION, 4): QT += widgets
 TARGET = Obson
 TEMPLATE = app
 
-CONFIG += c++11
+CONFIG += c++17
 # CONFIG -= app_bundle
 
 # The following define makes your compiler emit warnings if you use
@@ -31,48 +31,52 @@ DEFINES += QT_DEPRECATED_WARNINGS
 # https://stackoverflow.com/questions/52385658/no-such-sysroot-directory-while-building-qt-project)
 # QMAKE_MAC_SDK = macosx10.14
 
+# The simulation engine (Domain and the Account hierarchy) is shared with the
+# headless batch runner (microsim-batch.pro)
+include(engine.pri)
 
 SOURCES += \
-    domain.cpp \
     createdomaindlg.cpp \
+    derivedpropertiesdialog.cpp \
     domainparametersdialog.cpp \
     main.cpp \
     mainwindow.cpp \
     newbehaviourldlg.cpp \
     parameterwizard.cpp \
-    account.cpp \
-    worker.cpp \
-    firm.cpp \
-    government.cpp \
-    bank.cpp \
     optionsdialog.cpp \
     removemodeldlg.cpp \
     saveprofiledialog.cpp \
+    simulationrunner.cpp \
     statsdialog.cpp \
+    timingdialog.cpp \
     removeprofiledialog.cpp
 
 HEADERS += \
     createdomaindlg.h \
+    derivedpropertiesdialog.h \
     domainparametersdialog.h \
     mainwindow.h \
     newbehaviourldlg.h \
     parameterwizard.h \
-    account.h \
     optionsdialog.h \
     removemodeldlg.h \
     version.h \
     saveprofiledialog.h \
+    simulationrunner.h \
     statsdialog.h \
+    timingdialog.h \
     removeprofiledialog.h
 
 FORMS += \
     createdomaindlg.ui \
+    derivedpropertiesdialog.ui \
     domainparametersdialog.ui \
     newbehaviourdlg.ui \
     optionsdialog.ui \
     removemodeldlg.ui \
     saveprofiledialog.ui \
     statsdialog.ui \
+    timingdialog.ui \
     removeprofiledialog.ui
 
 DISTFILES += \
@@ -23,6 +23,11 @@ OptionsDialog::OptionsDialog(QWidget *parent) :
 
     ui->lineEdit->setText(QString::number(iterations));
     ui->lineEdit_5->setText(QString::number(first));
+
+    ui->checkBox->setChecked(settings.value("inequality-mode", "exact").toString() == "approximate");
+
+    ui->lineEdit_ensemble->setText(QString::number(settings.value("ensemble-size", 1).toInt()));
+    ui->lineEdit_tolerance->setText(QString::number(settings.value("ensemble-tolerance", 0).toDouble()));
 }
 
 OptionsDialog::~OptionsDialog()
@@ -49,6 +54,9 @@ void OptionsDialog::accept()
 
     settings.setValue("iterations", iterations);
     settings.setValue("start-period", first);
+    settings.setValue("inequality-mode", ui->checkBox->isChecked() ? "approximate" : "exact");
+    settings.setValue("ensemble-size", qMax(1, ui->lineEdit_ensemble->text().toInt()));
+    settings.setValue("ensemble-tolerance", qMax(0.0, ui->lineEdit_tolerance->text().toDouble()));
 
     QDialog::accept();
 }
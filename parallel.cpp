@@ -0,0 +1,24 @@
+#include "parallel.h"
+
+static thread_local bool in_parallel_region = false;
+
+int Parallel::idealThreadCount()
+{
+    return std::max(1, int(std::thread::hardware_concurrency()));
+}
+
+bool Parallel::nested()
+{
+    return in_parallel_region;
+}
+
+Parallel::Region::Region()
+{
+    was_nested = in_parallel_region;
+    in_parallel_region = true;
+}
+
+Parallel::Region::~Region()
+{
+    in_parallel_region = was_nested;
+}
@@ -0,0 +1,95 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+/******************************************************************************
+ * Simple helpers for running independent pieces of work on several threads.
+ * These use std::thread rather than QThreadPool so that they can be used by
+ * the engine in the headless build as well as by the GUI.
+ *
+ * A call to parallelFor made from inside another parallelFor (e.g. a domain
+ * running in parallel with other domains and then sorting its wages) runs
+ * serially on the calling thread, so the machine is never oversubscribed.
+ ******************************************************************************/
+
+namespace Parallel
+{
+    /*
+     * Number of threads to use for parallel work (at least 1)
+     */
+    int idealThreadCount();
+
+    /*
+     * True if the calling thread is already running work for parallelFor
+     */
+    bool nested();
+
+    /*
+     * Marks the calling thread as running parallel work for as long as it
+     * exists
+     */
+    class Region
+    {
+    public:
+        Region();
+        ~Region();
+    private:
+        bool was_nested;
+    };
+}
+
+/*
+ * Call f(i) for every i from 0 to n-1, using up to max_threads threads
+ * (default: Parallel::idealThreadCount()). The calls may be made in any order
+ * and on any thread, but parallelFor does not return until all of them have
+ * completed. The calling thread does its share of the work.
+ */
+template <typename F>
+void parallelFor(int n, F f, int max_threads = 0)
+{
+    if (max_threads <= 0)
+    {
+        max_threads = Parallel::idealThreadCount();
+    }
+
+    int threads = std::min(n, max_threads);
+
+    if (threads <= 1 || Parallel::nested())
+    {
+        for (int i = 0; i < n; i++)
+        {
+            f(i);
+        }
+        return;
+    }
+
+    std::atomic<int> next(0);
+
+    auto work = [&]() {
+        Parallel::Region region;
+        int i;
+        while ((i = next++) < n)
+        {
+            f(i);
+        }
+    };
+
+    std::vector<std::thread> pool;
+    for (int t = 1; t < threads; t++)
+    {
+        pool.emplace_back(work);
+    }
+
+    work();
+
+    for (std::thread &th : pool)
+    {
+        th.join();
+    }
+}
+
+#endif // PARALLEL_H
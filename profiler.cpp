@@ -0,0 +1,288 @@
+#include "profiler.h"
+
+#include <QSaveFile>
+
+#include <chrono>
+
+/*
+ * The trace is built up in a buffer of about this size, which is written to
+ * the device whenever it fills up
+ */
+#define TRACE_BUFFER_BYTES (1 << 20)
+
+std::atomic<bool> Profiler::enabled(false);
+
+/******************************************************************************
+ * PeriodProfile and ProfileSummary
+ ******************************************************************************/
+
+qint64 PeriodProfile::duration() const
+{
+    qint64 total = 0;
+    for (qint64 t : phases)
+    {
+        total += t;
+    }
+    return total;
+}
+
+ProfileSummary::ProfileSummary(const QVector<PeriodProfile> &profiles)
+{
+    periods = profiles.count();
+    for (const PeriodProfile &profile : profiles)
+    {
+        for (int i = 0; i < int(ProfilePhase::num_phases); i++)
+        {
+            phases[i] += profile.phases[i];
+        }
+        for (int i = 0; i < int(ProfileCounter::num_counters); i++)
+        {
+            counts[i] += profile.counts[i];
+        }
+    }
+}
+
+qint64 ProfileSummary::duration() const
+{
+    qint64 total = 0;
+    for (qint64 t : phases)
+    {
+        total += t;
+    }
+    return total;
+}
+
+/******************************************************************************
+ * Profiler
+ ******************************************************************************/
+
+void Profiler::setEnabled(bool enabled)
+{
+    Profiler::enabled.store(enabled, std::memory_order_relaxed);
+}
+
+QString Profiler::phaseName(ProfilePhase phase)
+{
+    switch (phase)
+    {
+    case ProfilePhase::initialisation:
+        return "initialisation";
+    case ProfilePhase::government:
+        return "government";
+    case ProfilePhase::firms:
+        return "firms";
+    case ProfilePhase::workers:
+        return "workers";
+    case ProfilePhase::firm_epilogue:
+        return "firm epilogue";
+    case ProfilePhase::worker_epilogue:
+        return "worker epilogue";
+    case ProfilePhase::inequality:
+        return "inequality";
+    case ProfilePhase::record:
+        return "record";
+    case ProfilePhase::exogenous:
+        return "exogenous";
+    default:
+        return "?";
+    }
+}
+
+QString Profiler::counterName(ProfileCounter counter)
+{
+    switch (counter)
+    {
+    case ProfileCounter::transactions:
+        return "transactions";
+    case ProfileCounter::hires:
+        return "hires";
+    case ProfileCounter::fires:
+        return "fires";
+    case ProfileCounter::loans:
+        return "loans";
+    default:
+        return "?";
+    }
+}
+
+qint64 Profiler::now()
+{
+    using namespace std::chrono;
+    static const steady_clock::time_point epoch = steady_clock::now();
+    return duration_cast<nanoseconds>(steady_clock::now() - epoch).count();
+}
+
+void Profiler::clear()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    periods.clear();
+}
+
+void Profiler::beginPeriod(int period)
+{
+    current = PeriodProfile();
+    current.period = period;
+
+    active = isEnabled();
+    if (active)
+    {
+        current.start = phase_start = now();
+    }
+}
+
+void Profiler::endPeriod()
+{
+    if (active)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        periods.append(current);
+    }
+    active = false;
+}
+
+QVector<PeriodProfile> Profiler::snapshot() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return periods;
+}
+
+/******************************************************************************
+ * TraceWriter
+ ******************************************************************************/
+
+/*
+ * A time in nanoseconds as microseconds (the unit of the format) to three
+ * decimal places
+ */
+static QByteArray micros(qint64 ns)
+{
+    QByteArray frac = QByteArray::number(ns % 1000);
+    return QByteArray::number(ns / 1000) + "." + QByteArray(3 - frac.size(), '0')
+            + frac;
+}
+
+/*
+ * A string as a JSON string literal
+ */
+static QByteArray jsonString(const QString &s)
+{
+    QByteArray out = "\"";
+    foreach (char c, s.toUtf8())
+    {
+        switch (c)
+        {
+        case '"':
+            out += "\\\"";
+            break;
+        case '\\':
+            out += "\\\\";
+            break;
+        default:
+            if (uchar(c) < 0x20)
+            {
+                out += "\\u00" + QByteArray::number(uchar(c), 16).rightJustified(2, '0');
+            }
+            else
+            {
+                out += c;
+            }
+        }
+    }
+    out += "\"";
+    return out;
+}
+
+void TraceWriter::addDomain(const QString &name, const QVector<PeriodProfile> &profiles)
+{
+    entries.append({name, profiles});
+}
+
+bool TraceWriter::write(const QString &fileName, QString &error)
+{
+    QSaveFile file(fileName);
+    if (!file.open(QIODevice::WriteOnly))
+    {
+        error = "Cannot open " + fileName + " for writing";
+        return false;
+    }
+
+    if (!write(&file) || !file.commit())
+    {
+        error = "Error writing " + fileName;
+        return false;
+    }
+    return true;
+}
+
+bool TraceWriter::write(QIODevice *device)
+{
+    QByteArray out;
+    out.reserve(TRACE_BUFFER_BYTES + 4096);
+    out += "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+
+    bool ok = true;
+    bool first = true;
+
+    auto event = [&](const QByteArray &json) {
+        if (!first)
+        {
+            out += ",\n";
+        }
+        out += json;
+        first = false;
+
+        if (out.size() >= TRACE_BUFFER_BYTES)
+        {
+            ok = ok && device->write(out) == out.size();
+            out.clear();
+        }
+    };
+
+    for (int d = 0; d < entries.count(); d++)
+    {
+        const Entry &entry = entries[d];
+        const QByteArray pid = QByteArray::number(d + 1);
+        const QByteArray ids = "\"pid\":" + pid + ",\"tid\":1";
+
+        event("{\"name\":\"process_name\",\"ph\":\"M\"," + ids
+              + ",\"args\":{\"name\":" + jsonString(entry.name) + "}}");
+        event("{\"name\":\"thread_name\",\"ph\":\"M\"," + ids
+              + ",\"args\":{\"name\":\"iterate\"}}");
+
+        for (const PeriodProfile &profile : entry.profiles)
+        {
+            const QByteArray period = QByteArray::number(profile.period);
+
+            event("{\"name\":\"period " + period
+                  + "\",\"cat\":\"period\",\"ph\":\"X\",\"ts\":"
+                  + micros(profile.start) + ",\"dur\":" + micros(profile.duration())
+                  + "," + ids + ",\"args\":{\"period\":" + period + "}}");
+
+            /*
+             * The phases follow each other without a gap
+             */
+            qint64 t = profile.start;
+            for (int i = 0; i < int(ProfilePhase::num_phases); i++)
+            {
+                event("{\"name\":"
+                      + jsonString(Profiler::phaseName(ProfilePhase(i)))
+                      + ",\"cat\":\"phase\",\"ph\":\"X\",\"ts\":" + micros(t)
+                      + ",\"dur\":" + micros(profile.phases[i]) + "," + ids + "}");
+                t += profile.phases[i];
+            }
+
+            for (int i = 0; i < int(ProfileCounter::num_counters); i++)
+            {
+                event("{\"name\":"
+                      + jsonString(Profiler::counterName(ProfileCounter(i)))
+                      + ",\"ph\":\"C\",\"ts\":" + micros(profile.start) + ","
+                      + ids + ",\"args\":{\"value\":"
+                      + QByteArray::number(profile.counts[i]) + "}}");
+            }
+        }
+    }
+
+    out += "\n]}\n";
+    ok = ok && device->write(out) == out.size();
+    return ok;
+}
@@ -0,0 +1,186 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <QIODevice>
+#include <QList>
+#include <QString>
+#include <QVector>
+
+#include <atomic>
+#include <mutex>
+
+/******************************************************************************
+ * Timings and counts for each phase of Domain::iterate.
+ *
+ * Each domain has a Profiler (see Domain::profiler). While profiling is
+ * enabled (see Profiler::setEnabled) it records, for every period the domain
+ * runs, how long each phase took and how many transactions, hires, fires and
+ * loans there were. When it is disabled the counts are still kept (each is
+ * just an increment of an integer) but nothing is timed or recorded, so the
+ * cost is a test of a flag per period.
+ *
+ * Times are measured with a steady clock from an epoch shared by all the
+ * domains, so the periods of domains run on different threads can be laid out
+ * on a common timeline. The records can be written as a trace (see
+ * TraceWriter) for viewing in chrome://tracing or Perfetto.
+ ******************************************************************************/
+
+/*
+ * The phases of Domain::iterate, in the order they are run
+ */
+enum class ProfilePhase
+{
+    initialisation,     // resetting counters (and agents, in period 0)
+    government,         // triggering the government
+    firms,              // triggering the firms
+    workers,            // triggering the workers (purchasePhase)
+    firm_epilogue,
+    worker_epilogue,    // updating average wages
+    inequality,         // Gini coefficient, mean and spread
+    record,             // recording the properties
+    exogenous,          // creating new firms
+
+    num_phases          // must be last
+};
+
+enum class ProfileCounter
+{
+    transactions,       // payments between accounts, and worker purchases
+    hires,
+    fires,
+    loans,
+
+    num_counters        // must be last
+};
+
+/*
+ * What happened in one period of one domain. Times are in nanoseconds, start
+ * being from Profiler's epoch.
+ */
+struct PeriodProfile
+{
+    int period = 0;
+    qint64 start = 0;
+    qint64 phases[int(ProfilePhase::num_phases)] = {};
+    qint64 counts[int(ProfileCounter::num_counters)] = {};
+
+    qint64 duration() const;
+};
+
+/*
+ * Totals over a number of periods
+ */
+struct ProfileSummary
+{
+    int periods = 0;
+    qint64 phases[int(ProfilePhase::num_phases)] = {};
+    qint64 counts[int(ProfileCounter::num_counters)] = {};
+
+    ProfileSummary(const QVector<PeriodProfile> &profiles = {});
+
+    qint64 duration() const;
+};
+
+class Profiler
+{
+public:
+
+    static void setEnabled(bool enabled);
+
+    static bool isEnabled()
+    {
+        return enabled.load(std::memory_order_relaxed);
+    }
+
+    static QString phaseName(ProfilePhase phase);
+    static QString counterName(ProfileCounter counter);
+
+    /*
+     * Nanoseconds since the epoch
+     */
+    static qint64 now();
+
+    /*
+     * Forget the periods recorded so far
+     */
+    void clear();
+
+    /*
+     * Start a period, resetting the counts. The first phase starts now.
+     */
+    void beginPeriod(int period);
+
+    /*
+     * End the phase in progress, starting the next one
+     */
+    void endPhase(ProfilePhase phase)
+    {
+        if (active)
+        {
+            qint64 t = now();
+            current.phases[int(phase)] += t - phase_start;
+            phase_start = t;
+        }
+    }
+
+    /*
+     * End the period and (if profiling was enabled when it began) record it
+     */
+    void endPeriod();
+
+    void count(ProfileCounter counter, qint64 n = 1)
+    {
+        current.counts[int(counter)] += n;
+    }
+
+    /*
+     * A copy of the periods recorded so far, which may be taken on any thread
+     * while the domain is running
+     */
+    QVector<PeriodProfile> snapshot() const;
+
+private:
+
+    static std::atomic<bool> enabled;
+
+    bool active = false;
+    qint64 phase_start = 0;
+    PeriodProfile current;
+
+    QVector<PeriodProfile> periods;
+    mutable std::mutex mutex;
+};
+
+/******************************************************************************
+ * TraceWriter writes the profiles of any number of domains in the Trace Event
+ * Format read by chrome://tracing and Perfetto. Each domain appears as a
+ * process with a single thread, on which each period is a slice containing a
+ * slice for each phase, and the counts for each period are shown as counter
+ * tracks.
+ ******************************************************************************/
+
+class TraceWriter
+{
+public:
+
+    void addDomain(const QString &name, const QVector<PeriodProfile> &profiles);
+
+    /*
+     * Write the trace to the given file, replacing it only if the whole trace
+     * has been written. On failure, returns false and sets error.
+     */
+    bool write(const QString &fileName, QString &error);
+    bool write(QIODevice *device);
+
+private:
+
+    struct Entry
+    {
+        QString name;
+        QVector<PeriodProfile> profiles;
+    };
+
+    QList<Entry> entries;
+};
+
+#endif // PROFILER_H
@@ -0,0 +1,101 @@
+#ifndef RANDOMSTREAM_H
+#define RANDOMSTREAM_H
+
+#include <QtGlobal>
+
+/******************************************************************************
+ * RandomStream is a counter-based random number generator. Rather than
+ * holding state that is changed by every draw, each stream is identified by a
+ * key made from the run's seed, the domain, the period, the agent making the
+ * draw and the purpose of the draw, and the n'th number in the stream is a
+ * function of the key and n only (the SplitMix64 finaliser applied to the key
+ * plus n times a constant).
+ *
+ * This means that any agent can draw its own numbers on any thread, in any
+ * order relative to other agents, and still get the same numbers on every
+ * run with the same seed. Use Domain::randomStream to get a stream.
+ ******************************************************************************/
+
+class RandomStream
+{
+public:
+
+    /*
+     * What the numbers are to be used for. Draws made by the same agent in the
+     * same period for different purposes come from different streams, so
+     * adding a new kind of draw doesn't change the existing ones.
+     */
+    enum class Purpose : quint32
+    {
+        purchase,           // worker choosing a firm to buy from
+        procurement,        // government choosing a firm to buy from
+        supplier,           // firm choosing a supplier of capital equipment
+        bank,               // choice of bank
+        loan_approval,      // bank deciding whether to lend
+        firm_creation       // domain deciding whether to create a firm
+    };
+
+    RandomStream(quint64 seed, quint64 domain, int period, quint64 agent,
+                 Purpose purpose)
+    {
+        key = mix(seed);
+        key = mix(key ^ domain);
+        key = mix(key ^ quint64(quint32(period)));
+        key = mix(key ^ agent);
+        key = mix(key ^ quint64(purpose));
+    }
+
+    /*
+     * The next 64 random bits
+     */
+    quint64 next()
+    {
+        return mix(key + (++counter) * GOLDEN_GAMMA);
+    }
+
+    /*
+     * A uniformly distributed integer from 0 to n - 1 (n > 0), without the
+     * bias of next() % n. This is Lemire's multiply-and-reject method, which
+     * only needs to draw again in a fraction n / 2^32 of cases.
+     */
+    quint32 bounded(quint32 n)
+    {
+        quint64 m = quint64(quint32(next() >> 32)) * n;
+        quint32 low = quint32(m);
+        if (low < n)
+        {
+            quint32 threshold = quint32(-n) % n;
+            while (low < threshold)
+            {
+                m = quint64(quint32(next() >> 32)) * n;
+                low = quint32(m);
+            }
+        }
+        return quint32(m >> 32);
+    }
+
+    /*
+     * A uniformly distributed double in [0, 1)
+     */
+    double uniform()
+    {
+        return double(next() >> 11) * (1.0 / 9007199254740992.0);   // 2^53
+    }
+
+private:
+
+    static const quint64 GOLDEN_GAMMA = Q_UINT64_C(0x9e3779b97f4a7c15);
+
+    quint64 key;
+    quint64 counter = 0;
+
+    static quint64 mix(quint64 z)
+    {
+        z += GOLDEN_GAMMA;
+        z = (z ^ (z >> 30)) * Q_UINT64_C(0xbf58476d1ce4e5b9);
+        z = (z ^ (z >> 27)) * Q_UINT64_C(0x94d049bb133111eb);
+        return z ^ (z >> 31);
+    }
+};
+
+#endif // RANDOMSTREAM_H
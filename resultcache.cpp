@@ -0,0 +1,186 @@
+#include "resultcache.h"
+#include "log.h"
+
+#include <QDateTime>
+#include <QDebug>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QSettings>
+#include <QStandardPaths>
+
+#include <string.h>
+
+#define RESULT_CACHE_FORMAT 1
+#define RESULT_CACHE_BYTE_ORDER 0x01020304
+#define RESULT_CACHE_SUFFIX ".obr"
+
+ResultCache::ResultCache(const QString &directory)
+{
+    this->directory = directory.isEmpty() ? defaultDirectory() : directory;
+
+    QSettings settings;
+    max_bytes = settings.value("result-cache-mb", 256).toLongLong() * 1024 * 1024;
+}
+
+QString ResultCache::defaultDirectory()     // static
+{
+    return QStandardPaths::writableLocation(QStandardPaths::AppDataLocation)
+            + "/result-cache";
+}
+
+void ResultCache::setMaxBytes(qint64 max_bytes)
+{
+    this->max_bytes = max_bytes;
+}
+
+bool ResultCache::isEnabled() const
+{
+    return max_bytes > 0;
+}
+
+QString ResultCache::fileName(const QByteArray &key) const
+{
+    return directory + "/" + QString::fromLatin1(key.toHex()) + RESULT_CACHE_SUFFIX;
+}
+
+bool ResultCache::load(const QByteArray &key, PropertyRecord &record) const
+{
+    if (!isEnabled())
+    {
+        return false;
+    }
+
+    QFile file(fileName(key));
+    if (!file.open(QIODevice::ReadWrite))
+    {
+        return false;
+    }
+
+    const qint64 size = file.size();
+    if (size < qint64(sizeof(Header)))
+    {
+        return false;
+    }
+
+    uchar *data = file.map(0, size);
+    if (data == nullptr)
+    {
+        return false;
+    }
+
+    Header header;
+    memcpy(&header, data, sizeof(Header));
+
+    const int num_properties = int(Property::num_properties);
+    bool ok = memcmp(header.magic, "OBRC", 4) == 0
+            && header.byte_order == RESULT_CACHE_BYTE_ORDER
+            && header.format == RESULT_CACHE_FORMAT
+            && header.properties == quint32(num_properties)
+            && size == qint64(sizeof(Header))
+                       + qint64(header.properties) * header.periods * qint64(sizeof(double));
+
+    if (ok)
+    {
+        const int periods = int(header.periods);
+        const uchar *values = data + sizeof(Header);
+
+        record.first_period = header.first_period;
+        for (int i = 0; i < num_properties; i++)
+        {
+            QVector<double> &column = record.columns[i];
+            column.resize(periods);
+            memcpy(column.data(), values + qint64(i) * periods * qint64(sizeof(double)),
+                   size_t(periods) * sizeof(double));
+        }
+
+        /*
+         * Mark the record as recently used (see evict)
+         */
+        file.setFileTime(QDateTime::currentDateTimeUtc(),
+                         QFileDevice::FileModificationTime);
+    }
+    else
+    {
+        LOG_WARNING(LogCategory::runs) << "ResultCache: ignoring invalid file" << file.fileName();
+    }
+
+    file.unmap(data);
+    return ok;
+}
+
+bool ResultCache::store(const QByteArray &key, const PropertyRecord &record)
+{
+    if (!isEnabled() || !QDir().mkpath(directory))
+    {
+        return false;
+    }
+
+    const int num_properties = int(Property::num_properties);
+    const int periods = record.count();
+
+    Header header;
+    memcpy(header.magic, "OBRC", 4);
+    header.byte_order = RESULT_CACHE_BYTE_ORDER;
+    header.format = RESULT_CACHE_FORMAT;
+    header.properties = quint32(num_properties);
+    header.periods = quint32(periods);
+    header.first_period = record.first_period;
+
+    QString name = fileName(key);
+    QFile file(name + ".tmp");
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate))
+    {
+        return false;
+    }
+
+    bool ok = file.write(reinterpret_cast<const char *>(&header), sizeof(Header))
+            == qint64(sizeof(Header));
+
+    for (int i = 0; ok && i < num_properties; i++)
+    {
+        const QVector<double> &column = record.columns[i];
+        qint64 bytes = qint64(periods) * qint64(sizeof(double));
+        ok = column.count() == periods
+                && file.write(reinterpret_cast<const char *>(column.constData()), bytes)
+                   == bytes;
+    }
+
+    file.close();
+
+    /*
+     * QFile::rename won't replace an existing file, but an existing file
+     * under the same name holds the same record
+     */
+    if (!ok || (!QFile::rename(file.fileName(), name) && !QFile::exists(name)))
+    {
+        QFile::remove(file.fileName());
+        return false;
+    }
+    QFile::remove(file.fileName());
+
+    evict();
+    return true;
+}
+
+void ResultCache::evict()
+{
+    QDir dir(directory);
+    QFileInfoList files = dir.entryInfoList(QStringList("*" RESULT_CACHE_SUFFIX),
+                                            QDir::Files, QDir::Time);
+
+    /*
+     * Files are listed most recently used first, so keep them until the limit
+     * is reached and delete the rest
+     */
+    qint64 total = 0;
+    foreach (const QFileInfo &info, files)
+    {
+        total += info.size();
+        if (total > max_bytes)
+        {
+            LOG_DEBUG(LogCategory::runs) << "ResultCache: evicting" << info.fileName();
+            QFile::remove(info.absoluteFilePath());
+        }
+    }
+}
@@ -0,0 +1,85 @@
+#ifndef RESULTCACHE_H
+#define RESULTCACHE_H
+
+#include "account.h"
+
+#include <QByteArray>
+#include <QString>
+
+/******************************************************************************
+ * ResultCache keeps the records of earlier runs (see Domain::recorded) on
+ * disk, so that a run that has been made before, with exactly the same
+ * configuration, doesn't have to be made again (e.g. after restarting the
+ * program or undoing a parameter change). Each record is kept in its own file,
+ * named after the run's hash (see Domain::runHash), under the application data
+ * directory.
+ *
+ * A file holds a small header followed by the columns of the record as raw
+ * doubles, one after the other, in the machine's byte order. It is read by
+ * mapping it into memory, so a hit costs little more than copying the values.
+ *
+ * The total size of the cache is limited (see setMaxBytes). When a new record
+ * takes it over the limit, the least recently used records are deleted.
+ * Using a record updates its file's modification time, which is what is used
+ * to order them.
+ *
+ * Files are written under a temporary name and then renamed, so records can
+ * be stored and read on several threads at once.
+ ******************************************************************************/
+
+class ResultCache
+{
+public:
+
+    /*
+     * Use the given directory, or the default one (see defaultDirectory) if
+     * none is given. The size limit is read from settings ("result-cache-mb",
+     * default 256). A limit of zero disables the cache.
+     */
+    ResultCache(const QString &directory = QString());
+
+    static QString defaultDirectory();
+
+    void setMaxBytes(qint64 max_bytes);
+    bool isEnabled() const;
+
+    /*
+     * Read the record stored under the given key. Returns false if there is
+     * no such record or it can't be read.
+     */
+    bool load(const QByteArray &key, PropertyRecord &record) const;
+
+    /*
+     * Store a record under the given key, evicting older records if
+     * necessary. Returns false if the record couldn't be written.
+     */
+    bool store(const QByteArray &key, const PropertyRecord &record);
+
+private:
+
+    /*
+     * The file header. Properties and periods give the size of the data.
+     */
+    struct Header
+    {
+        char magic[4];
+        quint32 byte_order;
+        quint32 format;
+        quint32 properties;
+        quint32 periods;
+        qint32 first_period;
+    };
+
+    QString directory;
+    qint64 max_bytes;
+
+    QString fileName(const QByteArray &key) const;
+
+    /*
+     * Delete the least recently used records until the total size is within
+     * the limit
+     */
+    void evict();
+};
+
+#endif // RESULTCACHE_H
@@ -0,0 +1,536 @@
+#include "resultfile.h"
+
+#include <string.h>
+
+#define RESULT_FILE_FORMAT 1
+#define RESULT_FILE_BYTE_ORDER 0x01020304
+
+/******************************************************************************
+ * ResultFileWriter
+ ******************************************************************************/
+
+ResultFileWriter::ResultFileWriter(ResultValueType type)
+{
+    this->type = type;
+}
+
+ResultFileWriter::~ResultFileWriter()
+{
+    if (file.isOpen())
+    {
+        file.cancelWriting();
+    }
+}
+
+bool ResultFileWriter::open(const QString &fileName, QString &error)
+{
+    file.setFileName(fileName);
+    if (!file.open(QIODevice::WriteOnly))
+    {
+        error = "Cannot open " + fileName + " for writing";
+        return false;
+    }
+
+    putRaw("OBRF", 4);
+    put(quint32(RESULT_FILE_BYTE_ORDER));
+    put(quint32(RESULT_FILE_FORMAT));
+    put(quint32(type));
+
+    return ok;
+}
+
+void ResultFileWriter::putRaw(const void *data, qint64 bytes)
+{
+    if (ok && bytes > 0)
+    {
+        ok = file.write(static_cast<const char *>(data), bytes) == bytes;
+    }
+}
+
+void ResultFileWriter::putString(const QString &s)
+{
+    QByteArray utf8 = s.toUtf8();
+    put(quint32(utf8.size()));
+    putRaw(utf8.constData(), utf8.size());
+}
+
+/*
+ * Pad to an 8-byte boundary, so that the values in a mapped file are aligned
+ */
+void ResultFileWriter::align()
+{
+    static const char zeros[8] = {};
+    qint64 pos = file.pos();
+    if (pos % 8 != 0)
+    {
+        putRaw(zeros, 8 - pos % 8);
+    }
+}
+
+void ResultFileWriter::beginRun(const ResultRunInfo &info)
+{
+    Q_ASSERT(!in_run);
+
+    Run run;
+    run.offset = quint64(file.pos());
+    run.first_period = info.first_period;
+    run.periods = 0;
+    runs.append(run);
+
+    putString(info.name);
+    put(quint64(info.seed));
+    put(qint32(info.first_period));
+
+    put(quint32(info.parameters.count()));
+    for (auto it = info.parameters.constBegin(); it != info.parameters.constEnd(); ++it)
+    {
+        putString(it.key());
+        put(qint32(it.value()));
+    }
+
+    put(quint32(info.properties.count()));
+    foreach (const QString &name, info.properties)
+    {
+        putString(name);
+    }
+
+    pending.fill(QVector<double>(), info.properties.count());
+    for (QVector<double> &values : pending)
+    {
+        values.reserve(RESULT_CHUNK_PERIODS);
+    }
+
+    in_run = true;
+}
+
+void ResultFileWriter::addPeriod(const double *values)
+{
+    Q_ASSERT(in_run);
+
+    for (int p = 0; p < pending.count(); p++)
+    {
+        pending[p].append(values[p]);
+    }
+    runs.last().periods++;
+
+    if (!pending.isEmpty() && pending[0].count() == RESULT_CHUNK_PERIODS)
+    {
+        writeChunks();
+    }
+}
+
+/*
+ * Write the pending values of each property as a chunk
+ */
+void ResultFileWriter::writeChunks()
+{
+    Run &run = runs.last();
+
+    if (pending.isEmpty() || pending[0].isEmpty())
+    {
+        return;
+    }
+
+    const int count = pending[0].count();
+    const quint32 first = run.periods - quint32(count);
+
+    for (int p = 0; p < pending.count(); p++)
+    {
+        align();
+
+        Chunk chunk;
+        chunk.property = quint32(p);
+        chunk.first = first;
+        chunk.count = quint32(count);
+        chunk.offset = quint64(file.pos());
+        run.chunks.append(chunk);
+
+        QVector<double> &values = pending[p];
+        if (type == ResultValueType::f64)
+        {
+            putRaw(values.constData(), qint64(count) * qint64(sizeof(double)));
+        }
+        else
+        {
+            QVector<float> narrowed(count);
+            for (int t = 0; t < count; t++)
+            {
+                narrowed[t] = float(values[t]);
+            }
+            putRaw(narrowed.constData(), qint64(count) * qint64(sizeof(float)));
+        }
+        values.clear();
+    }
+}
+
+void ResultFileWriter::endRun()
+{
+    Q_ASSERT(in_run);
+
+    writeChunks();
+    pending.clear();
+    in_run = false;
+}
+
+bool ResultFileWriter::close(QString &error)
+{
+    Q_ASSERT(!in_run);
+
+    align();
+    quint64 index_offset = quint64(file.pos());
+
+    put(quint32(runs.count()));
+    foreach (const Run &run, runs)
+    {
+        put(run.offset);
+        put(run.first_period);
+        put(run.periods);
+        put(quint32(run.chunks.count()));
+        foreach (const Chunk &chunk, run.chunks)
+        {
+            put(chunk.property);
+            put(chunk.first);
+            put(chunk.count);
+            put(chunk.offset);
+        }
+    }
+
+    put(index_offset);
+    putRaw("OBRX", 4);
+
+    if (!ok || !file.commit())
+    {
+        file.cancelWriting();
+        error = "Error writing " + file.fileName();
+        return false;
+    }
+    return true;
+}
+
+/******************************************************************************
+ * ResultFile
+ ******************************************************************************/
+
+/*
+ * Reads values from the mapped file, checking that each one is within it.
+ * After the first failure every read fails.
+ */
+class ResultReader
+{
+public:
+
+    ResultReader(const uchar *data, qint64 size, qint64 pos)
+    {
+        this->data = data;
+        this->size = size;
+        this->pos = pos;
+        ok = pos >= 0 && pos <= size;
+    }
+
+    template <typename T>
+    T get()
+    {
+        T value = T();
+        if (ok && qint64(sizeof(T)) <= size - pos)
+        {
+            memcpy(&value, data + pos, sizeof(T));
+            pos += qint64(sizeof(T));
+        }
+        else
+        {
+            ok = false;
+        }
+        return value;
+    }
+
+    QString getString()
+    {
+        quint32 length = get<quint32>();
+        if (!ok || length > size - pos)
+        {
+            ok = false;
+            return QString();
+        }
+        QString s = QString::fromUtf8(reinterpret_cast<const char *>(data + pos),
+                                      int(length));
+        pos += length;
+        return s;
+    }
+
+    const uchar *data;
+    qint64 size;
+    qint64 pos;
+    bool ok = true;
+};
+
+ResultFile::ResultFile()
+{
+}
+
+ResultFile::~ResultFile()
+{
+    close();
+}
+
+void ResultFile::close()
+{
+    if (data != nullptr)
+    {
+        file.unmap(const_cast<uchar *>(data));
+        data = nullptr;
+    }
+    file.close();
+    size = 0;
+    runs.clear();
+    chunks.clear();
+}
+
+bool ResultFile::open(const QString &fileName, QString &error)
+{
+    close();
+
+    file.setFileName(fileName);
+    if (!file.open(QIODevice::ReadOnly))
+    {
+        error = "Cannot open " + fileName;
+        return false;
+    }
+
+    size = file.size();
+    const qint64 header_size = 16, trailer_size = 12;
+    data = size >= header_size + trailer_size ? file.map(0, size) : nullptr;
+    if (data == nullptr)
+    {
+        error = fileName + " is not a results file";
+        close();
+        return false;
+    }
+
+    ResultReader header(data, size, 4);
+    bool ok = memcmp(data, "OBRF", 4) == 0
+            && header.get<quint32>() == RESULT_FILE_BYTE_ORDER
+            && header.get<quint32>() == RESULT_FILE_FORMAT;
+    quint32 value_type = header.get<quint32>();
+    ok = ok && value_type <= quint32(ResultValueType::f32)
+            && memcmp(data + size - 4, "OBRX", 4) == 0;
+
+    if (!ok)
+    {
+        error = fileName + " is not a results file, or was written by a"
+                           " different version or on a different machine";
+        close();
+        return false;
+    }
+
+    type = ResultValueType(value_type);
+    const qint64 value_size = type == ResultValueType::f64 ? 8 : 4;
+
+    ResultReader trailer(data, size, size - trailer_size);
+    ResultReader index(data, size - trailer_size, qint64(trailer.get<quint64>()));
+
+    const quint32 num_runs = index.get<quint32>();
+    for (quint32 r = 0; index.ok && r < num_runs; r++)
+    {
+        ResultRunInfo info;
+
+        ResultReader head(data, size, qint64(index.get<quint64>()));
+        info.first_period = index.get<qint32>();
+        info.periods = int(index.get<quint32>());
+        const quint32 num_chunks = index.get<quint32>();
+
+        info.name = head.getString();
+        info.seed = head.get<quint64>();
+        head.get<qint32>();     // first period, also in the index
+        const quint32 num_params = head.get<quint32>();
+        for (quint32 i = 0; head.ok && i < num_params; i++)
+        {
+            QString key = head.getString();
+            info.parameters[key] = head.get<qint32>();
+        }
+        const quint32 num_properties = head.get<quint32>();
+        for (quint32 i = 0; head.ok && i < num_properties; i++)
+        {
+            info.properties.append(head.getString());
+        }
+
+        QVector<Chunk> run_chunks;
+        for (quint32 c = 0; index.ok && c < num_chunks; c++)
+        {
+            Chunk chunk;
+            quint32 property = index.get<quint32>();
+            quint32 first = index.get<quint32>();
+            quint32 count = index.get<quint32>();
+            quint64 offset = index.get<quint64>();
+
+            if (property >= quint32(info.properties.count())
+                    || qint64(first) + count > info.periods
+                    || offset > quint64(size)
+                    || qint64(count) * value_size > size - qint64(offset))
+            {
+                index.ok = false;
+                break;
+            }
+
+            chunk.property = int(property);
+            chunk.first = int(first);
+            chunk.count = int(count);
+            chunk.data = data + offset;
+            run_chunks.append(chunk);
+        }
+
+        if (!head.ok)
+        {
+            index.ok = false;
+        }
+
+        runs.append(info);
+        chunks.append(run_chunks);
+    }
+
+    if (!index.ok || quint32(runs.count()) != num_runs)
+    {
+        error = fileName + " is damaged";
+        close();
+        return false;
+    }
+
+    return true;
+}
+
+ResultValueType ResultFile::valueType() const
+{
+    return type;
+}
+
+int ResultFile::runCount() const
+{
+    return runs.count();
+}
+
+const ResultRunInfo &ResultFile::run(int i) const
+{
+    return runs.at(i);
+}
+
+int ResultFile::propertyIndex(int i, const QString &name) const
+{
+    return runs.at(i).properties.indexOf(name);
+}
+
+bool ResultFile::read(int i, int p, int first, int count, double *values) const
+{
+    if (i < 0 || i >= runs.count() || p < 0 || p >= runs[i].properties.count()
+            || first < 0 || count < 0 || first + count > runs[i].periods)
+    {
+        return false;
+    }
+
+    /*
+     * Copy the part of each chunk of the property that overlaps the range
+     */
+    int copied = 0;
+    foreach (const Chunk &chunk, chunks[i])
+    {
+        int lo = qMax(first, chunk.first);
+        int hi = qMin(first + count, chunk.first + chunk.count);
+        if (chunk.property != p || lo >= hi)
+        {
+            continue;
+        }
+
+        if (type == ResultValueType::f64)
+        {
+            memcpy(values + (lo - first),
+                   chunk.data + size_t(lo - chunk.first) * sizeof(double),
+                   size_t(hi - lo) * sizeof(double));
+        }
+        else
+        {
+            const uchar *src = chunk.data + size_t(lo - chunk.first) * sizeof(float);
+            for (int t = lo; t < hi; t++, src += sizeof(float))
+            {
+                float value;
+                memcpy(&value, src, sizeof(float));
+                values[t - first] = double(value);
+            }
+        }
+        copied += hi - lo;
+    }
+
+    return copied == count;
+}
+
+QVector<double> ResultFile::column(int i, int p) const
+{
+    QVector<double> values(runs.at(i).periods);
+    if (!read(i, p, 0, values.count(), values.data()))
+    {
+        values.fill(0);
+    }
+    return values;
+}
+
+#ifndef RESULT_FILE_STANDALONE
+
+/******************************************************************************
+ * Domains and records
+ ******************************************************************************/
+
+ResultRunInfo ResultRunInfo::fromDomain(const Domain *dom)  // static
+{
+    ResultRunInfo info;
+
+    info.name = dom->getName();
+    info.seed = dom->randomSeed();
+    for (auto it = dom->params.constBegin(); it != dom->params.constEnd(); ++it)
+    {
+        info.parameters[Domain::parameterKeys.value(it.key())] = it.value();
+    }
+    return info;
+}
+
+void ResultFileWriter::addRecord(ResultRunInfo info, const PropertyRecord &record,
+                                 const QMap<Property,QString> &properties,
+                                 const QStringList &derived_names,
+                                 const QVector<QVector<double>> &derived)
+{
+    Q_ASSERT(derived.count() == derived_names.count());
+
+    info.first_period = record.first_period;
+    info.properties = properties.values() + derived_names;
+    beginRun(info);
+
+    const QList<Property> selected = properties.keys();
+    QVector<double> values(selected.count() + derived.count());
+
+    for (int t = 0; t < record.count(); t++)
+    {
+        for (int p = 0; p < selected.count(); p++)
+        {
+            values[p] = record.column(selected[p])[t];
+        }
+        for (int k = 0; k < derived.count(); k++)
+        {
+            values[selected.count() + k] = derived[k][t];
+        }
+        addPeriod(values.constData());
+    }
+
+    endRun();
+}
+
+void ResultFile::toRecord(int i, PropertyRecord &record) const
+{
+    const ResultRunInfo &info = runs.at(i);
+
+    record.first_period = info.first_period;
+    for (auto it = Domain::propertyMap.constBegin();
+         it != Domain::propertyMap.constEnd(); ++it)
+    {
+        int p = propertyIndex(i, it.key());
+        record.columns[int(it.value())] = p < 0 ? QVector<double>(info.periods, 0)
+                                                : column(i, p);
+    }
+}
+
+#endif // RESULT_FILE_STANDALONE
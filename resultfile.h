@@ -0,0 +1,251 @@
+#ifndef RESULTFILE_H
+#define RESULTFILE_H
+
+#ifndef RESULT_FILE_STANDALONE
+#include "account.h"
+#endif
+
+#include <QFile>
+#include <QList>
+#include <QMap>
+#include <QSaveFile>
+#include <QString>
+#include <QStringList>
+#include <QVector>
+
+/******************************************************************************
+ * Binary results files
+ *
+ * A results file holds the recorded values of one or more runs (e.g. one per
+ * domain, or one per point of a sweep) much more compactly than CSV, in a
+ * form that can be read back without parsing it. It is written by
+ * ResultFileWriter and read by ResultFile.
+ *
+ * Analysis tools can use these on their own by compiling resultfile.cpp with
+ * RESULT_FILE_STANDALONE defined, in which case they depend only on QtCore
+ * and the parts that deal with domains and PropertyRecords are left out.
+ *
+ * All values are in the byte order of the machine that wrote the file (which
+ * is checked on reading). Strings are held as a 32-bit length followed by
+ * UTF-8.
+ *
+ *     header       "OBRF", byte order mark, format version, value type
+ *                  (0 for doubles, 1 for floats)
+ *     for each run:
+ *       run header   domain name, seed, first period, the parameters (count,
+ *                    then settings key and value for each) and the names of
+ *                    the properties recorded (count, then names)
+ *       chunks       the values of one property for up to RESULT_CHUNK_PERIODS
+ *                    consecutive periods, as raw fixed-width values, starting
+ *                    on an 8-byte boundary
+ *     index        number of runs, then for each run the offset of its
+ *                  header, its first period, its number of periods and its
+ *                  number of chunks, and for each chunk its property (as an
+ *                  index into the run's property names), its first period
+ *                  (relative to the run's first period), its number of
+ *                  periods and its offset
+ *     trailer      offset of the index, "OBRX"
+ *
+ * A reader maps the file, finds the index from the trailer, and can then go
+ * straight to the chunks holding any range of periods of any property.
+ ******************************************************************************/
+
+/*
+ * Number of periods per chunk. The writer holds one chunk per property in
+ * memory, so this bounds the memory it uses however long the run.
+ */
+#define RESULT_CHUNK_PERIODS 4096
+
+/*
+ * The suffix the GUI gives results files
+ */
+#define RESULT_FILE_SUFFIX ".obres"
+
+enum class ResultValueType : quint32
+{
+    f64,
+    f32
+};
+
+/*
+ * The header of a run, as written to and read from a file
+ */
+struct ResultRunInfo
+{
+    QString name;
+    quint64 seed = 0;
+    int first_period = 0;
+    int periods = 0;
+
+    /*
+     * Parameter values by settings key (see Domain::parameterKeys)
+     */
+    QMap<QString,int> parameters;
+
+    QStringList properties;
+
+#ifndef RESULT_FILE_STANDALONE
+    /*
+     * Fill in the name, seed and parameters from a domain
+     */
+    static ResultRunInfo fromDomain(const Domain *dom);
+#endif
+};
+
+/******************************************************************************
+ * ResultFileWriter writes a results file a period at a time (for a run in
+ * progress) or a record at a time. The file is only replaced when close()
+ * succeeds.
+ ******************************************************************************/
+
+class ResultFileWriter
+{
+public:
+
+    ResultFileWriter(ResultValueType type = ResultValueType::f64);
+    ~ResultFileWriter();
+
+    bool open(const QString &fileName, QString &error);
+
+    /*
+     * Start a new run. Only the name, seed, first period, parameters and
+     * properties of info are used.
+     */
+    void beginRun(const ResultRunInfo &info);
+
+    /*
+     * Add the values of the properties of the current run (in the order
+     * given to beginRun) for its next period
+     */
+    void addPeriod(const double *values);
+
+    void endRun();
+
+#ifndef RESULT_FILE_STANDALONE
+    /*
+     * Write a whole run from a record. The properties are written in the
+     * order of the keys of properties, under the names given, followed by
+     * any derived properties (see DerivedProperties), with a column of values
+     * for each calculated from the record.
+     */
+    void addRecord(ResultRunInfo info, const PropertyRecord &record,
+                   const QMap<Property,QString> &properties,
+                   const QStringList &derived_names = QStringList(),
+                   const QVector<QVector<double>> &derived = QVector<QVector<double>>());
+#endif
+
+    /*
+     * Write the index and replace the file. On failure, returns false and
+     * sets error.
+     */
+    bool close(QString &error);
+
+private:
+
+    struct Chunk
+    {
+        quint32 property;
+        quint32 first;
+        quint32 count;
+        quint64 offset;
+    };
+
+    struct Run
+    {
+        quint64 offset;
+        qint32 first_period;
+        quint32 periods;
+        QVector<Chunk> chunks;
+    };
+
+    QSaveFile file;
+    ResultValueType type;
+    bool ok = true;
+
+    QVector<Run> runs;
+    bool in_run = false;
+
+    /*
+     * The values of the chunk in progress for each property of the current
+     * run
+     */
+    QVector<QVector<double>> pending;
+
+    void putRaw(const void *data, qint64 bytes);
+    void putString(const QString &s);
+    void align();
+    void writeChunks();
+
+    template <typename T>
+    void put(const T &value)
+    {
+        putRaw(&value, sizeof(T));
+    }
+};
+
+/******************************************************************************
+ * ResultFile reads a results file by mapping it into memory. Opening it reads
+ * only the index and the run headers; values are read on request, from just
+ * the chunks that hold them.
+ ******************************************************************************/
+
+class ResultFile
+{
+public:
+
+    ResultFile();
+    ~ResultFile();
+
+    /*
+     * On failure, returns false and sets error
+     */
+    bool open(const QString &fileName, QString &error);
+    void close();
+
+    ResultValueType valueType() const;
+
+    int runCount() const;
+    const ResultRunInfo &run(int i) const;
+
+    /*
+     * The index of the named property in run i, or -1 if it wasn't recorded
+     */
+    int propertyIndex(int i, const QString &name) const;
+
+    /*
+     * Copy the values of property p of run i for count periods, starting at
+     * period first (counted from the run's first period) into values. Returns
+     * false if the range is out of bounds.
+     */
+    bool read(int i, int p, int first, int count, double *values) const;
+
+    QVector<double> column(int i, int p) const;
+
+#ifndef RESULT_FILE_STANDALONE
+    /*
+     * Fill a PropertyRecord with run i. Properties are matched by name (see
+     * Domain::propertyMap) and any that weren't recorded are set to zero.
+     */
+    void toRecord(int i, PropertyRecord &record) const;
+#endif
+
+private:
+
+    struct Chunk
+    {
+        int property;
+        int first;
+        int count;
+        const uchar *data;
+    };
+
+    QFile file;
+    const uchar *data = nullptr;
+    qint64 size = 0;
+    ResultValueType type = ResultValueType::f64;
+
+    QList<ResultRunInfo> runs;
+    QVector<QVector<Chunk>> chunks;     // for each run
+};
+
+#endif // RESULTFILE_H
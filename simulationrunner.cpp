@@ -0,0 +1,292 @@
+#include "simulationrunner.h"
+#include "account.h"
+#include "log.h"
+#include "parallel.h"
+
+#include <QDebug>
+#include <QSettings>
+
+#include <algorithm>
+
+/*
+ * Minimum interval between chart updates while a run is in progress. Each
+ * update copies and redraws every series, so this limits the share of the GUI
+ * thread's time spent on it however fast the model runs.
+ */
+#define CHART_REFRESH_MS 100
+
+SimulationRunner::SimulationRunner(QObject *parent) : QThread(parent)
+{
+    cancelled = false;
+    periods_done = 0;
+
+    refresh_timer.setInterval(CHART_REFRESH_MS);
+    connect(&refresh_timer, &QTimer::timeout, this, &SimulationRunner::refresh);
+
+    /*
+     * QThread::finished is emitted on the thread that ran the domains, so this
+     * is a queued connection and finish() is called on the GUI thread
+     */
+    connect(this, &QThread::finished, this, &SimulationRunner::finish);
+}
+
+SimulationRunner::~SimulationRunner()
+{
+    cancelRun();
+}
+
+void SimulationRunner::startRun(QListWidget *propertyList)
+{
+    cancelRun();
+
+    this->propertyList = propertyList;
+
+    QSettings settings;
+    iterations = settings.value("iterations", 100).toInt();
+    start_period = settings.value("start-period").toInt();
+    ensemble_size = settings.value("ensemble-size", 1).toInt();
+    tolerance = settings.value("ensemble-tolerance", 0).toDouble() / 100;
+
+    const int end = iterations + start_period;
+    const int count = Domain::domains.count();
+
+    cancelled = false;
+    periods_done = 0;
+    periods_total = 0;
+
+    run_hashes.fill(QByteArray(), count);
+    result_keys.fill(QByteArray(), count);
+    cached.fill(false, count);
+    dirty.fill(false, count);
+    completed.fill(false, count);
+
+    for (int i = 0; i < count; i++)
+    {
+        Domain *dom = Domain::domains[i];
+
+        /*
+         * A domain that already holds the results of a complete run with
+         * the current configuration is left alone, chart and all
+         */
+        dom->readSettings();
+        result_keys[i] = resultKey(dom);
+
+        if (results.value(dom) == result_keys[i])
+        {
+            continue;
+        }
+
+        dirty[i] = true;
+        results.remove(dom);
+        periods_total += (end + 1) * std::max(1, ensemble_size);
+
+        /*
+         * A domain that was last run (not loaded from the cache) with the
+         * same configuration, to no later than the new end, is simply run on
+         * from where it stopped
+         */
+        QByteArray config = dom->runHash(0, start_period);
+
+        if (ensemble_size <= 1 && dom->lastPeriod() >= 0
+                && dom->lastPeriod() <= end && configs.value(dom) == config)
+        {
+            LOG_DEBUG(LogCategory::runs) << "Continuing domain" << dom->getName() << "from period"
+                     << dom->lastPeriod() + 1;
+            periods_done += dom->lastPeriod() + 1;
+            run_hashes[i] = dom->runHash(iterations, start_period);
+            continue;
+        }
+
+        LOG_DEBUG(LogCategory::runs) << "Initialising domain" << dom->getName();
+        dom->reset();
+        configs[dom] = config;
+
+        PropertyRecord record;
+        if (ensemble_size <= 1 && cache.isEnabled())
+        {
+            run_hashes[i] = dom->runHash(iterations, start_period);
+
+            /*
+             * A run being profiled has to be made even if its results are
+             * known
+             */
+            cached[i] = !Profiler::isEnabled()
+                    && cache.load(run_hashes[i], record);
+        }
+
+        if (cached[i])
+        {
+            LOG_DEBUG(LogCategory::runs) << "Using cached results for" << dom->getName();
+            dom->restoreRecord(record);
+            periods_done += end + 1;
+            completed[i] = true;
+        }
+        else
+        {
+            dom->reserveRecord(iterations + 1);
+        }
+    }
+
+    /*
+     * Set up the charts of the domains to be run with the values recorded so
+     * far, to be added to as the run progresses
+     */
+    for (int i = 0; i < count; i++)
+    {
+        if (dirty[i])
+        {
+            Domain::domains[i]->redrawChart(propertyList);
+        }
+    }
+    emit progress(periods_done, periods_total);
+
+    QThread::start();
+    refresh_timer.start();
+}
+
+void SimulationRunner::cancelRun()
+{
+    if (isRunning())
+    {
+        LOG_DEBUG(LogCategory::runs) << "Cancelling run";
+        cancelled = true;
+        wait();
+    }
+}
+
+void SimulationRunner::invalidate(const Domain *dom)
+{
+    results.remove(dom);
+    configs.remove(dom);
+}
+
+/*
+ * Runs on the background thread
+ */
+void SimulationRunner::run()
+{
+    /*
+     * Domains don't interact, so each one can be run for the whole period on
+     * its own thread with no need to synchronise them between periods. (If
+     * domains ever do interact, e.g. by trading, the periods will need to be
+     * run one at a time with a parallelFor for each period, and the
+     * interaction done between them.) Each domain only touches its own data,
+     * and draws from its own random streams, so the results don't depend on
+     * the number of threads or on scheduling.
+     *
+     * In ensemble mode each domain is run many times. The runs for each
+     * domain are made in parallel, so the domains themselves are run one
+     * after the other.
+     */
+    /*
+     * Each thread only sets its own domain's flag (the vector has been
+     * detached on the GUI thread, so this doesn't reallocate it)
+     */
+    bool *done = completed.data();
+
+    if (ensemble_size > 1)
+    {
+        for (int i = 0; i < Domain::domains.count(); i++)
+        {
+            if (cancelled)
+            {
+                break;
+            }
+            if (!dirty[i])
+            {
+                continue;
+            }
+            Domain::domains[i]->runEnsemble(ensemble_size, tolerance, iterations,
+                                            start_period, &cancelled, &periods_done);
+            done[i] = !cancelled;
+        }
+    }
+    else
+    {
+        parallelFor(Domain::domains.count(), [this, done](int i) {
+            if (!dirty[i] || cached[i])
+            {
+                return;
+            }
+
+            Domain *dom = Domain::domains.at(i);
+            for (int period = dom->lastPeriod() + 1;
+                 period <= iterations + start_period; period++)
+            {
+                if (cancelled)
+                {
+                    return;
+                }
+                dom->iterate(period, period < start_period);
+                ++periods_done;
+            }
+
+            done[i] = true;
+
+            if (!run_hashes[i].isEmpty() && cache.isEnabled())
+            {
+                cache.store(run_hashes[i], dom->recorded());
+            }
+        });
+    }
+}
+
+void SimulationRunner::refresh()
+{
+    for (int i = 0; i < dirty.count(); i++)
+    {
+        if (dirty[i])
+        {
+            Domain::domains[i]->updateChart();
+        }
+    }
+    emit progress(periods_done, periods_total);
+}
+
+void SimulationRunner::finish()
+{
+    /*
+     * A run may have been cancelled and another one started before the
+     * signal from the first one arrived
+     */
+    if (isRunning())
+    {
+        return;
+    }
+
+    refresh_timer.stop();
+
+    /*
+     * Redraw in full (rather than just refilling the series) so that any
+     * ensemble bands are shown. Domains whose runs were completed now hold
+     * the results for their configuration, so needn't be run again until it
+     * changes.
+     */
+    for (int i = 0; i < dirty.count(); i++)
+    {
+        if (dirty[i])
+        {
+            Domain *dom = Domain::domains[i];
+            dom->redrawChart(propertyList);
+            if (completed[i])
+            {
+                results[dom] = result_keys[i];
+            }
+        }
+    }
+
+    emit progress(cancelled ? int(periods_done) : periods_total, periods_total);
+    emit runFinished(cancelled);
+}
+
+QByteArray SimulationRunner::resultKey(const Domain *dom) const
+{
+    QByteArray key = dom->runHash(iterations, start_period);
+
+    if (ensemble_size > 1)
+    {
+        key += "/" + QByteArray::number(ensemble_size)
+                + "/" + QByteArray::number(tolerance);
+    }
+    return key;
+}
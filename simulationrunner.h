@@ -0,0 +1,142 @@
+#ifndef SIMULATIONRUNNER_H
+#define SIMULATIONRUNNER_H
+
+#include "resultcache.h"
+
+#include <QListWidget>
+#include <QMap>
+#include <QThread>
+#include <QTimer>
+#include <QVector>
+
+#include <atomic>
+
+/******************************************************************************
+ * SimulationRunner runs all the domains on a background thread so that the
+ * GUI stays responsive, and keeps the charts up to date while it does so.
+ *
+ * The charts are set up (with empty series) when a run starts. While it is in
+ * progress they are refilled from the domains' records at a bounded rate (see
+ * CHART_REFRESH_MS), each series being replaced in one go rather than a point
+ * at a time, and they are redrawn in full when the run has finished. Progress
+ * is reported as the number of periods run so far out of the total.
+ *
+ * If nothing but the number of iterations has changed since a domain was last
+ * run, and it is to be run for longer, it is simply run on from the end of
+ * the last run (or from wherever a cancelled run stopped), adding to the
+ * values already recorded. Otherwise it is reset and run from the start.
+ *
+ * Only the domains whose configuration (parameters, seed, number of
+ * iterations, ensemble size, etc.) has changed since they were last run to
+ * completion, or that haven't been run yet, are run. The others keep their
+ * recorded values, and their charts aren't touched. Domains don't interact,
+ * so a change to one never affects the results of another.
+ *
+ * Single runs (but not ensembles) are looked up in a ResultCache before they
+ * are made from the start. A domain whose run is found there isn't run at all, and the
+ * records of the domains that are run are added to the cache when the run
+ * has finished (unless it was cancelled). While profiling is enabled (see
+ * Profiler) runs are always made, so that they can be timed.
+ *
+ * A run can be cancelled at any time, and starting a new run cancels the one
+ * in progress. Nothing else may change a domain (its parameters, or the list
+ * of domains) while a run is in progress, so cancelRun() must be called
+ * first.
+ ******************************************************************************/
+
+class SimulationRunner : public QThread
+{
+    Q_OBJECT
+
+public:
+
+    SimulationRunner(QObject *parent = nullptr);
+    ~SimulationRunner() override;
+
+    /*
+     * Cancel any run in progress and start running the domains whose
+     * configuration has changed for the number of periods given in settings
+     */
+    void startRun(QListWidget *propertyList);
+
+    /*
+     * Stop the run in progress, if any, and wait for it to stop. The values
+     * recorded so far are kept.
+     */
+    void cancelRun();
+
+    /*
+     * Forget that the domain has been run, e.g. because its record has been
+     * replaced, so that the next run starts it afresh
+     */
+    void invalidate(const Domain *dom);
+
+signals:
+
+    void progress(int periods_done, int periods_total);
+
+    /*
+     * Emitted on the GUI thread when a run has finished and the charts have
+     * been redrawn
+     */
+    void runFinished(bool cancelled);
+
+protected:
+
+    void run() override;
+
+private:
+
+    QListWidget *propertyList = nullptr;
+    QTimer refresh_timer;
+
+    int iterations = 100;
+    int start_period = 0;
+    int ensemble_size = 1;
+    double tolerance = 0;
+
+    std::atomic<bool> cancelled;
+    std::atomic<int> periods_done;
+    int periods_total = 0;
+
+    ResultCache cache;
+
+    /*
+     * For each domain (in the order of Domain::domains), its run hash and
+     * whether its record was found in the cache
+     */
+    QVector<QByteArray> run_hashes;
+    QVector<bool> cached;
+
+    /*
+     * For each domain, the key of the results it is to hold when the run is
+     * complete (see resultKey), whether it needs to be run (or loaded from
+     * the cache) at all, and whether it has been completed
+     */
+    QVector<QByteArray> result_keys;
+    QVector<bool> dirty;
+    QVector<bool> completed;
+
+    /*
+     * The key of the complete results each domain holds, if any
+     */
+    QMap<const Domain *, QByteArray> results;
+
+    /*
+     * The configuration (see Domain::runHash) each domain was last reset
+     * with, used to decide whether it can be continued rather than reset
+     */
+    QMap<const Domain *, QByteArray> configs;
+
+    void refresh();
+    void finish();
+
+    /*
+     * Identifies the results of running a domain with its current
+     * configuration and the run settings: its run hash, plus the ensemble
+     * settings in ensemble mode
+     */
+    QByteArray resultKey(const Domain *dom) const;
+};
+
+#endif // SIMULATIONRUNNER_H
@@ -0,0 +1,369 @@
+#include "sweep.h"
+#include "parallel.h"
+
+#include <QFile>
+#include <QRegExp>
+#include <QStringList>
+
+#include <algorithm>
+#include <mutex>
+
+Sweep::Sweep(const Domain *base)
+{
+    this->base = base;
+}
+
+bool Sweep::parameterFromKey(const QString &key, ParamType &param)    // static
+{
+    for (auto it = Domain::parameterKeys.constBegin();
+         it != Domain::parameterKeys.constEnd(); ++it)
+    {
+        if (it.value() == key)
+        {
+            param = it.key();
+            return true;
+        }
+    }
+    return false;
+}
+
+QString Sweep::domainName(const QString &run_name, int *point)    // static
+{
+    QRegExp suffix(" #(\\d+)$");
+    int pos = suffix.indexIn(run_name);
+
+    if (point != nullptr)
+    {
+        *point = pos < 0 ? -1 : suffix.cap(1).toInt();
+    }
+
+    return pos < 0 ? run_name : run_name.left(pos);
+}
+
+bool Sweep::addAxis(const QString &spec, QString &error)
+{
+    int eq = spec.indexOf('=');
+    if (eq < 0)
+    {
+        error = "Expected key=values in \"" + spec + "\"";
+        return false;
+    }
+
+    QString key = spec.left(eq).trimmed();
+    QString values = spec.mid(eq + 1).trimmed();
+
+    Axis axis;
+    if (!parameterFromKey(key, axis.param))
+    {
+        error = "Unknown parameter \"" + key + "\"";
+        return false;
+    }
+
+    if (list_params.contains(axis.param))
+    {
+        error = "Parameter \"" + key + "\" is also in the list of points";
+        return false;
+    }
+
+    bool ok = true;
+    QStringList range = values.split(':');
+
+    if (range.count() == 3)
+    {
+        int first = range[0].toInt(&ok);
+        int last = ok ? range[1].toInt(&ok) : 0;
+        int step = ok ? range[2].toInt(&ok) : 0;
+
+        if (!ok || step <= 0 || last < first)
+        {
+            error = "Invalid range \"" + values + "\" for " + key;
+            return false;
+        }
+
+        for (int v = first; v <= last; v += step)
+        {
+            axis.values.append(v);
+        }
+    }
+    else
+    {
+        foreach (QString s, values.split(','))
+        {
+            axis.values.append(s.trimmed().toInt(&ok));
+            if (!ok)
+            {
+                error = "Invalid value \"" + s + "\" for " + key;
+                return false;
+            }
+        }
+    }
+
+    /*
+     * Each parameter has one column, so a repeated axis replaces the earlier
+     * one
+     */
+    for (int a = 0; a < axes.count(); a++)
+    {
+        if (axes[a].param == axis.param)
+        {
+            axes[a] = axis;
+            return true;
+        }
+    }
+
+    axes.append(axis);
+    return true;
+}
+
+bool Sweep::readPoints(const QString &fileName, QString &error)
+{
+    QFile file(fileName);
+    if (!file.open(QIODevice::ReadOnly | QIODevice::Text))
+    {
+        error = "Cannot open " + fileName;
+        return false;
+    }
+
+    QTextStream in(&file);
+    QRegExp sep("[,\\t]");
+
+    list_params.clear();
+    list_points.clear();
+
+    foreach (QString key, in.readLine().split(sep))
+    {
+        ParamType p;
+        if (!parameterFromKey(key.trimmed(), p))
+        {
+            error = "Unknown parameter \"" + key.trimmed() + "\" in " + fileName;
+            return false;
+        }
+        if (list_params.contains(p))
+        {
+            error = "Parameter \"" + key.trimmed() + "\" is repeated in " + fileName;
+            return false;
+        }
+        foreach (const Axis &axis, axes)
+        {
+            if (axis.param == p)
+            {
+                error = "Parameter \"" + key.trimmed() + "\" in " + fileName
+                        + " is also given as an axis";
+                return false;
+            }
+        }
+        list_params.append(p);
+    }
+
+    int line_number = 1;
+    while (!in.atEnd())
+    {
+        QString line = in.readLine();
+        line_number++;
+
+        if (line.trimmed().isEmpty())
+        {
+            continue;
+        }
+
+        QStringList fields = line.split(sep);
+        if (fields.count() != list_params.count())
+        {
+            error = fileName + ", line " + QString::number(line_number)
+                    + ": expected " + QString::number(list_params.count())
+                    + " values";
+            return false;
+        }
+
+        QVector<int> values;
+        foreach (QString s, fields)
+        {
+            bool ok;
+            values.append(s.trimmed().toInt(&ok));
+            if (!ok)
+            {
+                error = fileName + ", line " + QString::number(line_number)
+                        + ": invalid value \"" + s + "\"";
+                return false;
+            }
+        }
+        list_points.append(values);
+    }
+
+    return true;
+}
+
+void Sweep::setProperties(const QMap<Property,QString> &properties)
+{
+    this->properties = properties;
+}
+
+void Sweep::setPeriods(int iterations, int start_period)
+{
+    this->iterations = iterations;
+    this->start_period = start_period;
+}
+
+void Sweep::setMaxThreads(int threads)
+{
+    max_threads = threads;
+}
+
+int Sweep::count() const
+{
+    int n = list_params.isEmpty() ? 1 : list_points.count();
+    foreach (const Axis &axis, axes)
+    {
+        n *= axis.values.count();
+    }
+    return n;
+}
+
+QList<ParamType> Sweep::columns() const
+{
+    QList<ParamType> cols = list_params;
+    foreach (const Axis &axis, axes)
+    {
+        cols.append(axis.param);
+    }
+    return cols;
+}
+
+/*
+ * The last axis varies fastest, and the list of points slowest
+ */
+QVector<int> Sweep::point(int i) const
+{
+    QVector<int> values(list_params.count() + axes.count());
+
+    for (int a = axes.count() - 1; a >= 0; a--)
+    {
+        const QVector<int> &v = axes[a].values;
+        values[list_params.count() + a] = v[i % v.count()];
+        i /= v.count();
+    }
+
+    for (int p = 0; p < list_params.count(); p++)
+    {
+        values[p] = list_points[i][p];
+    }
+
+    return values;
+}
+
+QString Sweep::runPoint(int i, const QVector<int> &values, QChar sep,
+                        ResultRunInfo *info, PropertyRecord *record) const
+{
+    QList<ParamType> cols = columns();
+    QMap<ParamType,int> overrides;
+    for (int c = 0; c < cols.count(); c++)
+    {
+        overrides[cols[c]] = values[c];
+    }
+
+    Domain *dom = Domain::cloneDomain(base, overrides);
+    dom->setRecordedProperties(properties.keys());
+
+    dom->reserveRecord(iterations + 1);
+
+    for (int period = 0; period <= iterations + start_period; period++)
+    {
+        dom->iterate(period, period < start_period);
+    }
+
+    QString row = QString::number(i);
+    foreach (int v, values)
+    {
+        row += sep + QString::number(v);
+    }
+
+    foreach (Property p, properties.keys())
+    {
+        const QVector<double> &col = dom->recorded().column(p);
+        double last = 0, sum = 0, min = 0, max = 0;
+        if (!col.isEmpty())
+        {
+            last = col.last();
+            min = *std::min_element(col.constBegin(), col.constEnd());
+            max = *std::max_element(col.constBegin(), col.constEnd());
+            foreach (double v, col)
+            {
+                sum += v;
+            }
+        }
+
+        row += sep + QString::number(last)
+                + sep + QString::number(col.isEmpty() ? 0.0 : sum / col.count())
+                + sep + QString::number(min)
+                + sep + QString::number(max);
+    }
+
+    if (record != nullptr)
+    {
+        *info = ResultRunInfo::fromDomain(dom);
+        info->name = dom->getName() + " #" + QString::number(i);
+        *record = dom->recorded();
+    }
+
+    delete dom;
+
+    return row;
+}
+
+void Sweep::run(QTextStream &out, QChar sep)
+{
+    out << "Point";
+    foreach (ParamType p, columns())
+    {
+        out << sep << Domain::parameterKeys.value(p);
+    }
+    foreach (QString name, properties.values())
+    {
+        out << sep << name << " (final)"
+            << sep << name << " (mean)"
+            << sep << name << " (min)"
+            << sep << name << " (max)";
+    }
+    out << "\n";
+    out.flush();
+
+    /*
+     * Rows that have finished ahead of an earlier row are held here until
+     * they can be written
+     */
+    std::mutex mutex;
+    QMap<int,QString> pending;
+    int next_row = 0;
+
+    parallelFor(count(), [&](int i) {
+        QString row = runPoint(i, point(i), sep);
+
+        std::lock_guard<std::mutex> lock(mutex);
+        pending.insert(i, row);
+        while (!pending.isEmpty() && pending.firstKey() == next_row)
+        {
+            out << pending.take(next_row++) << "\n";
+        }
+        out.flush();
+    }, max_threads);
+}
+
+void Sweep::run(ResultFileWriter &out)
+{
+    /*
+     * Unlike the rows above, each run is written as soon as it finishes, so
+     * that no more than one record per thread is held at a time. The runs
+     * are named with their point numbers, and the file's index means that
+     * they can be read in any order.
+     */
+    std::mutex mutex;
+
+    parallelFor(count(), [&](int i) {
+        ResultRunInfo info;
+        PropertyRecord record;
+        runPoint(i, point(i), '\t', &info, &record);
+
+        std::lock_guard<std::mutex> lock(mutex);
+        out.addRecord(info, record, properties);
+    }, max_threads);
+}
@@ -0,0 +1,142 @@
+#ifndef SWEEP_H
+#define SWEEP_H
+
+#include "account.h"
+#include "resultfile.h"
+
+#include <QList>
+#include <QMap>
+#include <QString>
+#include <QTextStream>
+#include <QVector>
+
+/******************************************************************************
+ * Sweep runs a base domain at many different points in parameter space and
+ * writes one summary row per point: the final, mean, minimum and maximum
+ * value of each selected property over the recorded (non-silent) periods.
+ *
+ * The points are the Cartesian product of any number of axes (each giving a
+ * list of values for one parameter) and the rows of a list of points read
+ * from a file. Either may be omitted. Parameters that are not varied keep the
+ * base domain's values.
+ *
+ * Each point is run on a clone of the base domain (see Domain::cloneDomain),
+ * with the same random seed, so that differences between points are due to
+ * the parameters alone. Points are run in parallel, with no more clones in
+ * existence than there are threads, and are deleted as soon as they have
+ * finished. Rows are written in point order as soon as all earlier points
+ * have finished, so the output file is the same however many threads are
+ * used.
+ ******************************************************************************/
+
+class Sweep
+{
+public:
+
+    Sweep(const Domain *base);
+
+    /*
+     * Look up a parameter by its settings key (see Domain::parameterKeys).
+     * Returns false if there is no such parameter.
+     */
+    static bool parameterFromKey(const QString &key, ParamType &param);
+
+    /*
+     * The name of the domain that a run in a results file was made from,
+     * given the name of the run (which for a sweep point is the domain's name
+     * followed by " #" and the point's number). If point isn't nullptr it is
+     * set to the point's number, or -1 if the run isn't a sweep point.
+     */
+    static QString domainName(const QString &run_name, int *point = nullptr);
+
+    /*
+     * Add an axis from a specification of the form key=values, where values
+     * is either a comma-separated list (e.g. prop-invest=10,20,50) or a range
+     * first:last:step (e.g. income-tax-rate=10:40:5). An axis for a
+     * parameter that already has one replaces it. On failure (including a
+     * parameter that is in the list of points), returns false and sets error.
+     */
+    bool addAxis(const QString &spec, QString &error);
+
+    /*
+     * Read a list of points from a file. The first line holds the parameter
+     * keys and each subsequent line the values for one point, separated by
+     * commas or tabs. Each parameter may only appear once, and not also as an
+     * axis. On failure, returns false and sets error.
+     */
+    bool readPoints(const QString &fileName, QString &error);
+
+    /*
+     * The properties to summarise, in Property order, and the names to use
+     * for them in the header. Each point only evaluates these (see
+     * Domain::setRecordedProperties).
+     */
+    void setProperties(const QMap<Property,QString> &properties);
+
+    void setPeriods(int iterations, int start_period);
+
+    /*
+     * Maximum number of points to run at once (default: one per core)
+     */
+    void setMaxThreads(int threads);
+
+    /*
+     * Total number of points
+     */
+    int count() const;
+
+    /*
+     * Write a header line and then a row for each point
+     */
+    void run(QTextStream &out, QChar sep);
+
+    /*
+     * Write the values of the properties for every recorded period of each
+     * point to a results file instead, as a run named after the domain and
+     * the point number, with the point's parameters. The runs are written in
+     * the order in which they finish, not in point order.
+     */
+    void run(ResultFileWriter &out);
+
+private:
+
+    struct Axis
+    {
+        ParamType param;
+        QVector<int> values;
+    };
+
+    const Domain *base;
+
+    QList<Axis> axes;
+
+    QList<ParamType> list_params;
+    QVector<QVector<int>> list_points;
+
+    QMap<Property,QString> properties;
+
+    int iterations = 100;
+    int start_period = 0;
+    int max_threads = 0;
+
+    /*
+     * The parameters that are varied, in column order
+     */
+    QList<ParamType> columns() const;
+
+    /*
+     * The parameter values at point i, in the order given by columns()
+     */
+    QVector<int> point(int i) const;
+
+    /*
+     * Run the point with the given parameter values and return its row (less
+     * the line ending). If record isn't null, the point's run header and
+     * recorded values are also returned.
+     */
+    QString runPoint(int i, const QVector<int> &values, QChar sep,
+                     ResultRunInfo *info = nullptr,
+                     PropertyRecord *record = nullptr) const;
+};
+
+#endif // SWEEP_H
@@ -0,0 +1,166 @@
+#include "timingdialog.h"
+#include "ui_timingdialog.h"
+
+#include "account.h"
+#include "profiler.h"
+
+#include <QDir>
+#include <QFileDialog>
+#include <QMessageBox>
+#include <QTableWidgetItem>
+
+TimingDialog::TimingDialog(QWidget *parent) :
+    QDialog(parent),
+    ui(new Ui::TimingDialog)
+{
+    ui->setupUi(this);
+
+    ui->tableTimings->setColumnCount(4);
+    ui->tableTimings->setHorizontalHeaderLabels(
+                QStringList() << tr("Phase") << tr("Total") << tr("Per period")
+                              << tr("%"));
+}
+
+TimingDialog::~TimingDialog()
+{
+    delete ui;
+}
+
+void TimingDialog::refresh()
+{
+    QString current = ui->comboDomain->currentText();
+
+    ui->comboDomain->blockSignals(true);
+    ui->comboDomain->clear();
+    foreach (Domain *dom, Domain::domains)
+    {
+        ui->comboDomain->addItem(dom->getName());
+    }
+    int index = ui->comboDomain->findText(current);
+    ui->comboDomain->setCurrentIndex(index < 0 ? 0 : index);
+    ui->comboDomain->blockSignals(false);
+
+    showDomain(ui->comboDomain->currentIndex());
+}
+
+void TimingDialog::showDomain(int index)
+{
+    QTableWidget *table = ui->tableTimings;
+    table->setRowCount(0);
+
+    if (index < 0 || index >= Domain::domains.count())
+    {
+        ui->labSummary->setText(tr("No periods timed"));
+        return;
+    }
+
+    ProfileSummary summary(Domain::domains[index]->profiler().snapshot());
+
+    if (summary.periods == 0)
+    {
+        ui->labSummary->setText(Profiler::isEnabled()
+                                ? tr("No periods timed")
+                                : tr("No periods timed (turn on View > Record timings)"));
+        return;
+    }
+
+    const double total = double(summary.duration());
+    const int n = summary.periods;
+
+    auto addRow = [table](const QString &name, const QString &sum,
+                          const QString &mean, const QString &percent) {
+        int row = table->rowCount();
+        table->insertRow(row);
+        table->setItem(row, 0, new QTableWidgetItem(name));
+        QStringList values = QStringList() << sum << mean << percent;
+        for (int c = 0; c < values.count(); c++)
+        {
+            QTableWidgetItem *item = new QTableWidgetItem(values[c]);
+            item->setTextAlignment(Qt::AlignRight | Qt::AlignVCenter);
+            table->setItem(row, c + 1, item);
+        }
+    };
+
+    /*
+     * Times are shown in milliseconds in total and microseconds per period
+     */
+    for (int i = 0; i < int(ProfilePhase::num_phases); i++)
+    {
+        double t = double(summary.phases[i]);
+        addRow(Profiler::phaseName(ProfilePhase(i)),
+               QString::number(t / 1e6, 'f', 3) + " ms",
+               QString::number(t / 1e3 / n, 'f', 1) + " us",
+               QString::number(total > 0 ? 100 * t / total : 0, 'f', 1));
+    }
+    addRow(tr("all phases"), QString::number(total / 1e6, 'f', 3) + " ms",
+           QString::number(total / 1e3 / n, 'f', 1) + " us", "100.0");
+
+    for (int i = 0; i < int(ProfileCounter::num_counters); i++)
+    {
+        addRow(Profiler::counterName(ProfileCounter(i)),
+               QString::number(summary.counts[i]),
+               QString::number(double(summary.counts[i]) / n, 'f', 1), "");
+    }
+
+    table->resizeColumnsToContents();
+    ui->labSummary->setText(tr("%1 periods timed").arg(n));
+}
+
+void TimingDialog::on_comboDomain_currentIndexChanged(int index)
+{
+    showDomain(index);
+}
+
+void TimingDialog::on_btnRefresh_clicked()
+{
+    refresh();
+}
+
+/*
+ * Write the timings of every domain that has any as a single trace, so that
+ * domains run at the same time appear side by side
+ */
+void TimingDialog::on_btnExport_clicked()
+{
+    TraceWriter trace;
+    int count = 0;
+    foreach (Domain *dom, Domain::domains)
+    {
+        QVector<PeriodProfile> profiles = dom->profiler().snapshot();
+        if (!profiles.isEmpty())
+        {
+            trace.addDomain(dom->getName(), profiles);
+            count++;
+        }
+    }
+
+    if (count == 0)
+    {
+        QMessageBox msgBox;
+        msgBox.setText(tr("There are no timings to export"));
+        msgBox.exec();
+        return;
+    }
+
+    QString filename = QFileDialog::getSaveFileName(
+                this, tr("Export trace"), QDir::homePath() + "/obson-trace.json",
+                tr("Trace files (*.json);;All files (*)"));
+
+    if (filename.isEmpty())
+    {
+        return;
+    }
+
+    QString error;
+    if (!trace.write(filename, error))
+    {
+        QMessageBox msgBox;
+        msgBox.setText(error);
+        msgBox.exec();
+    }
+}
+
+void TimingDialog::on_btnClose_clicked()
+{
+    hide();
+}
@@ -0,0 +1,40 @@
+#ifndef TIMINGDIALOG_H
+#define TIMINGDIALOG_H
+
+#include <QDialog>
+
+namespace Ui {
+class TimingDialog;
+}
+
+/*
+ * Shows the time spent in each phase of Domain::iterate, and the counts of
+ * transactions etc., over the periods of the last run of a domain (see
+ * Profiler), and exports the timings of all the domains as a trace
+ */
+class TimingDialog : public QDialog
+{
+    Q_OBJECT
+
+public:
+    explicit TimingDialog(QWidget *parent = nullptr);
+    ~TimingDialog();
+
+    /*
+     * Reload the list of domains and the selected domain's timings
+     */
+    void refresh();
+
+private slots:
+    void on_comboDomain_currentIndexChanged(int index);
+    void on_btnRefresh_clicked();
+    void on_btnExport_clicked();
+    void on_btnClose_clicked();
+
+private:
+    Ui::TimingDialog *ui;
+
+    void showDomain(int index);
+};
+
+#endif // TIMINGDIALOG_H
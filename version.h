@@ -71,4 +71,12 @@
 #define VERSION "0.2.02 (November 2023)"
 // Start of major rewrite to allow multiple domains
 
+/*
+ * ENGINE_VERSION identifies the behaviour of the simulation engine, and is
+ * part of the key for cached results (see ResultCache). It must be increased
+ * whenever a change to the engine changes the results of a run, so that
+ * results from older versions are not used.
+ */
+#define ENGINE_VERSION 2
+
 #endif // VERSION_H
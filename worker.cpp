@@ -1,34 +1,45 @@
 #include "account.h"
+#include "log.h"
 #include <QDebug>
-#include <QMessageBox>
 
-Worker::Worker(Domain *domain) : Account(domain)
+/*
+ * The domain must already have allocated slot ix in its WorkerStore
+ */
+Worker::Worker(Domain *domain, int ix) : Account(domain)
 {
+    this->ix = ix;
     init();
 }
 
 void Worker::init()
 {
-    employer = nullptr;
+    WorkerStore &ws = _domain->wstore;
+
+    ws.employer[ix] = -1;
 
     period_hired = -1;
     period_fired = 0;
-    //average_wages = 0;
+    //ws.average_wages[ix] = 0;
+
+    ws.wages[ix] = 0;
+    ws.benefits[ix] = 0;
+    ws.purchases[ix] = 0;
+    ws.inc_tax[ix] = 0;
+}
 
-    wages = 0;
-    benefits = 0;
-    purchases = 0;
-    inc_tax = 0;
+double Worker::getBalance()
+{
+    return _domain->wstore.balance[ix];
 }
 
 bool Worker::isEmployed()
 {
-    return (employer != nullptr);
+    return (_domain->wstore.employer[ix] >= 0);
 }
 
 bool Worker::isEmployedBy(Account *emp)
 {
-    return (emp == employer);
+    return (emp == getEmployer());
 }
 
 void Worker::setPeriodHired(int period)
@@ -43,7 +54,8 @@ bool Worker::isNewHire(int period)
 
 Firm *Worker::getEmployer()
 {
-    return employer;
+    int e = _domain->wstore.employer[ix];
+    return e < 0 ? nullptr : _domain->employers[e];
 }
 
 /*
@@ -56,8 +68,9 @@ void Worker::trigger(int period)
         last_triggered = period;
 
         double purch;
-        double thresh = _domain->getIncomeThreshold();
-        double prop_con = _domain->getPropCon();
+        double thresh = _domain->parameter(ParamType::inc_thresh);
+        double prop_con = _domain->parameter(ParamType::prop_con);
+        double balance = _domain->wstore.balance[ix];
 
         if (balance <= thresh)
         {
@@ -70,28 +83,58 @@ void Worker::trigger(int period)
 
         if (purch > 0)
         {
-            if (transferSafely(_domain->selectRandomFirm(), purch, this))
+            RandomStream rs = _domain->randomStream(
+                        RandomStream::Purpose::purchase, quint64(ix));
+            if (transferSafely(_domain->selectRandomFirm(rs), purch, this))
             {
-                purchases += purch;
+                _domain->wstore.purchases[ix] += purch;
+                _domain->households.purchases += purch;
             }
         }
     }
 }
 
+/*
+ * Domain::iterate does this for all workers at once, directly on the
+ * WorkerStore
+ */
 void Worker::epilogue(int)
 {
-    average_wages = (wages + average_wages) / 2;
+    WorkerStore &ws = _domain->wstore;
+    ws.average_wages[ix] = (ws.wages[ix] + ws.average_wages[ix]) / 2;
 }
 
 double Worker::agreedWage()
 {
-    return agreed_wage;
+    return _domain->wstore.agreed_wage[ix];
 }
 
 void Worker::setAgreedWage(double wage)
 {
     //qDebug() << "Worker::setAgreedWage() called";
-    agreed_wage = wage;
+    _domain->wstore.agreed_wage[ix] = wage;
+}
+
+/*
+ * As Firm::transferSafely, but using the balance in the WorkerStore
+ */
+bool Worker::transferSafely(Account *recipient, double amount, Account *creditor)
+{
+    double &balance = _domain->wstore.balance[ix];
+
+    if (amount > balance || recipient == nullptr)
+    {
+        // TODO: This needs to go into a log somewhere
+        LOG_DEBUG(LogCategory::transactions) << "Worker::transferSafely(): done (insufficient funds or no recipient)";
+        return false;
+    }
+    else
+    {
+        recipient->credit(amount, creditor);
+        balance -= amount;
+        _domain->households.balance -= amount;
+        return true;
+    }
 }
 
 void Worker::credit(double amount, Account *creditor, bool)
@@ -101,7 +144,11 @@ void Worker::credit(double amount, Account *creditor, bool)
         Q_ASSERT(false);
     }
 
-    Account::credit(amount);        // credit the account
+    WorkerStore &ws = _domain->wstore;
+
+    ws.balance[ix] += amount;       // credit the account
+    _domain->_profiler.count(ProfileCounter::transactions);
+    _domain->households.balance += amount;
 
     if (isEmployedBy(creditor))     // i.e. this is a payment of wages (or bonus)
     {
@@ -110,12 +157,13 @@ void Worker::credit(double amount, Account *creditor, bool)
         // receiving the payment in our capacity as Worker then it's probably
         // benefits or bonus. If not employed at all it must be bonus and we are
         // flagged for deletion. Surprising but perfectly possible.
-        double tax = (amount * _domain->getIncTaxRate()) / 100;
+        double tax = (amount * _domain->parameter(ParamType::inc_tax_rate)) / 100;
 
         if (transferSafely(_domain->government(), tax, this))
         {
-            wages += amount;
-            inc_tax += tax;
+            ws.wages[ix] += amount;
+            ws.inc_tax[ix] += tax;
+            _domain->households.inc_tax += tax;
         }
         else
         {
@@ -127,7 +175,7 @@ void Worker::credit(double amount, Account *creditor, bool)
     }
     else if (creditor == _domain->government())     //i.e. benefits payment
     {
-        benefits += amount;
+        ws.benefits[ix] += amount;
     }
     else
     {
@@ -135,39 +183,38 @@ void Worker::credit(double amount, Account *creditor, bool)
          * Could be a purchase by. There's no reson why this shouldn't be
          * valid, but we need to check the logic...
          */
-        QMessageBox msgBox;
-        msgBox.setText("Unknown reason for crediting worker");
+        qCritical() << "Unknown reason for crediting worker";
         exit(100);
     }
 }
 
 double Worker::getWagesReceived()
 {
-    return wages;
+    return _domain->wstore.wages[ix];
 }
 
 double Worker::getAverageWages()
 {
-    return employer == nullptr ? 0 : average_wages;
+    return isEmployed() ? _domain->wstore.average_wages[ix] : 0;
 }
 
 double Worker::getBenefitsReceived()
 {
-    return benefits;
+    return _domain->wstore.benefits[ix];
 }
 
 double Worker::getPurchasesMade()
 {
-    return purchases;
+    return _domain->wstore.purchases[ix];
 }
 
 void Worker::setEmployer(Firm *emp)
 {
-    employer = emp;
+    _domain->wstore.employer[ix] = (emp == nullptr ? -1 : emp->_employer_ix);
 }
 
 double Worker::getIncTaxPaid()
 {
-    return inc_tax;
+    return _domain->wstore.inc_tax[ix];
 }
 